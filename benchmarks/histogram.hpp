@@ -0,0 +1,105 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace cpp_http::bench {
+/**
+ * Log-linear latency histogram in the style of HdrHistogram.
+ *
+ * Every power of two is split into 128 linear sub-buckets, so any recorded
+ * value is reported within 1/128 (< 0.8%) of its true value across the full
+ * 64-bit range, with a fixed 58 KiB of counters and O(1) recording.
+ * Histograms from different threads are combined with merge().
+ */
+class histogram {
+  static constexpr unsigned sub_bits = 7;
+  static constexpr std::uint64_t sub_count = std::uint64_t{1} << sub_bits;
+  static constexpr std::size_t bucket_count =
+      sub_count + (64 - sub_bits) * sub_count;
+
+  std::vector<std::uint64_t> counts_ =
+      std::vector<std::uint64_t>(bucket_count, 0);
+  std::uint64_t total_{0};
+  std::uint64_t min_{std::numeric_limits<std::uint64_t>::max()};
+  std::uint64_t max_{0};
+  long double sum_{0};
+
+  static std::size_t index_of(std::uint64_t value) {
+    if (value < sub_count) {
+      return static_cast<std::size_t>(value);
+    }
+    const auto exponent = 63U - static_cast<unsigned>(__builtin_clzll(value));
+    const auto shift = exponent - sub_bits;
+    const auto sub = (value >> shift) - sub_count;
+    return static_cast<std::size_t>(sub_count + shift * sub_count + sub);
+  }
+
+  // Highest value that lands in bucket `index`
+  static std::uint64_t highest_equivalent(std::size_t index) {
+    if (index < sub_count) {
+      return index;
+    }
+    const auto shift = (index - sub_count) / sub_count;
+    const auto sub = (index - sub_count) % sub_count;
+    const auto lowest = (sub_count + sub) << shift;
+    return lowest + ((std::uint64_t{1} << shift) - 1);
+  }
+
+public:
+  void record(std::uint64_t value, std::uint64_t count = 1) {
+    counts_[index_of(value)] += count;
+    total_ += count;
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+    sum_ += static_cast<long double>(value) * count;
+  }
+
+  void merge(const histogram &other) {
+    for (std::size_t i = 0; i < bucket_count; ++i) {
+      counts_[i] += other.counts_[i];
+    }
+    total_ += other.total_;
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+    sum_ += other.sum_;
+  }
+
+  void reset() {
+    std::fill(counts_.begin(), counts_.end(), 0);
+    total_ = 0;
+    min_ = std::numeric_limits<std::uint64_t>::max();
+    max_ = 0;
+    sum_ = 0;
+  }
+
+  [[nodiscard]] std::uint64_t count() const { return total_; }
+  [[nodiscard]] std::uint64_t min() const { return total_ == 0 ? 0 : min_; }
+  [[nodiscard]] std::uint64_t max() const { return max_; }
+  [[nodiscard]] double mean() const {
+    return total_ == 0 ? 0.0 : static_cast<double>(sum_ / total_);
+  }
+
+  // Smallest recorded value (within bucket precision) that at least
+  // `percentile` percent of the samples are less than or equal to
+  [[nodiscard]] std::uint64_t value_at_percentile(double percentile) const {
+    if (total_ == 0) {
+      return 0;
+    }
+    const auto wanted = std::max<std::uint64_t>(
+        1, static_cast<std::uint64_t>(
+               std::ceil(percentile / 100.0 * static_cast<double>(total_))));
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < bucket_count; ++i) {
+      seen += counts_[i];
+      if (seen >= wanted) {
+        return std::min(highest_equivalent(i), max_);
+      }
+    }
+    return max_;
+  }
+};
+} // namespace cpp_http::bench
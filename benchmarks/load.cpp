@@ -0,0 +1,465 @@
+// Open-loop HTTP load generator on top of cpp_http::client.
+//
+// Requests are scheduled at a constant rate regardless of how fast the
+// server answers. Latency is measured from the time a request was supposed
+// to be sent, not from when a free connection picked it up, so a stalled
+// server shows up in the percentiles instead of silently lowering the
+// offered load (coordinated omission).
+//
+//   cpp-http-load --rate 2000 --duration 30 --connections 64 --threads 4 \
+//                 --mix benchmarks/mix.example
+//   cpp-http-load --rate 500 --url http://127.0.0.1:12351/simple
+//
+// A mix file has one request per line: "<weight> <METHOD> <url> [body]",
+// blank lines and lines starting with '#' are skipped.
+#include "client/client.hpp"
+#include "client/request_builder.hpp"
+#include "histogram.hpp"
+#include <algorithm>
+#include <array>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/experimental/channel.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/beast/http/string_body.hpp>
+#include <boost/beast/http/verb.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+using clock_type = std::chrono::steady_clock;
+using http_request =
+    cpp_http::client::http_request<boost::beast::http::string_body>;
+
+struct options {
+  double rate{1000};
+  std::chrono::seconds duration{10};
+  std::size_t connections{16};
+  std::size_t threads{1};
+  std::chrono::milliseconds timeout{5000};
+  // Hedge idempotent requests after this long, zero disables hedging
+  std::chrono::milliseconds hedge{0};
+  unsigned retries{0};
+  std::string mix;
+  std::string url;
+};
+
+struct mix_entry {
+  double weight;
+  std::size_t route;
+  http_request request;
+};
+
+struct route_stats {
+  cpp_http::bench::histogram latency;
+  std::uint64_t completed{0};
+  std::uint64_t non_2xx{0};
+  std::uint64_t errors{0};
+
+  void merge(const route_stats &other) {
+    latency.merge(other.latency);
+    completed += other.completed;
+    non_2xx += other.non_2xx;
+    errors += other.errors;
+  }
+};
+
+// Where the time of successful requests went, see client::request_timing.
+// Phases that did not run, like DNS on a reused connection, are not
+// counted.
+struct phase_stats {
+  static constexpr std::array<const char *, 6> names = {
+      "pool wait", "dns", "connect", "tls", "write", "wait for header"};
+  std::array<cpp_http::bench::histogram, 6> phases;
+
+  void record(const cpp_http::client::request_timing &timing) {
+    const std::array<clock_type::duration, 6> durations = {
+        timing.pool_wait(), timing.dns(),   timing.connect(),
+        timing.tls(),       timing.write(), timing.wait()};
+    for (std::size_t i = 0; i < phases.size(); ++i) {
+      if (durations[i] > clock_type::duration::zero()) {
+        phases[i].record(static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(durations[i])
+                .count()));
+      }
+    }
+  }
+
+  void merge(const phase_stats &other) {
+    for (std::size_t i = 0; i < phases.size(); ++i) {
+      phases[i].merge(other.phases[i]);
+    }
+  }
+};
+
+struct job {
+  std::size_t entry;
+  clock_type::time_point intended;
+};
+
+using job_channel =
+    boost::asio::experimental::channel<void(boost::system::error_code, job)>;
+
+void usage() {
+  std::cerr << "usage: cpp-http-load (--mix FILE | --url URL) [--rate N]\n"
+               "         [--duration SECONDS] [--connections N]\n"
+               "         [--threads N] [--timeout MS] [--hedge MS]\n"
+               "         [--retries N]\n";
+}
+
+std::optional<options> parse_options(int argc, char *argv[]) {
+  options opts;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      return std::nullopt;
+    }
+    const std::string value = argv[++i];
+    if (arg == "--rate") {
+      opts.rate = std::stod(value);
+    } else if (arg == "--duration") {
+      opts.duration = std::chrono::seconds{std::stoll(value)};
+    } else if (arg == "--connections") {
+      opts.connections = std::stoul(value);
+    } else if (arg == "--threads") {
+      opts.threads = std::stoul(value);
+    } else if (arg == "--timeout") {
+      opts.timeout = std::chrono::milliseconds{std::stoll(value)};
+    } else if (arg == "--hedge") {
+      opts.hedge = std::chrono::milliseconds{std::stoll(value)};
+    } else if (arg == "--retries") {
+      opts.retries = static_cast<unsigned>(std::stoul(value));
+    } else if (arg == "--mix") {
+      opts.mix = value;
+    } else if (arg == "--url") {
+      opts.url = value;
+    } else {
+      return std::nullopt;
+    }
+  }
+  if (opts.mix.empty() == opts.url.empty() || opts.rate <= 0 ||
+      opts.connections == 0 || opts.threads == 0) {
+    return std::nullopt;
+  }
+  opts.connections = std::max(opts.connections, opts.threads);
+  return opts;
+}
+
+std::optional<mix_entry>
+make_entry(double weight, const std::string &method, const std::string &url,
+           const std::string &body, const options &opts,
+           const std::shared_ptr<cpp_http::client::connection_pool> &pool,
+           std::vector<std::string> &routes) {
+  const auto verb = boost::beast::http::string_to_verb(method);
+  if (verb == boost::beast::http::verb::unknown || weight <= 0) {
+    return std::nullopt;
+  }
+  auto builder = cpp_http::client::request_builder{};
+  builder.method(verb)
+      .base_url(url)
+      .timeout(opts.timeout)
+      .auto_redirect(false)
+      .pool(pool)
+      .hedge(opts.hedge)
+      .retry({opts.retries});
+  if (!body.empty()) {
+    builder.body(body);
+  }
+  auto request = std::move(builder).build();
+  const auto name = method + " " + std::string(request.url.encoded_path());
+  std::size_t route = 0;
+  while (route < routes.size() && routes[route] != name) {
+    ++route;
+  }
+  if (route == routes.size()) {
+    routes.push_back(name);
+  }
+  return mix_entry{weight, route, std::move(request)};
+}
+
+std::optional<std::vector<mix_entry>>
+load_mix(const options &opts, std::vector<std::string> &routes) {
+  std::vector<mix_entry> entries;
+  // Every worker keeps its own connection alive, the per-host limit must
+  // not throttle them
+  cpp_http::client::pool_options pool_options;
+  pool_options.max_connections_per_host = opts.connections;
+  const auto pool = cpp_http::client::connection_pool::create(pool_options);
+  if (!opts.url.empty()) {
+    auto entry = make_entry(1, "GET", opts.url, {}, opts, pool, routes);
+    if (!entry) {
+      return std::nullopt;
+    }
+    entries.push_back(std::move(*entry));
+    return entries;
+  }
+  std::ifstream file{opts.mix};
+  if (!file) {
+    std::cerr << "cannot open " << opts.mix << "\n";
+    return std::nullopt;
+  }
+  std::string line;
+  for (std::size_t number = 1; std::getline(file, line); ++number) {
+    std::istringstream fields{line};
+    double weight = 0;
+    std::string method;
+    std::string url;
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    if (!(fields >> weight >> method >> url)) {
+      std::cerr << opts.mix << ":" << number << ": expected WEIGHT METHOD URL\n";
+      return std::nullopt;
+    }
+    std::string body;
+    std::getline(fields >> std::ws, body);
+    auto entry = make_entry(weight, method, url, body, opts, pool, routes);
+    if (!entry) {
+      std::cerr << opts.mix << ":" << number << ": bad request line\n";
+      return std::nullopt;
+    }
+    entries.push_back(std::move(*entry));
+  }
+  if (entries.empty()) {
+    return std::nullopt;
+  }
+  return entries;
+}
+
+// One io_context per thread. The thread's share of the schedule is
+// interleaved with the other threads: thread t sends request t, t + threads,
+// t + 2 * threads, ... of the global sequence.
+class load_thread {
+  boost::asio::io_context ioc_{1};
+  const options &opts_;
+  const std::vector<mix_entry> &entries_;
+  std::size_t index_;
+  std::size_t connections_;
+  std::vector<route_stats> stats_;
+  phase_stats phases_;
+  clock_type::time_point last_completion_{};
+
+  void schedule(clock_type::time_point start, job_channel &queue,
+                boost::asio::yield_context yield) {
+    std::vector<double> weights;
+    for (const auto &entry : entries_) {
+      weights.push_back(entry.weight);
+    }
+    std::mt19937_64 random{index_ + 1};
+    std::discrete_distribution<std::size_t> pick{weights.begin(),
+                                                 weights.end()};
+    const auto period = std::chrono::duration<double>(1.0 / opts_.rate);
+    const auto end = start + opts_.duration;
+    boost::asio::steady_timer timer{ioc_};
+    boost::system::error_code ec;
+    for (std::uint64_t n = index_;; n += opts_.threads) {
+      const auto intended =
+          start + std::chrono::duration_cast<clock_type::duration>(
+                      period * static_cast<double>(n));
+      if (intended >= end) {
+        break;
+      }
+      timer.expires_at(intended);
+      timer.async_wait(yield[ec]);
+      // Blocks when every connection is busy and the backlog is full. The
+      // intended time is kept, the wait is charged to the request.
+      queue.async_send({}, job{pick(random), intended}, yield[ec]);
+    }
+    queue.close();
+  }
+
+  void work(job_channel &queue, boost::asio::yield_context yield) {
+    boost::system::error_code ec;
+    while (true) {
+      const auto next = queue.async_receive(yield[ec]);
+      if (ec) {
+        break;
+      }
+      const auto &entry = entries_[next.entry];
+      auto &stats = stats_[entry.route];
+      auto response =
+          cpp_http::client::send<boost::beast::http::string_body,
+                                 boost::beast::http::string_body>(
+              entry.request, 0, yield);
+      bool failed = response.has_error();
+      while (!failed && !response.value()->complete()) {
+        failed = response.value()->read(yield).has_error();
+      }
+      const auto now = clock_type::now();
+      last_completion_ = std::max(last_completion_, now);
+      if (failed) {
+        ++stats.errors;
+        continue;
+      }
+      const auto status = static_cast<unsigned>(response.value()->status());
+      if (status < 200 || status > 299) {
+        ++stats.non_2xx;
+      }
+      ++stats.completed;
+      phases_.record(response.value()->timing());
+      stats.latency.record(static_cast<std::uint64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(now -
+                                                               next.intended)
+              .count()));
+    }
+  }
+
+public:
+  load_thread(const options &opts, const std::vector<mix_entry> &entries,
+              std::size_t routes, std::size_t index)
+      : opts_(opts), entries_(entries), index_(index),
+        connections_(opts.connections / opts.threads +
+                     (index < opts.connections % opts.threads ? 1 : 0)),
+        stats_(routes) {}
+
+  void run(clock_type::time_point start) {
+    auto queue = std::make_shared<job_channel>(ioc_, 65536);
+    boost::asio::spawn(
+        ioc_,
+        [this, start, queue](boost::asio::yield_context yield) {
+          schedule(start, *queue, yield);
+        },
+        boost::asio::detached);
+    for (std::size_t i = 0; i < connections_; ++i) {
+      boost::asio::spawn(
+          ioc_,
+          [this, queue](boost::asio::yield_context yield) {
+            work(*queue, yield);
+          },
+          boost::asio::detached);
+    }
+    ioc_.run();
+  }
+
+  [[nodiscard]] const std::vector<route_stats> &stats() const {
+    return stats_;
+  }
+  [[nodiscard]] const phase_stats &phases() const { return phases_; }
+  [[nodiscard]] clock_type::time_point last_completion() const {
+    return last_completion_;
+  }
+};
+
+std::string format_latency(std::uint64_t nanoseconds) {
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(3)
+      << static_cast<double>(nanoseconds) / 1e6;
+  return out.str();
+}
+
+void print_row(const std::string &name, const route_stats &stats,
+               double elapsed) {
+  const auto &latency = stats.latency;
+  std::cout << std::left << std::setw(32) << name << std::right
+            << std::setw(10) << stats.completed << std::setw(8)
+            << stats.errors << std::setw(8) << stats.non_2xx << std::setw(11)
+            << std::fixed << std::setprecision(1)
+            << static_cast<double>(stats.completed) / elapsed;
+  for (const double percentile : {50.0, 90.0, 99.0, 99.9, 99.99}) {
+    std::cout << std::setw(10)
+              << format_latency(latency.value_at_percentile(percentile));
+  }
+  std::cout << std::setw(10) << format_latency(latency.max()) << "\n";
+}
+
+void report(const std::vector<std::string> &routes,
+            const std::vector<route_stats> &stats, const options &opts,
+            double elapsed) {
+  std::cout << "target rate " << opts.rate << " req/s for "
+            << opts.duration.count() << " s, " << opts.connections
+            << " connections on " << opts.threads << " threads\n"
+            << "latency in ms from the intended send time\n\n";
+  std::cout << std::left << std::setw(32) << "route" << std::right
+            << std::setw(10) << "requests" << std::setw(8) << "errors"
+            << std::setw(8) << "non2xx" << std::setw(11) << "req/s"
+            << std::setw(10) << "p50" << std::setw(10) << "p90"
+            << std::setw(10) << "p99" << std::setw(10) << "p99.9"
+            << std::setw(10) << "p99.99" << std::setw(10) << "max" << "\n";
+  route_stats total;
+  for (std::size_t i = 0; i < routes.size(); ++i) {
+    print_row(routes[i], stats[i], elapsed);
+    total.merge(stats[i]);
+  }
+  if (routes.size() > 1) {
+    print_row("total", total, elapsed);
+  }
+}
+
+void report_phases(const phase_stats &stats) {
+  std::cout << "\nphases in ms\n\n"
+            << std::left << std::setw(32) << "phase" << std::right
+            << std::setw(10) << "count" << std::setw(10) << "p50"
+            << std::setw(10) << "p90" << std::setw(10) << "p99"
+            << std::setw(10) << "max" << "\n";
+  for (std::size_t i = 0; i < stats.phases.size(); ++i) {
+    const auto &phase = stats.phases[i];
+    std::cout << std::left << std::setw(32) << phase_stats::names[i]
+              << std::right << std::setw(10) << phase.count();
+    for (const double percentile : {50.0, 90.0, 99.0}) {
+      std::cout << std::setw(10)
+                << format_latency(phase.value_at_percentile(percentile));
+    }
+    std::cout << std::setw(10) << format_latency(phase.max()) << "\n";
+  }
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+  const auto opts = parse_options(argc, argv);
+  if (!opts) {
+    usage();
+    return EXIT_FAILURE;
+  }
+  std::vector<std::string> routes;
+  const auto entries = load_mix(*opts, routes);
+  if (!entries) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  std::vector<std::unique_ptr<load_thread>> workers;
+  for (std::size_t i = 0; i < opts->threads; ++i) {
+    workers.push_back(std::make_unique<load_thread>(*opts, *entries,
+                                                    routes.size(), i));
+  }
+  // Leave the threads a moment to start before the first intended send
+  const auto start = clock_type::now() + std::chrono::milliseconds{100};
+  std::vector<std::thread> threads;
+  for (auto &worker : workers) {
+    threads.emplace_back([&worker, start] { worker->run(start); });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  std::vector<route_stats> stats(routes.size());
+  phase_stats phases;
+  auto finish = start;
+  for (const auto &worker : workers) {
+    phases.merge(worker->phases());
+    for (std::size_t i = 0; i < routes.size(); ++i) {
+      stats[i].merge(worker->stats()[i]);
+    }
+    finish = std::max(finish, worker->last_completion());
+  }
+  const auto elapsed = std::max(
+      std::chrono::duration<double>(finish - start).count(), 1e-9);
+  report(routes, stats, *opts, elapsed);
+  report_phases(phases);
+  return EXIT_SUCCESS;
+}
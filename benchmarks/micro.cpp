@@ -0,0 +1,360 @@
+// Microbenchmarks for the per-request hot paths.
+//
+// Every benchmark reports allocs/op next to the time per iteration. For a
+// diffable record between commits run
+//   cpp-http-bench --benchmark_out=bench.json --benchmark_out_format=json
+// and compare two files with Google Benchmark's tools/compare.py.
+#include "client/request_builder.hpp"
+#include "client/request_template.hpp"
+#include "client/response.hpp"
+#include "client/sse_parser.hpp"
+#include "message.hpp"
+#include "server/matcher.hpp"
+#include "server/request.hpp"
+#include <atomic>
+#include <benchmark/benchmark.h>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/beast/http/serializer.hpp>
+#include <boost/beast/http/string_body.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace {
+std::atomic<std::uint64_t> allocations{0};
+} // namespace
+
+void *operator new(std::size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size == 0 ? 1 : size)) {
+    return p;
+  }
+  throw std::bad_alloc{};
+}
+void *operator new[](std::size_t size) { return ::operator new(size); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+using beast_request =
+    boost::beast::http::request<boost::beast::http::string_body>;
+
+// Counts allocations made between construction and report()
+class allocation_counter {
+  benchmark::State &state_;
+  std::uint64_t start_;
+
+public:
+  explicit allocation_counter(benchmark::State &state)
+      : state_(state), start_(allocations.load(std::memory_order_relaxed)) {}
+
+  void report() {
+    const auto count = allocations.load(std::memory_order_relaxed) - start_;
+    state_.counters["allocs/op"] = benchmark::Counter(
+        static_cast<double>(count), benchmark::Counter::kAvgIterations);
+  }
+};
+
+std::string route_prefix(std::size_t route) {
+  return "/api/route" + std::to_string(route);
+}
+
+// "/api/route<n>/:p0/s1/:p2/..." with `depth` segments after the prefix
+std::string params_pattern(std::size_t route, std::size_t depth) {
+  auto pattern = route_prefix(route);
+  for (std::size_t i = 0; i < depth; ++i) {
+    pattern += i % 2 == 0 ? "/:p" + std::to_string(i)
+                          : "/s" + std::to_string(i);
+  }
+  return pattern;
+}
+
+std::string regex_pattern(std::size_t route, std::size_t depth) {
+  auto pattern = route_prefix(route);
+  for (std::size_t i = 0; i < depth; ++i) {
+    pattern += i % 2 == 0 ? std::string{"/([^/]+)"}
+                          : "/s" + std::to_string(i);
+  }
+  return pattern;
+}
+
+std::string request_path(std::size_t route, std::size_t depth) {
+  auto path = route_prefix(route);
+  for (std::size_t i = 0; i < depth; ++i) {
+    path += i % 2 == 0 ? "/value" + std::to_string(i)
+                       : "/s" + std::to_string(i);
+  }
+  return path;
+}
+
+std::string query_string(std::size_t params) {
+  std::string query;
+  for (std::size_t i = 0; i < params; ++i) {
+    query += i == 0 ? '?' : '&';
+    query += "key" + std::to_string(i) + "=value%20" + std::to_string(i);
+  }
+  return query;
+}
+
+beast_request make_request(std::string target) {
+  beast_request req{boost::beast::http::verb::get, target, 11};
+  req.set(boost::beast::http::field::host, "localhost");
+  req.set(boost::beast::http::field::user_agent, "cpp-http-bench");
+  req.set(boost::beast::http::field::accept, "*/*");
+  return req;
+}
+
+std::string event_data(std::size_t size) {
+  std::string data(size, 'x');
+  for (std::size_t i = 63; i < size; i += 64) {
+    data[i] = ' ';
+  }
+  return data;
+}
+
+// Matches against the last registered route, the worst case of the linear
+// scan in server::dispatch_request
+template <class Matcher, class MakePattern>
+void match_routes(benchmark::State &state, MakePattern make_pattern) {
+  const auto routes = static_cast<std::size_t>(state.range(0));
+  const auto depth = static_cast<std::size_t>(state.range(1));
+  std::vector<std::unique_ptr<cpp_http::server::matcher>> matchers;
+  matchers.reserve(routes);
+  for (std::size_t i = 0; i < routes; ++i) {
+    matchers.push_back(std::make_unique<Matcher>(make_pattern(i, depth)));
+  }
+  cpp_http::server::request request{
+      make_request(request_path(routes - 1, depth))};
+
+  allocation_counter counter{state};
+  for (auto _ : state) {
+    bool matched = false;
+    for (const auto &matcher : matchers) {
+      if (matcher->match(request)) {
+        matched = true;
+        break;
+      }
+    }
+    benchmark::DoNotOptimize(matched);
+  }
+  counter.report();
+}
+
+void BM_path_params_matcher(benchmark::State &state) {
+  match_routes<cpp_http::server::path_params_matcher>(state, params_pattern);
+}
+BENCHMARK(BM_path_params_matcher)
+    ->ArgNames({"routes", "depth"})
+    ->ArgsProduct({{1, 16, 128}, {2, 8}});
+
+void BM_regex_matcher(benchmark::State &state) {
+  match_routes<cpp_http::server::regex_matcher>(state, regex_pattern);
+}
+BENCHMARK(BM_regex_matcher)
+    ->ArgNames({"routes", "depth"})
+    ->ArgsProduct({{1, 16, 128}, {2, 8}});
+
+// Copying the beast message is part of every iteration, BM_request_copy
+// measures that share alone
+void BM_request_copy(benchmark::State &state) {
+  const auto params = static_cast<std::size_t>(state.range(0));
+  const auto source = make_request(request_path(0, 4) + query_string(params));
+  allocation_counter counter{state};
+  for (auto _ : state) {
+    auto copy = source;
+    benchmark::DoNotOptimize(copy);
+  }
+  counter.report();
+}
+BENCHMARK(BM_request_copy)->ArgName("query_params")->Arg(0)->Arg(4)->Arg(32);
+
+void BM_request_construct(benchmark::State &state) {
+  const auto params = static_cast<std::size_t>(state.range(0));
+  const auto source = make_request(request_path(0, 4) + query_string(params));
+  allocation_counter counter{state};
+  for (auto _ : state) {
+    cpp_http::server::request request{beast_request{source}};
+    benchmark::DoNotOptimize(request);
+  }
+  counter.report();
+}
+BENCHMARK(BM_request_construct)
+    ->ArgName("query_params")
+    ->Arg(0)
+    ->Arg(4)
+    ->Arg(32);
+
+void BM_request_query_lookup(benchmark::State &state) {
+  const auto params = static_cast<std::size_t>(state.range(0));
+  const auto source = make_request(request_path(0, 4) + query_string(params));
+  const auto last_key = "key" + std::to_string(params - 1);
+  allocation_counter counter{state};
+  for (auto _ : state) {
+    cpp_http::server::request request{beast_request{source}};
+    auto value = request.query_params().find(last_key);
+    benchmark::DoNotOptimize(value);
+  }
+  counter.report();
+}
+BENCHMARK(BM_request_query_lookup)
+    ->ArgName("query_params")
+    ->Arg(1)
+    ->Arg(4)
+    ->Arg(32);
+
+void BM_sse_to_http_chunk(benchmark::State &state) {
+  cpp_http::server_sent_event event;
+  event.event = "message";
+  event.id = "123456";
+  event.data = event_data(static_cast<std::size_t>(state.range(0)));
+  allocation_counter counter{state};
+  for (auto _ : state) {
+    auto chunk = event.to_http_chunk();
+    benchmark::DoNotOptimize(chunk);
+  }
+  counter.report();
+  state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations()) *
+                          state.range(0));
+}
+BENCHMARK(BM_sse_to_http_chunk)
+    ->ArgName("event_bytes")
+    ->Arg(32)
+    ->Arg(512)
+    ->Arg(16 << 10);
+
+void BM_http_chunk_to_chunk_body(benchmark::State &state) {
+  cpp_http::server_sent_event event;
+  event.data = event_data(static_cast<std::size_t>(state.range(0)));
+  const auto chunk = std::move(event).to_http_chunk();
+  allocation_counter counter{state};
+  for (auto _ : state) {
+    auto body = chunk.to_chunk_body();
+    std::size_t size = 0;
+    for (auto it = boost::asio::buffer_sequence_begin(body);
+         it != boost::asio::buffer_sequence_end(body); ++it) {
+      size += boost::asio::const_buffer(*it).size();
+    }
+    benchmark::DoNotOptimize(size);
+  }
+  counter.report();
+}
+BENCHMARK(BM_http_chunk_to_chunk_body)
+    ->ArgName("event_bytes")
+    ->Arg(32)
+    ->Arg(512)
+    ->Arg(16 << 10);
+
+void BM_parse_sse_block(benchmark::State &state) {
+  cpp_http::server_sent_event event;
+  event.event = "message";
+  event.id = "123456";
+  event.data = event_data(static_cast<std::size_t>(state.range(0)));
+  const auto block = std::move(event).to_http_chunk().chunked_body + "\n";
+  allocation_counter counter{state};
+  for (auto _ : state) {
+    auto parsed = cpp_http::client::response<
+        boost::beast::http::string_body>::parse_sse_block(block);
+    benchmark::DoNotOptimize(parsed);
+  }
+  counter.report();
+  state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations()) *
+                          static_cast<std::int64_t>(block.size()));
+}
+BENCHMARK(BM_parse_sse_block)
+    ->ArgName("event_bytes")
+    ->Arg(32)
+    ->Arg(512)
+    ->Arg(16 << 10);
+
+// A stream of events fed through the incremental parser, CRLF line endings
+void BM_sse_parser(benchmark::State &state) {
+  std::string stream;
+  for (int i = 0; i < 16; ++i) {
+    stream.append("event: message\r\nid: ")
+        .append(std::to_string(i))
+        .append("\r\ndata: ")
+        .append(event_data(static_cast<std::size_t>(state.range(0))))
+        .append("\r\n\r\n");
+  }
+  allocation_counter counter{state};
+  for (auto _ : state) {
+    cpp_http::client::sse_parser parser;
+    std::size_t events = 0;
+    const auto consumed =
+        parser.parse(stream, [&events](cpp_http::server_sent_event &&event) {
+          benchmark::DoNotOptimize(event);
+          ++events;
+          return true;
+        });
+    benchmark::DoNotOptimize(consumed);
+    benchmark::DoNotOptimize(events);
+  }
+  counter.report();
+  state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations()) *
+                          static_cast<std::int64_t>(stream.size()));
+}
+BENCHMARK(BM_sse_parser)
+    ->ArgName("event_bytes")
+    ->Arg(32)
+    ->Arg(512)
+    ->Arg(16 << 10);
+
+cpp_http::client::request_builder<> api_request_builder(std::string_view id) {
+  cpp_http::client::request_builder<> builder;
+  builder.method(boost::beast::http::verb::get)
+      .base_url("http://api.example.com/v1/items")
+      .param("id", id)
+      .header("accept", "application/json")
+      .header("x-request-id", id);
+  return builder;
+}
+
+// The hot path without templates, build() and a full serialization
+void BM_request_serialize(benchmark::State &state) {
+  allocation_counter counter{state};
+  for (auto _ : state) {
+    auto req = api_request_builder("12345").build();
+    req.request.set(boost::beast::http::field::host, req.url.host_address());
+    req.request.set(boost::beast::http::field::user_agent,
+                    cpp_http::client::user_agent());
+    boost::beast::http::request_serializer<boost::beast::http::string_body>
+        serializer{req.request};
+    boost::beast::error_code ec;
+    std::size_t bytes = 0;
+    while (!ec && !serializer.is_done()) {
+      serializer.next(ec, [&](boost::beast::error_code &,
+                              const auto &buffers) {
+        bytes += boost::asio::buffer_size(buffers);
+        serializer.consume(boost::asio::buffer_size(buffers));
+      });
+    }
+    benchmark::DoNotOptimize(bytes);
+  }
+  counter.report();
+}
+BENCHMARK(BM_request_serialize);
+
+// The same request from a template, slots patched into gather buffers
+void BM_request_template(benchmark::State &state) {
+  boost::asio::io_context ioc;
+  const auto tpl = cpp_http::client::request_template::create(
+                       api_request_builder("{}").build(), ioc.get_executor())
+                       .value();
+  allocation_counter counter{state};
+  for (auto _ : state) {
+    auto buffers = tpl.buffers({"12345", "12345"});
+    benchmark::DoNotOptimize(buffers);
+  }
+  counter.report();
+}
+BENCHMARK(BM_request_template);
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,48 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace cpp_http::bench {
+// Resident set size from /proc/self/statm, 0 where that is unavailable
+inline std::uint64_t resident_bytes() {
+  std::ifstream statm{"/proc/self/statm"};
+  std::uint64_t size = 0;
+  std::uint64_t resident = 0;
+  if (!(statm >> size >> resident)) {
+    return 0;
+  }
+  return resident * static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE));
+}
+
+// User plus system CPU time of the whole process
+inline std::chrono::microseconds cpu_time() {
+  ::rusage usage{};
+  ::getrusage(RUSAGE_SELF, &usage);
+  const auto to_us = [](const ::timeval &tv) {
+    return std::chrono::seconds{tv.tv_sec} +
+           std::chrono::microseconds{tv.tv_usec};
+  };
+  return to_us(usage.ru_utime) + to_us(usage.ru_stime);
+}
+
+// Tens of thousands of sockets need more than the usual 1024 descriptors
+inline void raise_open_file_limit() {
+  ::rlimit limit{};
+  if (::getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+      limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    ::setrlimit(RLIMIT_NOFILE, &limit);
+  }
+}
+
+// Nanoseconds on the monotonic clock. Publisher and subscriber compare these
+// directly, so both have to run on the same host.
+inline std::int64_t monotonic_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+} // namespace cpp_http::bench
@@ -0,0 +1,300 @@
+// Subscriber half of the SSE soak benchmark, see sse_soak_server.cpp.
+//
+//   cpp-http-sse-soak-client --url http://127.0.0.1:12352/events \
+//       --connections 20000 --threads 4 --ramp 2000 --duration 60
+//
+// Holds many SSE connections open and measures, without any per-event
+// output, the publish-to-receive latency of every event, events/s, RSS per
+// connection, CPU per event and id gaps caused by dropped events. Publisher
+// and subscribers have to run on the same host, latency compares monotonic
+// clock readings of both processes.
+#include "client/client.hpp"
+#include "client/request_builder.hpp"
+#include "client/response.hpp"
+#include "histogram.hpp"
+#include "message.hpp"
+#include "process_stats.hpp"
+#include <algorithm>
+#include <atomic>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/experimental/channel.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/beast/http/string_body.hpp>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+using event_channel = boost::asio::experimental::channel<void(
+    boost::system::error_code, cpp_http::server_sent_event)>;
+
+struct options {
+  std::string url{"http://127.0.0.1:12352/events"};
+  std::size_t connections{1000};
+  std::size_t threads{1};
+  // New connections per second across all threads
+  double ramp{1000};
+  std::chrono::seconds duration{30};
+};
+
+// Written by one io_context thread, read by the reporter under `mutex`
+struct thread_stats {
+  std::mutex mutex;
+  cpp_http::bench::histogram interval;
+  cpp_http::bench::histogram total;
+  std::uint64_t events{0};
+  std::uint64_t gaps{0};
+  std::uint64_t malformed{0};
+};
+
+struct shared_stats {
+  std::atomic<std::size_t> connected{0};
+  std::atomic<std::size_t> failed{0};
+  std::atomic<std::size_t> closed{0};
+  // Time read_sse waited for a full event channel
+  std::atomic<std::uint64_t> blocked_us{0};
+};
+
+void consume(event_channel &events, thread_stats &stats,
+             boost::asio::yield_context yield) {
+  std::optional<std::uint64_t> last_id;
+  boost::system::error_code ec;
+  while (true) {
+    auto event = events.async_receive(yield[ec]);
+    if (ec) {
+      break;
+    }
+    const auto received = cpp_http::bench::monotonic_ns();
+    std::int64_t published = 0;
+    std::uint64_t id = 0;
+    const auto &data = event.data;
+    const auto &id_text = event.id;
+    const bool parsed =
+        data.has_value() && id_text.has_value() &&
+        std::from_chars(data->data(), data->data() + data->size(), published)
+                .ec == std::errc{} &&
+        std::from_chars(id_text->data(), id_text->data() + id_text->size(), id)
+                .ec == std::errc{};
+
+    std::lock_guard lock{stats.mutex};
+    if (!parsed) {
+      ++stats.malformed;
+      continue;
+    }
+    ++stats.events;
+    if (last_id.has_value() && id > *last_id + 1) {
+      stats.gaps += id - *last_id - 1;
+    }
+    last_id = id;
+    const auto latency = static_cast<std::uint64_t>(
+        std::max<std::int64_t>(received - published, 0));
+    stats.interval.record(latency);
+    stats.total.record(latency);
+  }
+}
+
+void subscribe(const cpp_http::client::http_request<> &request,
+               thread_stats &stats, shared_stats &shared,
+               boost::asio::yield_context yield) {
+  auto response =
+      cpp_http::client::send<boost::beast::http::string_body,
+                             boost::beast::http::string_body>(request, yield);
+  if (response.has_error() || !response.value()->is_ok()) {
+    ++shared.failed;
+    return;
+  }
+  ++shared.connected;
+  // read_sse stops reading while the channel is full, a larger channel
+  // absorbs bursts without pushing back on the server
+  auto events = std::make_shared<event_channel>(yield.get_executor(), 1024);
+  boost::asio::spawn(
+      yield.get_executor(),
+      [events, &stats](boost::asio::yield_context yield) {
+        consume(*events, stats, yield);
+      },
+      boost::asio::detached);
+  auto result = response.value()->read_sse(*events, yield);
+  shared.blocked_us += static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          response.value()->blocked_on_consumer())
+          .count());
+  events->close();
+  --shared.connected;
+  ++shared.closed;
+}
+
+void run_thread(const options &opts, std::size_t index,
+                const cpp_http::client::http_request<> &request,
+                thread_stats &stats, shared_stats &shared,
+                std::chrono::steady_clock::time_point stop) {
+  boost::asio::io_context ioc{1};
+  const auto count = opts.connections / opts.threads +
+                     (index < opts.connections % opts.threads ? 1 : 0);
+  const auto period = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::duration<double>(static_cast<double>(opts.threads) /
+                                    opts.ramp));
+  boost::asio::spawn(
+      ioc,
+      [&, count, period](boost::asio::yield_context yield) {
+        boost::asio::steady_timer timer{ioc};
+        boost::system::error_code ec;
+        auto next = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < count; ++i) {
+          boost::asio::spawn(
+              ioc,
+              [&](boost::asio::yield_context yield) {
+                subscribe(request, stats, shared, yield);
+              },
+              boost::asio::detached);
+          next += period;
+          timer.expires_at(next);
+          timer.async_wait(yield[ec]);
+        }
+      },
+      boost::asio::detached);
+  // Connections stay open until the end of the run
+  boost::asio::steady_timer deadline{ioc};
+  deadline.expires_at(stop);
+  deadline.async_wait([&ioc](boost::system::error_code) { ioc.stop(); });
+  ioc.run();
+}
+
+void print_latency(const cpp_http::bench::histogram &latency) {
+  const auto ms = [](std::uint64_t ns) {
+    return static_cast<double>(ns) / 1e6;
+  };
+  std::cout << " p50_ms " << ms(latency.value_at_percentile(50)) << " p99_ms "
+            << ms(latency.value_at_percentile(99)) << " p99.9_ms "
+            << ms(latency.value_at_percentile(99.9)) << " max_ms "
+            << ms(latency.max());
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+  options opts;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const std::string arg = argv[i];
+    const std::string value = argv[i + 1];
+    if (arg == "--url") {
+      opts.url = value;
+    } else if (arg == "--connections") {
+      opts.connections = std::stoul(value);
+    } else if (arg == "--threads") {
+      opts.threads = std::max<std::size_t>(std::stoul(value), 1);
+    } else if (arg == "--ramp") {
+      opts.ramp = std::stod(value);
+    } else if (arg == "--duration") {
+      opts.duration = std::chrono::seconds{std::stoll(value)};
+    } else {
+      std::cerr << "usage: cpp-http-sse-soak-client [--url URL]\n"
+                   "         [--connections N] [--threads N]\n"
+                   "         [--ramp CONNECTIONS_PER_SECOND]"
+                   " [--duration SECONDS]\n";
+      return EXIT_FAILURE;
+    }
+  }
+  cpp_http::bench::raise_open_file_limit();
+
+  // Every subscription holds its connection for the whole run
+  cpp_http::client::pool_options pool_options;
+  pool_options.max_connections_per_host = opts.connections;
+  const auto request = cpp_http::client::request_builder{}
+                           .method(boost::beast::http::verb::get)
+                           .base_url(opts.url)
+                           .header("Accept", "text/event-stream")
+                           .timeout(std::chrono::milliseconds{0})
+                           .pool(cpp_http::client::connection_pool::create(
+                               pool_options))
+                           .build();
+  const auto baseline_rss = cpp_http::bench::resident_bytes();
+  const auto baseline_cpu = cpp_http::bench::cpu_time();
+  const auto start = std::chrono::steady_clock::now();
+  const auto stop = start + opts.duration;
+
+  std::vector<std::unique_ptr<thread_stats>> stats;
+  shared_stats shared;
+  std::vector<std::thread> threads;
+  for (std::size_t i = 0; i < opts.threads; ++i) {
+    stats.push_back(std::make_unique<thread_stats>());
+  }
+  for (std::size_t i = 0; i < opts.threads; ++i) {
+    threads.emplace_back([&, i] {
+      run_thread(opts, i, request, *stats[i], shared, stop);
+    });
+  }
+
+  auto last_cpu = baseline_cpu;
+  std::uint64_t last_events = 0;
+  while (std::chrono::steady_clock::now() + std::chrono::seconds{1} <= stop) {
+    std::this_thread::sleep_for(std::chrono::seconds{1});
+    cpp_http::bench::histogram interval;
+    std::uint64_t events = 0;
+    std::uint64_t gaps = 0;
+    for (auto &thread : stats) {
+      std::lock_guard lock{thread->mutex};
+      interval.merge(thread->interval);
+      thread->interval.reset();
+      events += thread->events;
+      gaps += thread->gaps;
+    }
+    const auto cpu = cpp_http::bench::cpu_time();
+    const auto connected = shared.connected.load();
+    const auto rss = cpp_http::bench::resident_bytes();
+    const auto interval_events = events - last_events;
+    std::cout << "connected " << connected << " failed " << shared.failed
+              << " events/s " << interval_events << " gaps " << gaps
+              << " rss_kib/conn "
+              << (connected == 0 ? 0
+                                 : (rss - std::min(rss, baseline_rss)) / 1024 /
+                                       connected)
+              << " cpu_us/event "
+              << (interval_events == 0
+                      ? 0.0
+                      : static_cast<double>((cpu - last_cpu).count()) /
+                            static_cast<double>(interval_events));
+    print_latency(interval);
+    std::cout << std::endl;
+    last_cpu = cpu;
+    last_events = events;
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  cpp_http::bench::histogram total;
+  std::uint64_t events = 0;
+  std::uint64_t gaps = 0;
+  std::uint64_t malformed = 0;
+  for (auto &thread : stats) {
+    total.merge(thread->total);
+    events += thread->events;
+    gaps += thread->gaps;
+    malformed += thread->malformed;
+  }
+  const auto elapsed =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+  const auto cpu_us = (cpp_http::bench::cpu_time() - baseline_cpu).count();
+  std::cout << "\ntotal events " << events << " events/s "
+            << static_cast<double>(events) / elapsed << " gaps " << gaps
+            << " malformed " << malformed << " failed connections "
+            << shared.failed << " blocked_ms "
+            << shared.blocked_us / 1000 << " cpu_us/event "
+            << (events == 0 ? 0.0
+                            : static_cast<double>(cpu_us) /
+                                  static_cast<double>(events));
+  print_latency(total);
+  std::cout << std::endl;
+  return gaps == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,201 @@
+// Publisher half of the SSE soak benchmark, see sse_soak_client.cpp.
+//
+//   cpp-http-sse-soak-server --port 12352 --rate 10 --payload 256
+//
+// Every subscriber of /events receives the same event stream. Each event
+// carries a sequence number in `id` and its publish time on the monotonic
+// clock at the start of `data`. Events that do not fit into a subscriber's
+// queue are dropped and counted, the client sees them as id gaps.
+// Once a second the server prints subscribers, events and drops, RSS and CPU.
+#include "message.hpp"
+#include "process_stats.hpp"
+#include "server/request.hpp"
+#include "server/response.hpp"
+#include "server/server.hpp"
+#include "server/service.hpp"
+#include "server/service_builder.hpp"
+#include <boost/asio/detached.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/smart_ptr/local_shared_ptr.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+struct options {
+  unsigned short port{12352};
+  double rate{10};
+  std::size_t payload{256};
+  std::size_t queue{64};
+};
+
+using subscriber = boost::local_shared_ptr<cpp_http::server::streaming_channel>;
+
+// Subscribers live on the server's single io_context thread
+struct hub {
+  std::vector<subscriber> subscribers;
+  std::size_t queue;
+  std::uint64_t published{0};
+  std::uint64_t delivered{0};
+  std::uint64_t dropped{0};
+};
+
+class soak_service : public cpp_http::server::sse_service {
+  hub &hub_;
+
+public:
+  explicit soak_service(hub &hub) : hub_(hub) {}
+  ~soak_service() override = default;
+
+  cpp_http::server::result<cpp_http::server::empty_response>
+  handle_sse_request(cpp_http::server::request &&request,
+                     boost::local_shared_ptr<
+                         cpp_http::server::streaming_channel>
+                         tx,
+                     boost::asio::yield_context yield) override {
+    hub_.subscribers.push_back(std::move(tx));
+    return std::move(cpp_http::server::response_builder{}
+                         .ok()
+                         .version(request.request_cref().version())
+                         .set(boost::beast::http::field::cache_control,
+                              "no-cache")
+                         .keep_alive(true))
+        .empty();
+  }
+
+  // The response channel is created by chunked_service with room for ten
+  // chunks, a deeper queue has to be requested here
+  cpp_http::server::result<cpp_http::server::response>
+  handle_request(cpp_http::server::request &&request,
+                 boost::asio::yield_context yield) override {
+    auto channel =
+        boost::make_local_shared<cpp_http::server::streaming_channel>(
+            yield.get_executor(), hub_.queue);
+    auto header = handle_chunked_request(std::move(request), channel, yield);
+    if (header.has_error()) {
+      return header.error();
+    }
+    header.value().chunked(true);
+    return cpp_http::server::response{std::move(header).value(),
+                                      std::move(channel)};
+  }
+};
+
+void publish(hub &hub, const options &opts, boost::asio::yield_context yield) {
+  boost::asio::steady_timer timer{yield.get_executor()};
+  const auto period = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::duration<double>(1.0 / opts.rate));
+  const std::string padding(opts.payload, 'x');
+  auto next = std::chrono::steady_clock::now();
+  boost::system::error_code ec;
+  for (std::uint64_t id = 0;; ++id) {
+    next += period;
+    timer.expires_at(next);
+    timer.async_wait(yield[ec]);
+
+    cpp_http::server_sent_event event;
+    event.id = std::to_string(id);
+    event.data = std::to_string(cpp_http::bench::monotonic_ns()) + " " + padding;
+    const auto chunk = std::move(event).to_http_chunk();
+    ++hub.published;
+    auto &subscribers = hub.subscribers;
+    for (std::size_t i = 0; i < subscribers.size();) {
+      // Only the hub holds the channel once its connection is gone
+      if (subscribers[i].local_use_count() == 1 ||
+          !subscribers[i]->is_open()) {
+        subscribers[i] = std::move(subscribers.back());
+        subscribers.pop_back();
+        continue;
+      }
+      if (subscribers[i]->try_send(boost::system::error_code{}, chunk)) {
+        ++hub.delivered;
+      } else {
+        ++hub.dropped;
+      }
+      ++i;
+    }
+  }
+}
+
+void report(hub &hub, boost::asio::yield_context yield) {
+  boost::asio::steady_timer timer{yield.get_executor()};
+  auto last_cpu = cpp_http::bench::cpu_time();
+  auto last_delivered = hub.delivered;
+  auto last_dropped = hub.dropped;
+  boost::system::error_code ec;
+  for (;;) {
+    timer.expires_after(std::chrono::seconds{1});
+    timer.async_wait(yield[ec]);
+    const auto cpu = cpp_http::bench::cpu_time();
+    const auto delivered = hub.delivered - last_delivered;
+    const auto cpu_us = (cpu - last_cpu).count();
+    std::cout << "subscribers " << hub.subscribers.size() << " published "
+              << hub.published << " sent/s " << delivered << " dropped/s "
+              << hub.dropped - last_dropped << " rss_mib "
+              << cpp_http::bench::resident_bytes() / (1024 * 1024)
+              << " cpu_us/event "
+              << (delivered == 0 ? 0.0
+                                 : static_cast<double>(cpu_us) /
+                                       static_cast<double>(delivered))
+              << std::endl;
+    last_cpu = cpu;
+    last_delivered = hub.delivered;
+    last_dropped = hub.dropped;
+  }
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+  options opts;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const std::string arg = argv[i];
+    const std::string value = argv[i + 1];
+    if (arg == "--port") {
+      opts.port = static_cast<unsigned short>(std::stoul(value));
+    } else if (arg == "--rate") {
+      opts.rate = std::stod(value);
+    } else if (arg == "--payload") {
+      opts.payload = std::stoul(value);
+    } else if (arg == "--queue") {
+      opts.queue = std::stoul(value);
+    } else {
+      std::cerr << "usage: cpp-http-sse-soak-server [--port N] [--rate N]\n"
+                   "         [--payload BYTES] [--queue EVENTS]\n";
+      return EXIT_FAILURE;
+    }
+  }
+  cpp_http::bench::raise_open_file_limit();
+
+  hub hub;
+  hub.queue = opts.queue;
+  const auto endpoint = boost::asio::ip::tcp::endpoint(
+      boost::asio::ip::make_address("127.0.0.1"), opts.port);
+  auto server = cpp_http::server::server(endpoint);
+  server.get("/events", std::move(cpp_http::server::service_builder{})
+                            .build_service(std::make_unique<soak_service>(hub)));
+  std::cout << "endpoint: " << endpoint << std::endl;
+
+  boost::asio::io_context ioc{1};
+  boost::asio::spawn(
+      ioc, [&server](boost::asio::yield_context yield) { server.run(yield); },
+      boost::asio::detached);
+  boost::asio::spawn(
+      ioc,
+      [&hub, &opts](boost::asio::yield_context yield) {
+        publish(hub, opts, yield);
+      },
+      boost::asio::detached);
+  boost::asio::spawn(
+      ioc, [&hub](boost::asio::yield_context yield) { report(hub, yield); },
+      boost::asio::detached);
+  ioc.run();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,261 @@
+// Differential fuzzer for the SIMD request head parser.
+//
+// Every input is read as a sequence of pipelined requests twice, once with
+// cpp_http::server::read_request and once with boost::beast::http::async_read
+// and a request_parser under the same limits. Method, target, version,
+// fields, body and the final error have to match, the first difference
+// aborts with the input printed.
+//
+// The first two input bytes pick the read size and the header limit, the
+// rest is what the peer sends. Built with Clang this is a libFuzzer target:
+//   cpp-http-fuzz-head-parser -max_len=4096 corpus/
+// elsewhere it mutates a few seed requests at random:
+//   cpp-http-fuzz-head-parser [iterations] [seed]
+#include "server/head_parser.hpp"
+#include <algorithm>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/beast/_experimental/test/stream.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/http/read.hpp>
+#include <boost/beast/http/string_body.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+namespace http = boost::beast::http;
+
+struct read_result {
+  // One line per request, fields in wire order
+  std::vector<std::string> messages;
+  boost::beast::error_code ec;
+};
+
+std::string describe(const http::request<http::string_body> &req) {
+  std::string text;
+  text.append(req.method_string())
+      .append(" ")
+      .append(req.target())
+      .append(" ")
+      .append(std::to_string(req.version()));
+  for (const auto &field : req) {
+    text.append(" [")
+        .append(field.name_string())
+        .append(": ")
+        .append(field.value())
+        .append("]");
+  }
+  text.append(" body=").append(req.body());
+  return text;
+}
+
+// Reads `wire` in chunks of `read_size` until the first error, at most as
+// many requests as there are bytes
+template <class Read>
+read_result read_all(std::string_view wire, std::size_t read_size,
+                     Read read) {
+  read_result result;
+  boost::asio::io_context ioc;
+  boost::beast::test::stream stream{ioc, wire};
+  stream.read_size(read_size);
+  stream.close_remote();
+  boost::asio::spawn(ioc, [&](boost::asio::yield_context yield) {
+    boost::beast::flat_buffer buffer;
+    for (std::size_t i = 0; i <= wire.size(); ++i) {
+      http::request<http::string_body> req;
+      result.ec = read(stream, buffer, req, yield);
+      if (result.ec) {
+        return;
+      }
+      result.messages.push_back(describe(req));
+    }
+  });
+  ioc.run();
+  return result;
+}
+
+void report(std::string_view wire, const read_result &simd,
+            const read_result &beast) {
+  std::fprintf(stderr, "mismatch for input:\n");
+  for (const char c : wire) {
+    const auto byte = static_cast<unsigned char>(c);
+    if (byte >= 0x20 && byte < 0x7f && byte != '\\') {
+      std::fputc(byte, stderr);
+    } else {
+      std::fprintf(stderr, "\\x%02x", byte);
+    }
+  }
+  for (const auto *side : {&simd, &beast}) {
+    std::fprintf(stderr, "\n%s:\n", side == &simd ? "simd" : "beast");
+    for (const auto &message : side->messages) {
+      std::fprintf(stderr, "  %s\n", message.c_str());
+    }
+    std::fprintf(stderr, "  error: %s\n", side->ec.message().c_str());
+  }
+  std::abort();
+}
+
+// Errors beast reports for a malformed or truncated head
+bool is_head_error(const boost::beast::error_code &ec) {
+  for (const auto error :
+       {http::error::partial_message, http::error::bad_line_ending,
+        http::error::bad_method, http::error::bad_target,
+        http::error::bad_version, http::error::bad_field,
+        http::error::bad_value, http::error::bad_content_length,
+        http::error::bad_transfer_encoding, http::error::bad_obs_fold}) {
+    if (ec == error) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Beast validates lines as they arrive and counts its header limit from the
+// last line it consumed, so whether a malformed, truncated or overlong head
+// fails with a parse error, partial_message, header_limit or not at all
+// depends on how the bytes were split into reads. The fast path reads ahead
+// before handing over, so with small reads only the kind of failure has to
+// match. With the whole input in one read both see the same buffer and
+// have to agree exactly.
+bool same_result(const read_result &simd, const read_result &beast,
+                 bool one_read) {
+  if (one_read) {
+    return simd.messages == beast.messages && simd.ec == beast.ec;
+  }
+  if (simd.ec == http::error::header_limit ||
+      beast.ec == http::error::header_limit) {
+    const auto common = std::min(simd.messages.size(), beast.messages.size());
+    return std::equal(simd.messages.begin(), simd.messages.begin() + common,
+                      beast.messages.begin());
+  }
+  return simd.messages == beast.messages &&
+         (simd.ec == beast.ec ||
+          (is_head_error(simd.ec) && is_head_error(beast.ec)));
+}
+
+void check(const std::uint8_t *data, std::size_t size) {
+  if (size < 2) {
+    return;
+  }
+  const std::size_t read_size = data[0] == 0 ? 65536 : data[0];
+  cpp_http::server::request_limits limits;
+  limits.header_limit = 64 + static_cast<std::size_t>(data[1]) * 64;
+  limits.body_limit = 1024;
+  const std::string_view wire{reinterpret_cast<const char *>(data + 2),
+                              size - 2};
+
+  const auto simd = read_all(
+      wire, read_size,
+      [&](auto &stream, auto &buffer, auto &req, auto yield) {
+        const auto read = cpp_http::server::read_request(stream, buffer, req,
+                                                         limits, yield);
+        return read.has_error() ? read.error() : boost::beast::error_code{};
+      });
+  const auto beast = read_all(
+      wire, read_size,
+      [&](auto &stream, auto &buffer, auto &req, auto yield) {
+        http::request_parser<http::string_body> parser;
+        parser.header_limit(static_cast<std::uint32_t>(limits.header_limit));
+        parser.body_limit(limits.body_limit);
+        boost::beast::error_code ec;
+        http::async_read(stream, buffer, parser, yield[ec]);
+        if (!ec) {
+          req = parser.release();
+        }
+        return ec;
+      });
+  if (!same_result(simd, beast, read_size >= wire.size())) {
+    report(wire, simd, beast);
+  }
+}
+} // namespace
+
+#ifdef CPP_HTTP_FUZZ_LIBFUZZER
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t *data,
+                                      std::size_t size) {
+  check(data, size);
+  return 0;
+}
+#else
+namespace {
+const std::string_view seeds[] = {
+    "GET / HTTP/1.1\r\nHost: a\r\n\r\n",
+    "GET /index.html?q=1 HTTP/1.0\r\nHost: example.com\r\n"
+    "User-Agent: fuzz\r\nAccept: */*\r\nConnection: keep-alive\r\n\r\n",
+    "POST /submit HTTP/1.1\r\nHost: a\r\nContent-Length: 5\r\n"
+    "Content-Type: text/plain\r\n\r\nhello",
+    "PUT /x HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+    "3\r\nabc\r\n0\r\n\r\n",
+    "GET / HTTP/1.1\r\nX-Folded: a\r\n b\r\n\r\n",
+    "PATCH /p HTTP/1.1\r\nContent-Length: 2\r\nContent-Length: 2\r\n\r\nok",
+    "GET /a HTTP/1.1\r\n\r\nGET /b HTTP/1.1\r\nHost: b\r\n\r\n",
+};
+
+// Bytes that sit on the parser's decision points
+constexpr std::string_view interesting{" \t\r\n:,;\0\x7f\x80\xff" "aZ0-",
+                                       15};
+
+std::string mutate(std::mt19937_64 &rng) {
+  std::uniform_int_distribution<std::size_t> pick_seed{
+      0, std::size(seeds) - 1};
+  std::string input{seeds[pick_seed(rng)]};
+  const auto rounds = std::uniform_int_distribution<int>{1, 4}(rng);
+  for (int round = 0; round < rounds; ++round) {
+    const auto pos =
+        std::uniform_int_distribution<std::size_t>{0, input.size()}(rng);
+    const auto byte = interesting[std::uniform_int_distribution<std::size_t>{
+        0, interesting.size() - 1}(rng)];
+    switch (std::uniform_int_distribution<int>{0, 5}(rng)) {
+    case 0:
+      input.insert(pos, 1, byte);
+      break;
+    case 1:
+      if (pos < input.size()) {
+        input[pos] = byte;
+      }
+      break;
+    case 2:
+      if (pos < input.size()) {
+        input[pos] = static_cast<char>(rng());
+      }
+      break;
+    case 3:
+      input.erase(pos, std::uniform_int_distribution<std::size_t>{1, 8}(rng));
+      break;
+    case 4:
+      input.insert(pos, input.substr(pos, std::uniform_int_distribution<
+                                              std::size_t>{1, 32}(rng)));
+      break;
+    default:
+      input.insert(pos, seeds[pick_seed(rng)]);
+      break;
+    }
+  }
+  // Read size and header limit, small values hit the fallback boundaries
+  const char limits[] = {static_cast<char>(rng() % 8 == 0 ? 0 : rng() % 64),
+                         static_cast<char>(rng() % 4)};
+  return std::string(limits, 2) + input;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  const auto iterations = argc > 1 ? std::strtoull(argv[1], nullptr, 10)
+                                   : 100000ULL;
+  const auto seed =
+      argc > 2 ? std::strtoull(argv[2], nullptr, 10) : std::random_device{}();
+  std::printf("seed %llu\n", static_cast<unsigned long long>(seed));
+  std::mt19937_64 rng{seed};
+  for (unsigned long long i = 0; i < iterations; ++i) {
+    const auto input = mutate(rng);
+    check(reinterpret_cast<const std::uint8_t *>(input.data()), input.size());
+  }
+  std::printf("%llu inputs, no mismatch\n", iterations);
+  return 0;
+}
+#endif
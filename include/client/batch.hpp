@@ -0,0 +1,193 @@
+#pragma once
+#include "client/client.hpp"
+#include "client/connection_pool.hpp"
+#include "client/dns_cache.hpp"
+#include "client/request_builder.hpp"
+#include "client/response.hpp"
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/bind_cancellation_slot.hpp>
+#include <boost/asio/cancellation_signal.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/experimental/channel.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/beast/http/dynamic_body.hpp>
+#include <boost/outcome/result.hpp>
+#include <boost/outcome/success_failure.hpp>
+#include <boost/system/detail/error_code.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace cpp_http::client {
+enum class batch_mode {
+  // Every request runs, failures are reported like any other completion
+  collect_all,
+  // The first failed request cancels the ones in flight, the rest are
+  // never sent
+  cancel_on_error,
+};
+
+struct batch_options {
+  // Requests waiting for their response header at the same time
+  std::size_t max_concurrency{64};
+  // The same, per scheme, host and port. Requests over the limit wait in
+  // the batch instead of the pool, so they do not run into its
+  // wait_timeout.
+  std::size_t max_per_host{8};
+  batch_mode mode{batch_mode::collect_all};
+  // Shared by requests that do not bring their own, default_pool() and
+  // default_dns_cache() when null
+  std::shared_ptr<connection_pool> pool;
+  std::shared_ptr<dns_cache> dns;
+};
+
+template <class Response = boost::beast::http::dynamic_body>
+struct batch_result {
+  // Position of the request in the batch
+  std::size_t index{0};
+  // Header read, the body is left to the receiver. Null on error.
+  std::unique_ptr<response<Response>> resp;
+};
+
+template <class Response = boost::beast::http::dynamic_body>
+using batch_channel = boost::asio::experimental::channel<void(
+    boost::system::error_code, batch_result<Response>)>;
+
+/**
+ * Sends `requests` concurrently and hands each completion to `tx` as it
+ * arrives, out of order, tagged with the request's index.
+ *
+ * Returns once every started request completed and was delivered. In
+ * cancel_on_error mode that is the first error, requests that were not
+ * started are not reported. Closing `tx` on the receiving side cancels the
+ * batch the same way.
+ */
+template <class Response = boost::beast::http::dynamic_body, class Request>
+inline boost::outcome_v2::result<void>
+send_batch(std::vector<http_request<Request>> requests, batch_options options,
+           batch_channel<Response> &tx, boost::asio::yield_context yield) {
+  using response_ptr = std::unique_ptr<response<Response>>;
+  using done_channel = boost::asio::experimental::channel<void(
+      boost::system::error_code, std::size_t, response_ptr)>;
+
+  // Workers report into the channel after this frame returned when the
+  // batch was cancelled, they keep the shared state alive
+  struct batch_state {
+    batch_state(const boost::asio::any_io_executor &executor,
+                std::size_t capacity)
+        : done(executor, capacity) {}
+    done_channel done;
+    // One per started request, a deque keeps them in place
+    std::deque<boost::asio::cancellation_signal> signals;
+  };
+
+  const auto executor = yield.get_executor();
+  const auto concurrency = std::max<std::size_t>(options.max_concurrency, 1);
+  const auto per_host = std::max<std::size_t>(options.max_per_host, 1);
+  const auto pool = options.pool ? options.pool : default_pool();
+  const auto dns = options.dns ? options.dns : default_dns_cache();
+  auto state = std::make_shared<batch_state>(executor, concurrency);
+
+  std::vector<std::string> keys;
+  keys.reserve(requests.size());
+  for (auto &req : requests) {
+    if (!req.pool) {
+      req.pool = pool;
+    }
+    if (!req.dns) {
+      req.dns = dns;
+    }
+    keys.push_back(connection_pool::key_for(req.url, executor));
+  }
+
+  // Requests not started yet in batch order, and those that found their
+  // host at its limit, so every request is looked at twice at most
+  std::deque<std::size_t> queued;
+  for (std::size_t i = 0; i < requests.size(); ++i) {
+    queued.push_back(i);
+  }
+  std::unordered_map<std::string, std::deque<std::size_t>> blocked;
+  std::unordered_map<std::string, std::size_t> running_per_host;
+  std::size_t in_flight = 0;
+
+  const auto start = [&](std::size_t index) {
+    ++in_flight;
+    ++running_per_host[keys[index]];
+    auto &signal = state->signals.emplace_back();
+    boost::asio::spawn(
+        executor,
+        [state, req = std::move(requests[index]),
+         index](boost::asio::yield_context yield) mutable {
+          auto resp = send<Response, Request>(std::move(req), yield);
+          if (resp.has_error()) {
+            state->done.try_send(resp.error(), index, nullptr);
+          } else {
+            state->done.try_send(boost::system::error_code{}, index,
+                                 std::move(resp).value());
+          }
+        },
+        boost::asio::bind_cancellation_slot(signal.slot(),
+                                            boost::asio::detached));
+  };
+
+  const auto fill = [&] {
+    while (in_flight < concurrency && !queued.empty()) {
+      const auto index = queued.front();
+      queued.pop_front();
+      if (running_per_host[keys[index]] >= per_host) {
+        blocked[keys[index]].push_back(index);
+      } else {
+        start(index);
+      }
+    }
+  };
+
+  boost::system::error_code batch_error;
+  const auto cancel = [&](const boost::system::error_code &ec) {
+    batch_error = ec;
+    queued.clear();
+    blocked.clear();
+    for (auto &signal : state->signals) {
+      signal.emit(boost::asio::cancellation_type::terminal);
+    }
+  };
+
+  fill();
+  while (in_flight > 0) {
+    boost::system::error_code ec;
+    auto [index, resp] = state->done.async_receive(yield[ec]);
+    --in_flight;
+    const auto &key = keys[index];
+    --running_per_host[key];
+    boost::system::error_code send_ec;
+    tx.async_send(ec, batch_result<Response>{index, std::move(resp)},
+                  yield[send_ec]);
+    if (!batch_error && send_ec) {
+      cancel(send_ec);
+    } else if (!batch_error && ec &&
+               options.mode == batch_mode::cancel_on_error) {
+      cancel(ec);
+    }
+    if (batch_error) {
+      continue;
+    }
+    // The freed host slot goes to a request that waited for it
+    if (auto waiting = blocked.find(key);
+        waiting != blocked.end() && !waiting->second.empty()) {
+      start(waiting->second.front());
+      waiting->second.pop_front();
+    }
+    fill();
+  }
+  if (batch_error) {
+    return batch_error;
+  }
+  return boost::outcome_v2::success();
+}
+} // namespace cpp_http::client
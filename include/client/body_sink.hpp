@@ -0,0 +1,136 @@
+#pragma once
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/experimental/concurrent_channel.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <boost/beast/core/file.hpp>
+#include <boost/beast/core/file_base.hpp>
+#include <boost/outcome/result.hpp>
+#include <boost/system/detail/error_code.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+
+namespace cpp_http::client {
+// Threads that run blocking file writes, so they never stall an io_context
+inline boost::asio::thread_pool &file_io_pool() {
+  static boost::asio::thread_pool pool{2};
+  return pool;
+}
+
+/**
+ * Write-behind file target for a response body.
+ *
+ * The body is read into one buffer while the previous one is written on
+ * file_io_pool(), so the disk and the network work in parallel. Memory is
+ * bounded by two buffers of `write_behind` bytes whatever the body size.
+ */
+class file_sink {
+  using done_channel = boost::asio::experimental::concurrent_channel<void(
+      boost::system::error_code)>;
+
+  std::shared_ptr<boost::beast::file> file_;
+  std::shared_ptr<std::string> filling_;
+  std::shared_ptr<std::string> writing_;
+  std::size_t used_{0};
+  std::shared_ptr<done_channel> written_;
+  bool pending_{false};
+  std::uint64_t size_{0};
+
+  struct private_tag {};
+
+  // Waits for the write in flight
+  boost::system::error_code wait(boost::asio::yield_context yield) {
+    boost::system::error_code ec;
+    if (pending_) {
+      pending_ = false;
+      written_->async_receive(yield[ec]);
+    }
+    return ec;
+  }
+
+  boost::system::error_code flush(boost::asio::yield_context yield) {
+    if (auto ec = wait(yield)) {
+      return ec;
+    }
+    if (used_ == 0) {
+      return {};
+    }
+    std::swap(filling_, writing_);
+    pending_ = true;
+    // The write keeps the file and its buffer alive even when the sink is
+    // dropped before it finished
+    boost::asio::post(file_io_pool(), [file = file_, buffer = writing_,
+                                       size = used_, written = written_] {
+      boost::system::error_code ec;
+      std::size_t offset = 0;
+      while (!ec && offset < size) {
+        offset += file->write(buffer->data() + offset, size - offset, ec);
+      }
+      written->try_send(ec);
+    });
+    used_ = 0;
+    return {};
+  }
+
+public:
+  file_sink(private_tag, boost::asio::any_io_executor executor,
+            std::shared_ptr<boost::beast::file> file, std::size_t write_behind)
+      : file_(std::move(file)),
+        filling_(std::make_shared<std::string>(write_behind, '\0')),
+        writing_(std::make_shared<std::string>(write_behind, '\0')),
+        written_(std::make_shared<done_channel>(std::move(executor), 1)) {}
+
+  // Creates or truncates the file at `path`
+  static boost::outcome_v2::result<file_sink>
+  create(const std::string &path, boost::asio::any_io_executor executor,
+         std::size_t write_behind = 1024 * 1024) {
+    auto file = std::make_shared<boost::beast::file>();
+    boost::system::error_code ec;
+    file->open(path.c_str(), boost::beast::file_mode::write, ec);
+    if (ec) {
+      return ec;
+    }
+    return file_sink{private_tag{}, std::move(executor), std::move(file),
+                     write_behind == 0 ? 1 : write_behind};
+  }
+
+  // Free space of the buffer being filled
+  boost::asio::mutable_buffer prepare() {
+    return {filling_->data() + used_, filling_->size() - used_};
+  }
+
+  // Accounts for `bytes` stored into prepare(), starts writing a full buffer
+  boost::outcome_v2::result<void> commit(std::size_t bytes,
+                                         boost::asio::yield_context yield) {
+    used_ += bytes;
+    size_ += bytes;
+    if (used_ < filling_->size()) {
+      return boost::outcome_v2::success();
+    }
+    if (auto ec = flush(yield)) {
+      return ec;
+    }
+    return boost::outcome_v2::success();
+  }
+
+  // Writes what is left and waits until everything reached the file
+  boost::outcome_v2::result<void> finish(boost::asio::yield_context yield) {
+    auto ec = flush(yield);
+    if (!ec) {
+      ec = wait(yield);
+    }
+    if (ec) {
+      return ec;
+    }
+    return boost::outcome_v2::success();
+  }
+
+  // Bytes committed so far
+  [[nodiscard]] std::uint64_t size() const { return size_; }
+};
+} // namespace cpp_http::client
@@ -4,148 +4,97 @@
 #include "boost/beast/core/tcp_stream.hpp"
 #include "boost/outcome/result.hpp"
 #include "boost/outcome/success_failure.hpp"
+#include "connection_pool.hpp"
+#include "dns_cache.hpp"
+#include "happy_eyeballs.hpp"
+#include "http2.hpp"
+#include "http_cache.hpp"
+#include "request_body.hpp"
 #include "request_builder.hpp"
 #include "response.hpp"
+#include "retry.hpp"
+#include "timing.hpp"
+#include "tls.hpp"
+#include <boost/asio/bind_cancellation_slot.hpp>
+#include <boost/asio/cancellation_signal.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/experimental/channel.hpp>
 #include <boost/asio/ssl/context.hpp>
 #include <boost/asio/ssl/error.hpp>
 #include <boost/asio/ssl/host_name_verification.hpp>
 #include <boost/asio/ssl/stream.hpp>
 #include <boost/asio/ssl/stream_base.hpp>
 #include <boost/asio/ssl/verify_mode.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/beast/core.hpp>
 #include <boost/beast/core/error.hpp>
 #include <boost/beast/core/stream_traits.hpp>
 #include <boost/beast/http/error.hpp>
 #include <boost/beast/http/field.hpp>
+#include <boost/beast/http/verb.hpp>
 #include <boost/system/detail/errc.hpp>
 #include <boost/system/detail/error_code.hpp>
 #include <boost/url/scheme.hpp>
 #include <boost/url/url_view.hpp>
+#include <array>
+#include <charconv>
+#include <chrono>
 #include <memory>
 #include <openssl/err.h>
+#include <openssl/ssl.h>
 #include <openssl/tls1.h>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <utility>
 namespace cpp_http::client {
 inline boost::asio::ssl::context &get_ssl_context() {
-  static boost::asio::ssl::context context{
-      boost::asio::ssl::context::tls_client};
-  static bool initialized = false;
-  if (!initialized) {
-    context.set_default_verify_paths();
-    context.set_verify_mode(boost::asio::ssl::verify_peer);
-    initialized = true;
-  }
-  return context;
+  return default_tls_context()->context();
 }
 
 inline std::string_view user_agent() { return "cpp-http/client"; }
 
-template <class Response, class Request>
-inline boost::outcome_v2::result<std::unique_ptr<response<Response>>>
-send_http(http_request<Request> req, boost::asio::ip::tcp::resolver &resolver,
-          uint64_t redirect_count, boost::asio::yield_context yield);
-
-template <class Response, class Request>
-inline boost::outcome_v2::result<std::unique_ptr<response<Response>>>
-send_https(http_request<Request> req, boost::asio::ip::tcp::resolver &resolver,
-           uint64_t redirect_count, boost::asio::yield_context yield);
-
-template <class Response, class Request>
-inline boost::outcome_v2::result<std::unique_ptr<response<Response>>>
-send(http_request<Request> req, boost::asio::ip::tcp::resolver &resolver,
-     uint64_t redirect_count, boost::asio::yield_context yield) {
-  const auto &url = req.url;
-  if (url.scheme_id() == boost::urls::scheme::https) {
-    return send_https<Response, Request>(std::move(req), resolver,
-                                         redirect_count, yield);
-  }
-  return send_http<Response, Request>(std::move(req), resolver, redirect_count,
-                                      yield);
-}
-
-inline boost::outcome_v2::result<boost::asio::ip::tcp::resolver::results_type>
-resolve(boost::urls::url_view url, boost::asio::ip::tcp::resolver &resolver,
+inline boost::outcome_v2::result<endpoint_list>
+resolve(boost::urls::url_view url, dns_cache &dns,
         boost::asio::yield_context yield) {
-  boost::system::error_code ec;
   std::string host = url.host_address();
   bool is_https = url.scheme_id() == boost::urls::scheme::https;
   auto port = std::to_string(url.port_number() > 0 ? url.port_number()
                              : is_https            ? 443
                                                    : 80);
-
-  auto endpoints = resolver.async_resolve(host, port, yield[ec]);
-  if (ec) {
-    return ec;
-  }
-  return endpoints;
+  return dns.resolve(host, port, yield);
 }
 
-template <class Response, class Request>
-inline boost::outcome_v2::result<std::unique_ptr<response<Response>>>
-send_http(http_request<Request> req, boost::asio::ip::tcp::resolver &resolver,
-          uint64_t redirect_count, boost::asio::yield_context yield) {
+// Opens a plain or TLS stream to `url` for a pool slot that is not
+// connected yet
+inline boost::outcome_v2::result<void>
+connect(connection &conn, boost::urls::url_view url, uint64_t timeout_ms,
+        dns_cache &dns, tls_context &tls, bool offer_http2,
+        request_timing &timing, boost::asio::yield_context yield) {
   boost::beast::error_code ec;
-  auto stream =
-      std::make_unique<boost::beast::tcp_stream>(yield.get_executor());
-  if (req.timeout_ms > 0) {
-    stream->expires_after(std::chrono::milliseconds(req.timeout_ms));
-  }
-  auto url = req.url;
-  auto endpoints = resolve(url, resolver, yield);
+  auto endpoints = resolve(url, dns, yield);
   if (endpoints.has_error()) {
     return endpoints.error();
   }
-  stream->async_connect(endpoints.value(), yield[ec]);
-  if (ec) {
-    return ec;
-  }
-
-  req.request.target(url.encoded_target());
-  req.request.set(boost::beast::http::field::host, url.host_address());
-  req.request.set(boost::beast::http::field::user_agent, user_agent());
-  boost::beast::http::async_write(*stream, req.request, yield[ec]);
-  if (ec) {
-    return ec;
-  }
-
-  auto resp = std::make_unique<response<Response>>(std::move(stream));
-  if (auto init_result = resp->init_parser(yield[ec]);
-      init_result.has_error()) {
-    return init_result.error();
-  }
-  if (resp->is_redirection() && req.auto_redirect) {
-    auto loc = resp->redirect_url();
-    if (!loc) {
-      return boost::beast::http::error::bad_field;
-    }
-    if (redirect_count > req.max_redirects) {
-      return boost::beast::errc::protocol_error;
-    }
-    req.url = *loc;
-    return send<Response, Request>(std::move(req), resolver, redirect_count + 1,
-                                   yield);
-    // continue to next loop to redirect
+  timing.resolved = request_timing::clock::now();
+  // Races the resolved addresses instead of trying them one by one, so a
+  // dead address does not cost the whole timeout
+  auto stream = race_connect(endpoints.value(),
+                             std::chrono::milliseconds(timeout_ms), yield);
+  if (stream.has_error()) {
+    return stream.error();
   }
-  return boost::outcome_v2::success(std::move(resp));
-}
-
-template <class Response, class Request>
-boost::outcome_v2::
-    result<std::unique_ptr<response<Response>>> inline send_https(
-        http_request<Request> req, boost::asio::ip::tcp::resolver &resolver,
-        uint64_t redirect_count, boost::asio::yield_context yield) {
-  boost::beast::error_code ec;
-  auto url = req.url;
-  auto &&endpoints = resolve(url, resolver, yield);
-  if (endpoints.has_error()) {
-    return endpoints.error();
+  timing.connected = request_timing::clock::now();
+  if (url.scheme_id() != boost::urls::scheme::https) {
+    conn.attach(std::move(stream).value());
+    conn.set_negotiated_http2(offer_http2);
+    return boost::outcome_v2::success();
   }
 
   const auto host = url.host_address();
   auto ssl_stream =
       std::make_unique<boost::asio::ssl::stream<boost::beast::tcp_stream>>(
-          yield.get_executor(), get_ssl_context());
+          std::move(*stream.value()), tls.context());
   if (!SSL_set_tlsext_host_name(ssl_stream->native_handle(), host.c_str())) {
     ec.assign(static_cast<int>(::ERR_get_error()),
               boost::asio::error::get_ssl_category());
@@ -153,65 +102,567 @@ boost::outcome_v2::
   }
   ssl_stream->set_verify_callback(
       boost::asio::ssl::host_name_verification(host));
-  if (ec) {
-    return ec;
+  tls.prepare(ssl_stream->native_handle(),
+              host + ":" +
+                  std::to_string(url.port_number() > 0 ? url.port_number()
+                                                       : 443));
+  if (offer_http2) {
+    static constexpr unsigned char protocols[] = {
+        2, 'h', '2', 8, 'h', 't', 't', 'p', '/', '1', '.', '1'};
+    SSL_set_alpn_protos(ssl_stream->native_handle(), protocols,
+                        sizeof(protocols));
   }
 
-  if (req.timeout_ms > 0) {
+  if (timeout_ms > 0) {
     boost::beast::get_lowest_layer(*ssl_stream)
-        .expires_after(std::chrono::milliseconds(req.timeout_ms));
+        .expires_after(std::chrono::milliseconds(timeout_ms));
   }
-  boost::beast::get_lowest_layer(*ssl_stream)
-      .async_connect(endpoints.value(), yield[ec]);
+  ssl_stream->async_handshake(boost::asio::ssl::stream_base::client, yield[ec]);
   if (ec) {
     return ec;
   }
+  timing.tls_done = request_timing::clock::now();
+  timing.tls_resumed = SSL_session_reused(ssl_stream->native_handle()) != 0;
+  tls.handshake_done(ssl_stream->native_handle());
+  const unsigned char *selected = nullptr;
+  unsigned int selected_length = 0;
+  SSL_get0_alpn_selected(ssl_stream->native_handle(), &selected,
+                         &selected_length);
+  conn.set_negotiated_http2(
+      std::string_view(reinterpret_cast<const char *>(selected),
+                       selected_length) == "h2");
+  conn.attach(std::move(ssl_stream));
+  return boost::outcome_v2::success();
+}
 
+// Requests that may be sent a second time when a kept-alive connection
+// turns out to be closed by the server, RFC 9110 section 9.2.2
+inline bool is_idempotent(boost::beast::http::verb method) {
+  switch (method) {
+  case boost::beast::http::verb::get:
+  case boost::beast::http::verb::head:
+  case boost::beast::http::verb::options:
+  case boost::beast::http::verb::trace:
+  case boost::beast::http::verb::put:
+  case boost::beast::http::verb::delete_:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Errors a reused connection reports when the server closed it between two
+// requests
+inline bool is_stale_connection(const boost::system::error_code &ec) {
+  return ec == boost::asio::error::eof ||
+         ec == boost::asio::error::connection_reset ||
+         ec == boost::asio::error::broken_pipe ||
+         ec == boost::beast::http::error::end_of_stream;
+}
+
+// Writes the request on a connected connection and reads the response
+// header
+template <class Response, class Request>
+inline boost::outcome_v2::result<std::unique_ptr<response<Response>>>
+exchange(http_request<Request> &req, std::unique_ptr<connection> conn,
+         request_timing &timing, boost::asio::yield_context yield) {
+  boost::beast::error_code ec;
+  const auto &url = req.url;
+  req.request.target(url.encoded_target());
+  req.request.set(boost::beast::http::field::host, url.host_address());
+  req.request.set(boost::beast::http::field::user_agent, user_agent());
+  timing.reused_connection = conn->requests() > 0;
+  conn->mark_used();
   if (req.timeout_ms > 0) {
-    boost::beast::get_lowest_layer(*ssl_stream)
-        .expires_after(std::chrono::milliseconds(req.timeout_ms));
+    conn->expires_after(std::chrono::milliseconds(req.timeout_ms));
   }
-  ssl_stream->async_handshake(boost::asio::ssl::stream_base::client, yield[ec]);
+  conn->with_stream([&](auto &stream) {
+    ec = write_request(stream, req.request, req.body_stream.get(),
+                       std::chrono::milliseconds(req.timeout_ms), yield);
+  });
   if (ec) {
     return ec;
   }
+  timing.request_written = request_timing::clock::now();
+
+  auto resp = std::make_unique<response<Response>>(std::move(conn));
+  resp->decompress(req.decompress);
+  if (auto init_result = resp->init_parser(yield, req.request.method());
+      init_result.has_error()) {
+    return init_result.error();
+  }
+  timing.header_received = request_timing::clock::now();
+  resp->set_timing(timing);
+  return boost::outcome_v2::success(std::move(resp));
+}
 
+// Sends the request as a new stream of an HTTP/2 session and reads the
+// response header
+template <class Response, class Request>
+inline boost::outcome_v2::result<std::unique_ptr<response<Response>>>
+exchange_http2(http_request<Request> &req, http2_session &session,
+               request_timing &timing, boost::asio::yield_context yield) {
+  const auto &url = req.url;
   req.request.target(url.encoded_target());
-  req.request.set(boost::beast::http::field::host, host);
   req.request.set(boost::beast::http::field::user_agent, user_agent());
+  std::string authority = url.host_address();
+  if (url.has_port()) {
+    authority.append(":").append(url.port());
+  }
+  const bool is_https = url.scheme_id() == boost::urls::scheme::https;
+  auto stream = session.submit(req.request, is_https ? "https" : "http",
+                               authority, yield, req.priority);
+  if (stream.has_error()) {
+    return stream.error();
+  }
+  timing.http2 = true;
+  timing.request_written = request_timing::clock::now();
+  auto conn = std::make_unique<connection>(std::move(stream).value());
   if (req.timeout_ms > 0) {
-    boost::beast::get_lowest_layer(*ssl_stream)
-        .expires_after(std::chrono::milliseconds(req.timeout_ms));
+    conn->expires_after(std::chrono::milliseconds(req.timeout_ms));
   }
-  boost::beast::http::async_write(*ssl_stream, req.request, yield[ec]);
-  if (ec) {
-    return ec;
+  auto resp = std::make_unique<response<Response>>(std::move(conn));
+  resp->decompress(req.decompress);
+  if (auto init_result = resp->init_parser(yield, req.request.method());
+      init_result.has_error()) {
+    return init_result.error();
   }
+  timing.header_received = request_timing::clock::now();
+  resp->set_timing(timing);
+  return boost::outcome_v2::success(std::move(resp));
+}
 
-  auto resp = std::make_unique<response<Response>>(std::move(ssl_stream));
-  if (auto init_result = resp->init_parser(yield); init_result.has_error()) {
-    return init_result.error();
+// One attempt at the request and its redirects, without retries or hedging
+template <class Response, class Request>
+inline boost::outcome_v2::result<std::unique_ptr<response<Response>>>
+send_attempt(http_request<Request> req, uint64_t redirect_count,
+             boost::asio::yield_context yield) {
+  const auto pool = req.pool ? req.pool : default_pool();
+  const auto dns = req.dns ? req.dns : default_dns_cache();
+  const auto tls = req.tls ? req.tls : default_tls_context();
+  const auto key = connection_pool::key_for(req.url, yield.get_executor());
+  request_timing timing;
+  timing.start = request_timing::clock::now();
+  timing.redirects = redirect_count;
+  boost::outcome_v2::result<std::unique_ptr<response<Response>>> resp{
+      boost::asio::error::not_connected};
+  bool sent = false;
+  // Streamed bodies are sent over HTTP/1.1 only and cannot be replayed
+  const bool http2 = req.http2 && !req.body_stream;
+  // Requests waiting for this one to set up the HTTP/2 session are let go
+  // on every way out that does not produce one
+  struct http2_lead {
+    connection_pool &pool;
+    const std::string &key;
+    bool held{false};
+    bool http1_only{false};
+    ~http2_lead() {
+      if (held) {
+        pool.abandon_http2(key, http1_only);
+      }
+    }
+  } lead{*pool, key};
+  while (http2) {
+    auto session = pool->find_http2(key, lead.held, yield);
+    if (session.has_error()) {
+      notify_timing_observer(timing, session.error());
+      return session.error();
+    }
+    if (session.value() == nullptr) {
+      break;
+    }
+    if (!session.value()->is_open()) {
+      pool->remove_http2(key, session.value());
+      continue;
+    }
+    timing.checked_out = request_timing::clock::now();
+    timing.reused_connection = true;
+    resp = exchange_http2<Response, Request>(req, *session.value(), timing,
+                                             yield);
+    // A session that is going away refuses streams before processing
+    // them, those go out on a new connection
+    sent = !resp.has_error() ||
+           resp.error() != boost::asio::error::connection_aborted;
+    break;
   }
-  if (resp->is_redirection() && req.auto_redirect) {
-    auto loc = resp->redirect_url();
+  for (bool retry = is_idempotent(req.request.method()) && !req.body_stream;
+       !sent; retry = false) {
+    auto conn = pool->checkout(key, yield,
+                               std::chrono::milliseconds(req.timeout_ms));
+    if (conn.has_error()) {
+      notify_timing_observer(timing, conn.error());
+      return conn.error();
+    }
+    timing.checked_out = request_timing::clock::now();
+    if (!conn.value()->is_connected()) {
+      if (auto connected = connect(*conn.value(), req.url, req.timeout_ms,
+                                   *dns, *tls, http2, timing, yield);
+          connected.has_error()) {
+        notify_timing_observer(timing, connected.error());
+        return connected.error();
+      }
+      if (conn.value()->negotiated_http2()) {
+        // The session owns the connection and its pool slot from here on
+        auto session = http2_session::start(std::move(conn).value());
+        pool->add_http2(key, session);
+        lead.held = false;
+        resp = exchange_http2<Response, Request>(req, *session, timing, yield);
+        break;
+      }
+      lead.http1_only = true;
+    }
+    if (lead.held) {
+      // The others use HTTP/1.1 connections of their own from here
+      pool->abandon_http2(key, lead.http1_only);
+      lead.held = false;
+    }
+    const bool reused = conn.value()->requests() > 0;
+    resp = exchange<Response, Request>(req, std::move(conn).value(), timing,
+                                       yield);
+    sent = !resp.has_error() || !reused || !retry ||
+           !is_stale_connection(resp.error());
+  }
+  notify_timing_observer(timing, resp.has_error()
+                                     ? resp.error()
+                                     : boost::system::error_code{});
+  if (resp.has_error()) {
+    return resp.error();
+  }
+  if (resp.value()->is_redirection() && req.auto_redirect) {
+    auto loc = resp.value()->redirect_url();
     if (!loc) {
       return boost::beast::http::error::bad_field;
     }
     if (redirect_count > req.max_redirects) {
       return boost::beast::errc::protocol_error;
     }
+    // Reading the usually tiny redirect body lets the next request reuse
+    // the connection when the location is on the same origin
+    resp.value()->discard_body(yield);
+    resp.value().reset();
     req.url = *loc;
-    return send<Response, Request>(std::move(req), resolver, redirect_count + 1,
-                                   yield);
-    // continue to next loop to redirect
+    return send_attempt<Response, Request>(std::move(req), redirect_count + 1,
+                                           yield);
   }
-  return boost::outcome_v2::success(std::move(resp));
+  return resp;
+}
+
+// Repeats failed attempts after a jittered backoff while the error allows
+// it and the budget has tokens left
+template <class Response, class Request>
+inline boost::outcome_v2::result<std::unique_ptr<response<Response>>>
+send_with_retries(const http_request<Request> &req, uint64_t redirect_count,
+                  retry_budget &budget, boost::asio::yield_context yield) {
+  const bool idempotent = is_idempotent(req.request.method());
+  for (unsigned retry = 0;; ++retry) {
+    auto resp = send_attempt<Response, Request>(req, redirect_count, yield);
+    if (!resp.has_error() || retry >= req.retry.max_retries ||
+        !is_retryable(resp.error(), idempotent) || !budget.try_withdraw()) {
+      return resp;
+    }
+    boost::asio::steady_timer timer{yield.get_executor()};
+    timer.expires_after(backoff_delay(req.retry, retry));
+    boost::system::error_code ec;
+    timer.async_wait(yield[ec]);
+    if (ec) {
+      return ec;
+    }
+  }
+}
+
+// Sends a duplicate when the first attempt has no response header after
+// `hedge_after`, the first response wins. The attempt still running is
+// cancelled, a response that arrives late is closed unread.
+template <class Response, class Request>
+inline boost::outcome_v2::result<std::unique_ptr<response<Response>>>
+send_hedged(const http_request<Request> &req, uint64_t redirect_count,
+            retry_budget &budget, boost::asio::yield_context yield) {
+  using response_ptr = std::unique_ptr<response<Response>>;
+  using result_channel = boost::asio::experimental::channel<void(
+      boost::system::error_code, std::size_t, response_ptr)>;
+  static constexpr std::size_t attempts = 2;
+  static constexpr auto timer_fired = attempts;
+
+  // Attempts report into the channel after this frame returned when they
+  // lose, they keep the shared state alive
+  struct hedge_state {
+    explicit hedge_state(const boost::asio::any_io_executor &executor)
+        : results(executor, attempts + 1) {}
+    result_channel results;
+    std::array<boost::asio::cancellation_signal, attempts> signals;
+  };
+  const auto executor = yield.get_executor();
+  auto state = std::make_shared<hedge_state>(executor);
+  std::size_t started = 0;
+  std::size_t pending = 0;
+  const auto start_attempt = [&] {
+    const auto index = started++;
+    ++pending;
+    boost::asio::spawn(
+        executor,
+        [state, req, redirect_count, index,
+         &budget](boost::asio::yield_context yield) {
+          auto resp = send_with_retries<Response, Request>(req, redirect_count,
+                                                           budget, yield);
+          if (resp.has_error()) {
+            state->results.try_send(resp.error(), index, nullptr);
+          } else {
+            state->results.try_send(boost::system::error_code{}, index,
+                                    std::move(resp).value());
+          }
+        },
+        boost::asio::bind_cancellation_slot(state->signals[index].slot(),
+                                            boost::asio::detached));
+  };
+
+  boost::asio::steady_timer timer{executor};
+  timer.expires_after(req.hedge_after);
+  timer.async_wait([state](boost::system::error_code ec) {
+    if (!ec) {
+      state->results.try_send(boost::system::error_code{}, timer_fired,
+                              nullptr);
+    }
+  });
+  start_attempt();
+  boost::system::error_code last_error;
+  while (true) {
+    boost::system::error_code ec;
+    auto [index, resp] = state->results.async_receive(yield[ec]);
+    if (index == timer_fired) {
+      if (started < attempts && budget.try_withdraw()) {
+        start_attempt();
+      }
+      continue;
+    }
+    --pending;
+    if (!ec) {
+      timer.cancel();
+      for (std::size_t i = 0; i < started; ++i) {
+        if (i != index) {
+          state->signals[i].emit(boost::asio::cancellation_type::terminal);
+        }
+      }
+      return boost::outcome_v2::success(std::move(resp));
+    }
+    last_error = ec;
+    if (pending == 0) {
+      timer.cancel();
+      return last_error;
+    }
+  }
+}
+
+template <class Response, class Request>
+inline boost::outcome_v2::result<std::unique_ptr<response<Response>>>
+send(http_request<Request> req, uint64_t redirect_count,
+     boost::asio::yield_context yield);
+
+// Fetches `req` over the network, revalidating `stored` when given, and
+// keeps the response in `cache` when it may be stored. Redirects are
+// returned, not followed.
+template <class Response, class Request>
+inline boost::outcome_v2::result<std::unique_ptr<response<Response>>>
+fetch_cached(http_request<Request> req, http_cache &cache,
+             const std::string &key,
+             const std::shared_ptr<const cached_response> &stored,
+             uint64_t redirect_count, boost::asio::yield_context yield) {
+  namespace http = boost::beast::http;
+  const bool decompress = req.decompress;
+  // Bodies are stored as sent and decoded on every replay
+  req.decompress = false;
+  req.auto_redirect = false;
+  if (stored) {
+    if (const auto etag = stored->head[http::field::etag]; !etag.empty()) {
+      req.request.set(http::field::if_none_match, etag);
+    }
+    if (const auto modified = stored->head[http::field::last_modified];
+        !modified.empty()) {
+      req.request.set(http::field::if_modified_since, modified);
+    }
+  }
+  const auto request_time = std::chrono::system_clock::now();
+  auto resp = send<Response, Request>(req, redirect_count, yield);
+  if (resp.has_error()) {
+    return resp;
+  }
+  auto &fetched = *resp.value();
+  if (stored && fetched.status() == http::status::not_modified) {
+    auto entry = refresh_cache_entry(*stored, fetched.header(), request_time);
+    // The 304 ends with its header, the connection goes back to the pool
+    // before the stored body is served
+    fetched.discard_body(yield);
+    fetched.close();
+    resp.value().reset();
+    cache.store(key, entry);
+    cache.count_revalidated();
+    return make_cached_response<Response>(*entry, decompress, yield);
+  }
+  auto entry = make_cache_entry(req.request, fetched.header(), request_time);
+  // Only bodies of a known, small enough size are buffered for the cache
+  const auto length = fetched.header()[http::field::content_length];
+  std::size_t size = 0;
+  const auto parsed =
+      std::from_chars(length.data(), length.data() + length.size(), size);
+  if (parsed.ec != std::errc{} || size > cache.options().max_entry_bytes) {
+    entry.reset();
+  }
+  if (!entry) {
+    // A newer response that cannot be stored replaces the old one
+    if (stored) {
+      cache.invalidate(key);
+    }
+    fetched.decompress(decompress);
+    return resp;
+  }
+  auto body = std::make_shared<std::string>();
+  body->reserve(size);
+  if (auto body_read = fetched.read_body(
+          [&](std::string_view piece) {
+            body->append(piece);
+            return true;
+          },
+          yield);
+      body_read.has_error()) {
+    return body_read.error();
+  }
+  resp.value().reset();
+  entry->body = std::move(body);
+  cache.store(key, entry);
+  return make_cached_response<Response>(*entry, decompress, yield);
+}
+
+// Serves GET requests from `cache` while fresh, or stale within
+// stale-while-revalidate as a background revalidation runs. Other methods
+// go to the network and invalidate the stored response on success.
+template <class Response, class Request>
+inline boost::outcome_v2::result<std::unique_ptr<response<Response>>>
+send_cached(http_request<Request> req, std::shared_ptr<http_cache> cache,
+            uint64_t redirect_count, boost::asio::yield_context yield) {
+  namespace http = boost::beast::http;
+  const auto key = http_cache::key_for(req.url);
+  const auto method = req.request.method();
+  const auto directives =
+      parse_cache_control(req.request[http::field::cache_control]);
+  if (method != http::verb::get || directives.no_store ||
+      req.request.count(http::field::range) > 0) {
+    const bool safe = method == http::verb::get ||
+                      method == http::verb::head ||
+                      method == http::verb::options ||
+                      method == http::verb::trace;
+    auto resp = send<Response, Request>(std::move(req), redirect_count, yield);
+    if (!safe && !resp.has_error() &&
+        static_cast<unsigned>(resp.value()->status()) < 400) {
+      cache->invalidate(key);
+    }
+    return resp;
+  }
+
+  const auto now = std::chrono::system_clock::now();
+  auto stored = cache->lookup(key, req.request);
+  boost::outcome_v2::result<std::unique_ptr<response<Response>>> resp{
+      boost::asio::error::not_found};
+  if (stored && !directives.no_cache && stored->is_fresh(now)) {
+    cache->count_hit();
+    resp = make_cached_response<Response>(*stored, req.decompress, yield);
+  } else if (stored && !directives.no_cache &&
+             stored->may_serve_stale(now)) {
+    // One revalidation per key, later requests keep getting the stale copy
+    if (cache->begin_revalidation(key)) {
+      boost::asio::spawn(
+          yield.get_executor(),
+          [req, cache, key, stored,
+           redirect_count](boost::asio::yield_context yield) {
+            (void)fetch_cached<Response, Request>(req, *cache, key, stored,
+                                                  redirect_count, yield);
+            cache->end_revalidation(key);
+          },
+          boost::asio::detached);
+    }
+    cache->count_stale_served();
+    resp = make_cached_response<Response>(*stored, req.decompress, yield);
+  } else {
+    resp = fetch_cached<Response, Request>(req, *cache, key, stored,
+                                           redirect_count, yield);
+  }
+  if (resp.has_error() || !resp.value()->is_redirection() ||
+      !req.auto_redirect) {
+    return resp;
+  }
+  auto loc = resp.value()->redirect_url();
+  if (!loc) {
+    return boost::beast::http::error::bad_field;
+  }
+  if (redirect_count > req.max_redirects) {
+    return boost::beast::errc::protocol_error;
+  }
+  resp.value()->discard_body(yield);
+  resp.value().reset();
+  req.url = *loc;
+  return send_cached<Response, Request>(std::move(req), std::move(cache),
+                                        redirect_count + 1, yield);
+}
+
+// Sends the request with the cache, retry and hedging settings of `req`
+template <class Response, class Request>
+inline boost::outcome_v2::result<std::unique_ptr<response<Response>>>
+send(http_request<Request> req, uint64_t redirect_count,
+     boost::asio::yield_context yield) {
+  if constexpr (std::is_copy_constructible_v<http_request<Request>>) {
+    if (req.cache) {
+      auto cache = std::move(req.cache);
+      return send_cached<Response, Request>(std::move(req), std::move(cache),
+                                            redirect_count, yield);
+    }
+  }
+  const bool hedge = req.hedge_after.count() > 0 &&
+                     is_idempotent(req.request.method()) && !req.body_stream;
+  const bool retry = req.retry.max_retries > 0 && !req.body_stream;
+  // Attempts need their own copy of the request, move-only bodies such as
+  // files are sent once
+  if constexpr (std::is_copy_constructible_v<http_request<Request>>) {
+    if (hedge || retry) {
+      auto &budget = req.budget ? *req.budget : *default_retry_budget();
+      budget.record_request();
+      if (hedge) {
+        return send_hedged<Response, Request>(req, redirect_count, budget,
+                                              yield);
+      }
+      return send_with_retries<Response, Request>(req, redirect_count, budget,
+                                                  yield);
+    }
+  }
+  return send_attempt<Response, Request>(std::move(req), redirect_count,
+                                         yield);
+}
+
+// Names are resolved through the request's dns_cache, `resolver` is only
+// kept for existing callers
+template <class Response, class Request>
+inline boost::outcome_v2::result<std::unique_ptr<response<Response>>>
+send(http_request<Request> req, boost::asio::ip::tcp::resolver &resolver,
+     uint64_t redirect_count, boost::asio::yield_context yield) {
+  return send<Response, Request>(std::move(req), redirect_count, yield);
+}
+
+template <class Response, class Request>
+inline boost::outcome_v2::result<std::unique_ptr<response<Response>>>
+send_http(http_request<Request> req, boost::asio::ip::tcp::resolver &resolver,
+          uint64_t redirect_count, boost::asio::yield_context yield) {
+  return send<Response, Request>(std::move(req), resolver, redirect_count,
+                                 yield);
+}
+
+template <class Response, class Request>
+inline boost::outcome_v2::result<std::unique_ptr<response<Response>>>
+send_https(http_request<Request> req, boost::asio::ip::tcp::resolver &resolver,
+           uint64_t redirect_count, boost::asio::yield_context yield) {
+  return send<Response, Request>(std::move(req), resolver, redirect_count,
+                                 yield);
 }
 
 template <class Response, class Request>
 boost::outcome_v2::result<std::unique_ptr<response<Response>>> inline send(
     http_request<Request> req, boost::asio::yield_context yield) {
-  auto resolver = boost::asio::ip::tcp::resolver(yield.get_executor());
-  return send<Response, Request>(req, resolver, 0, yield);
+  return send<Response, Request>(std::move(req), 0, yield);
 }
 } // namespace cpp_http::client
\ No newline at end of file
@@ -0,0 +1,585 @@
+#pragma once
+#include "client/http2_stream.hpp"
+#include "client/memory_stream.hpp"
+#include <boost/asio/error.hpp>
+#include <boost/asio/execution/context.hpp>
+#include <boost/asio/execution_context.hpp>
+#include <boost/asio/experimental/concurrent_channel.hpp>
+#include <boost/asio/query.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/ssl/stream.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/beast/core/tcp_stream.hpp>
+#include <boost/outcome/result.hpp>
+#include <boost/system/detail/error_code.hpp>
+#include <boost/url/scheme.hpp>
+#include <boost/url/url_view.hpp>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/socket.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace cpp_http::client {
+class connection_pool;
+class http2_session;
+
+/**
+ * A plain or TLS stream to one origin, or one HTTP/2 stream multiplexed
+ * over a connection owned by an http2_session, or a stored response
+ * replayed from memory.
+ *
+ * Connections handed out by a connection_pool count against the pool's
+ * per-host limit until they are destroyed or given back with
+ * connection_pool::release().
+ */
+class connection {
+public:
+  using tcp_stream = boost::beast::tcp_stream;
+  using ssl_stream = boost::asio::ssl::stream<boost::beast::tcp_stream>;
+
+  // Not connected yet, see attach()
+  connection() = default;
+  explicit connection(std::unique_ptr<tcp_stream> stream)
+      : stream_(std::move(stream)) {}
+  explicit connection(std::unique_ptr<ssl_stream> stream)
+      : ssl_stream_(std::move(stream)) {}
+  explicit connection(std::shared_ptr<http2_stream> stream)
+      : http2_stream_(std::move(stream)) {}
+  explicit connection(std::unique_ptr<memory_stream> stream)
+      : memory_stream_(std::move(stream)) {}
+  connection(const connection &) = delete;
+  connection &operator=(const connection &) = delete;
+  connection(connection &&) = delete;
+  connection &operator=(connection &&) = delete;
+  inline ~connection();
+
+  // Calls `f` with the underlying tcp_stream, ssl::stream, http2_stream or
+  // memory_stream
+  template <class F> decltype(auto) with_stream(F &&f) {
+    if (ssl_stream_) {
+      return f(*ssl_stream_);
+    }
+    if (http2_stream_) {
+      return f(*http2_stream_);
+    }
+    if (memory_stream_) {
+      return f(*memory_stream_);
+    }
+    return f(*stream_);
+  }
+
+  // Not available on HTTP/2 and memory streams
+  tcp_stream &lowest_layer() {
+    if (ssl_stream_) {
+      return boost::beast::get_lowest_layer(*ssl_stream_);
+    }
+    return *stream_;
+  }
+
+  [[nodiscard]] bool is_connected() const {
+    return stream_ || ssl_stream_ || http2_stream_ || memory_stream_;
+  }
+  [[nodiscard]] bool is_tls() const { return ssl_stream_ != nullptr; }
+  [[nodiscard]] bool is_http2() const { return http2_stream_ != nullptr; }
+  [[nodiscard]] bool is_memory() const { return memory_stream_ != nullptr; }
+  // True once the connection was used for a request before this one
+  [[nodiscard]] bool is_reused() const { return requests_ > 1; }
+  [[nodiscard]] std::uint64_t requests() const { return requests_; }
+  [[nodiscard]] const std::string &pool_key() const { return key_; }
+  // The pool this connection was checked out of, null once released
+  [[nodiscard]] const std::shared_ptr<connection_pool> &pool() const {
+    return pool_;
+  }
+
+  void attach(std::unique_ptr<tcp_stream> stream) {
+    stream_ = std::move(stream);
+  }
+  void attach(std::unique_ptr<ssl_stream> stream) {
+    ssl_stream_ = std::move(stream);
+  }
+
+  void mark_used() { ++requests_; }
+
+  // Set by whoever connected the transport when it speaks HTTP/2, via ALPN
+  // or prior knowledge
+  void set_negotiated_http2(bool http2) { negotiated_http2_ = http2; }
+  [[nodiscard]] bool negotiated_http2() const { return negotiated_http2_; }
+
+  // Deadline for the next operations, an HTTP/2 stream is reset on expiry
+  void expires_after(std::chrono::steady_clock::duration duration) {
+    if (http2_stream_) {
+      http2_stream_->expires_after(duration);
+    } else if (!memory_stream_) {
+      lowest_layer().expires_after(duration);
+    }
+  }
+
+  void expires_never() {
+    if (http2_stream_) {
+      http2_stream_->expires_never();
+    } else if (!memory_stream_) {
+      lowest_layer().expires_never();
+    }
+  }
+
+  // A pooled connection is healthy when the socket is open and the peer has
+  // neither closed it nor sent anything while it sat idle
+  [[nodiscard]] bool is_healthy() {
+    if (!is_connected() || is_http2() || is_memory()) {
+      return false;
+    }
+    auto &socket = lowest_layer().socket();
+    if (!socket.is_open()) {
+      return false;
+    }
+    char byte = 0;
+    const auto peeked = ::recv(socket.native_handle(), &byte, 1,
+                               MSG_PEEK | MSG_DONTWAIT);
+    return peeked < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+  }
+
+  void shutdown() {
+    if (http2_stream_) {
+      http2_stream_->cancel();
+      return;
+    }
+    if (!is_connected() || is_memory()) {
+      return;
+    }
+    boost::system::error_code ec;
+    // Without a yield_context a TLS close_notify cannot be sent, the TCP
+    // shutdown is enough for the peer to see the end of the connection
+    lowest_layer().socket().shutdown(
+        boost::asio::ip::tcp::socket::shutdown_both, ec);
+    lowest_layer().socket().close(ec);
+  }
+
+private:
+  friend class connection_pool;
+
+  std::unique_ptr<tcp_stream> stream_;
+  std::unique_ptr<ssl_stream> ssl_stream_;
+  std::shared_ptr<http2_stream> http2_stream_;
+  std::unique_ptr<memory_stream> memory_stream_;
+  // Set while the connection is checked out of a pool
+  std::shared_ptr<connection_pool> pool_;
+  std::string key_;
+  std::chrono::steady_clock::time_point idle_since_{};
+  std::uint64_t requests_{0};
+  bool negotiated_http2_{false};
+};
+
+struct pool_options {
+  // Open connections per origin and io_context, idle ones included
+  std::size_t max_connections_per_host{64};
+  // Idle connections older than this are closed instead of reused
+  std::chrono::milliseconds idle_timeout{std::chrono::seconds{30}};
+  // How long a request waits for a connection when the host is at its
+  // limit. Zero uses the timeout passed to checkout(), usually the
+  // request's own, and waits forever when that is zero too.
+  std::chrono::milliseconds wait_timeout{0};
+};
+
+/**
+ * Per execution_context bookkeeping of the pools holding its connections.
+ *
+ * Pooled streams are registered with the reactor of the io_context they
+ * were opened on. When that context shuts down, shutdown() closes the idle
+ * connections of every pool that holds some, so none outlives its
+ * reactor. The tag replaces the context address in pool keys, a later
+ * context at the same address never gets the old sockets.
+ */
+class pool_context_service : public boost::asio::execution_context::service {
+  static inline std::atomic<std::uint64_t> next_tag_{1};
+
+  std::uint64_t tag_;
+  std::mutex mutex_;
+  std::vector<std::pair<std::weak_ptr<connection_pool>, std::string>> keys_;
+
+public:
+  static inline boost::asio::execution_context::id id;
+
+  explicit pool_context_service(boost::asio::execution_context &context)
+      : boost::asio::execution_context::service(context),
+        tag_(next_tag_.fetch_add(1, std::memory_order_relaxed)) {}
+
+  [[nodiscard]] std::uint64_t tag() const { return tag_; }
+
+  // `pool` keeps connections under `key` on this context
+  void attach(std::weak_ptr<connection_pool> pool, std::string key) {
+    std::lock_guard lock{mutex_};
+    keys_.emplace_back(std::move(pool), std::move(key));
+  }
+
+  inline void shutdown() override;
+};
+
+/**
+ * Keep-alive connections shared by every request to the same scheme, host
+ * and port.
+ *
+ * checkout() hands out the most recently used healthy idle connection, or
+ * an unconnected one the caller has to connect when the host is below its
+ * limit, or waits for one of the two. Connections are bound to the
+ * io_context they were created on and only reused by requests running on
+ * the same one, so a single pool is safe to share between threads.
+ */
+class connection_pool : public std::enable_shared_from_this<connection_pool> {
+  using wakeup_channel = boost::asio::experimental::concurrent_channel<void(
+      boost::system::error_code)>;
+
+  struct waiter {
+    std::shared_ptr<wakeup_channel> wakeup;
+    bool granted{false};
+    std::unique_ptr<connection> granted_connection;
+  };
+
+  struct host {
+    std::vector<std::unique_ptr<connection>> idle;
+    std::deque<std::shared_ptr<waiter>> waiters;
+    std::size_t open{0};
+    // Known to the pool_context_service of its io_context
+    bool attached{false};
+  };
+
+  struct http2_entry {
+    std::weak_ptr<http2_session> session;
+    // A request is connecting for the key, the others wait for its session
+    bool pending{false};
+    // The origin did not negotiate h2, requests no longer wait for it
+    bool http1_only{false};
+    std::vector<std::shared_ptr<wakeup_channel>> followers;
+  };
+
+  pool_options options_;
+  std::mutex mutex_;
+  std::unordered_map<std::string, host> hosts_;
+  std::unordered_map<std::string, http2_entry> sessions_;
+  // Keys of io_contexts that shut down, connections released for them
+  // are closed instead of kept
+  std::unordered_set<std::string> closed_keys_;
+
+  struct private_tag {};
+
+  std::unique_ptr<connection> make_slot(const std::string &key) {
+    auto slot = std::make_unique<connection>();
+    slot->key_ = key;
+    slot->pool_ = shared_from_this();
+    return slot;
+  }
+
+  // Moves idle connections past their timeout into `evicted`
+  void evict_expired(host &host,
+                     std::vector<std::unique_ptr<connection>> &evicted) {
+    const auto deadline =
+        std::chrono::steady_clock::now() - options_.idle_timeout;
+    auto &idle = host.idle;
+    for (std::size_t i = 0; i < idle.size();) {
+      if (idle[i]->idle_since_ < deadline) {
+        evicted.push_back(std::move(idle[i]));
+        idle.erase(idle.begin() + static_cast<std::ptrdiff_t>(i));
+        --host.open;
+      } else {
+        ++i;
+      }
+    }
+  }
+
+  // Hands a freed slot or an idle connection to the oldest waiter, called
+  // with the mutex held
+  bool grant(host &host, std::unique_ptr<connection> conn) {
+    if (host.waiters.empty()) {
+      return false;
+    }
+    auto next = std::move(host.waiters.front());
+    host.waiters.pop_front();
+    next->granted = true;
+    next->granted_connection = std::move(conn);
+    next->wakeup->try_send(boost::system::error_code{});
+    return true;
+  }
+
+  // Called with the mutex held
+  static void wake_followers(http2_entry &entry) {
+    for (const auto &follower : entry.followers) {
+      follower->try_send(boost::system::error_code{});
+    }
+    entry.followers.clear();
+  }
+
+  // A checked out connection went away, its slot is free again
+  void closed(const std::string &key) {
+    std::lock_guard lock{mutex_};
+    if (closed_keys_.count(key) > 0) {
+      return;
+    }
+    auto &state = hosts_[key];
+    --state.open;
+    if (!state.waiters.empty()) {
+      ++state.open;
+      grant(state, make_slot(key));
+    }
+  }
+
+  friend class connection;
+
+public:
+  connection_pool(private_tag, pool_options options) : options_(options) {}
+
+  static std::shared_ptr<connection_pool> create(pool_options options = {}) {
+    return std::make_shared<connection_pool>(private_tag{}, options);
+  }
+
+  [[nodiscard]] const pool_options &options() const { return options_; }
+
+  // Pool key of `url` for requests running on `executor`
+  template <class Executor>
+  static std::string key_for(boost::urls::url_view url,
+                             const Executor &executor) {
+    const bool is_https = url.scheme_id() == boost::urls::scheme::https;
+    const auto port = url.port_number() > 0 ? url.port_number()
+                      : is_https            ? 443
+                                            : 80;
+    auto &context =
+        boost::asio::query(executor, boost::asio::execution::context);
+    return std::string(is_https ? "https://" : "http://") +
+           std::string(url.host_address()) + ":" + std::to_string(port) +
+           "@" +
+           std::to_string(
+               boost::asio::use_service<pool_context_service>(context).tag());
+  }
+
+  // Returns a connected, healthy idle connection or an unconnected one
+  // holding a free slot for `key`. A full host is waited for up to
+  // options().wait_timeout, or `wait_timeout` when that is zero.
+  boost::outcome_v2::result<std::unique_ptr<connection>>
+  checkout(const std::string &key, boost::asio::yield_context yield,
+           std::chrono::milliseconds wait_timeout = {}) {
+    std::vector<std::unique_ptr<connection>> evicted;
+    std::shared_ptr<waiter> queued;
+    bool attach = false;
+    {
+      std::lock_guard lock{mutex_};
+      auto &state = hosts_[key];
+      attach = !state.attached;
+      state.attached = true;
+    }
+    // The service locks its mutex before the pool's on shutdown, so this
+    // runs without the pool lock
+    if (attach) {
+      boost::asio::use_service<pool_context_service>(
+          boost::asio::query(yield.get_executor(),
+                             boost::asio::execution::context))
+          .attach(weak_from_this(), key);
+    }
+    {
+      std::lock_guard lock{mutex_};
+      auto &state = hosts_[key];
+      evict_expired(state, evicted);
+      while (!state.idle.empty()) {
+        auto conn = std::move(state.idle.back());
+        state.idle.pop_back();
+        if (conn->is_healthy()) {
+          conn->pool_ = shared_from_this();
+          return conn;
+        }
+        --state.open;
+        evicted.push_back(std::move(conn));
+      }
+      if (state.open < options_.max_connections_per_host) {
+        ++state.open;
+        return make_slot(key);
+      }
+      queued = std::make_shared<waiter>();
+      queued->wakeup = std::make_shared<wakeup_channel>(yield.get_executor(), 1);
+      state.waiters.push_back(queued);
+    }
+    // `evicted` is destroyed here, outside the lock
+    evicted.clear();
+
+    boost::asio::steady_timer timer{yield.get_executor()};
+    if (options_.wait_timeout.count() > 0) {
+      wait_timeout = options_.wait_timeout;
+    }
+    if (wait_timeout.count() > 0) {
+      timer.expires_after(wait_timeout);
+      timer.async_wait([wakeup = queued->wakeup](boost::system::error_code ec) {
+        if (!ec) {
+          wakeup->try_send(boost::asio::error::timed_out);
+        }
+      });
+    }
+    boost::system::error_code ec;
+    queued->wakeup->async_receive(yield[ec]);
+    timer.cancel();
+
+    std::lock_guard lock{mutex_};
+    if (!queued->granted) {
+      auto &waiters = hosts_[key].waiters;
+      for (auto it = waiters.begin(); it != waiters.end(); ++it) {
+        if (*it == queued) {
+          waiters.erase(it);
+          break;
+        }
+      }
+      return ec ? ec : boost::asio::error::timed_out;
+    }
+    return std::move(queued->granted_connection);
+  }
+
+  // Returns a connection whose last response was read completely and allowed
+  // keep-alive. Anything else should simply be destroyed.
+  void release(std::unique_ptr<connection> conn) {
+    const auto key = conn->key_;
+    conn->pool_.reset();
+    conn->idle_since_ = std::chrono::steady_clock::now();
+    std::unique_lock lock{mutex_};
+    if (closed_keys_.count(key) > 0) {
+      // Its io_context is gone, the connection is closed unlocked
+      lock.unlock();
+      conn.reset();
+      return;
+    }
+    auto &state = hosts_[key];
+    if (!state.waiters.empty()) {
+      // Waiters run on the same io_context, the connection is usable there
+      conn->pool_ = shared_from_this();
+      grant(state, std::move(conn));
+      return;
+    }
+    state.idle.push_back(std::move(conn));
+  }
+
+  // The HTTP/2 session requests for `key` share. Without one the first
+  // caller gets null with `lead` set and has to end with add_http2() or
+  // abandon_http2(), callers arriving meanwhile wait for it instead of
+  // opening connections of their own. Null without `lead` when the origin
+  // does not speak h2.
+  boost::outcome_v2::result<std::shared_ptr<http2_session>>
+  find_http2(const std::string &key, bool &lead,
+             boost::asio::yield_context yield) {
+    lead = false;
+    while (true) {
+      std::shared_ptr<wakeup_channel> wakeup;
+      {
+        std::lock_guard lock{mutex_};
+        auto &entry = sessions_[key];
+        if (auto session = entry.session.lock()) {
+          return session;
+        }
+        if (entry.http1_only) {
+          return nullptr;
+        }
+        if (!entry.pending) {
+          entry.pending = true;
+          lead = true;
+          return nullptr;
+        }
+        wakeup = std::make_shared<wakeup_channel>(yield.get_executor(), 1);
+        entry.followers.push_back(wakeup);
+      }
+      boost::system::error_code ec;
+      wakeup->async_receive(yield[ec]);
+      if (ec) {
+        return ec;
+      }
+    }
+  }
+
+  void add_http2(const std::string &key,
+                 const std::shared_ptr<http2_session> &session) {
+    std::lock_guard lock{mutex_};
+    auto &entry = sessions_[key];
+    entry.session = session;
+    entry.pending = false;
+    wake_followers(entry);
+  }
+
+  // Ends a lead from find_http2() without a session, `http1_only` when the
+  // origin answered without h2
+  void abandon_http2(const std::string &key, bool http1_only) {
+    std::lock_guard lock{mutex_};
+    auto &entry = sessions_[key];
+    entry.pending = false;
+    entry.http1_only = entry.http1_only || http1_only;
+    wake_followers(entry);
+  }
+
+  // Forgets `session` when it is still the one registered for `key`, the
+  // next find_http2() then sets up a new one
+  void remove_http2(const std::string &key,
+                    const std::shared_ptr<http2_session> &session) {
+    std::lock_guard lock{mutex_};
+    if (const auto it = sessions_.find(key);
+        it != sessions_.end() && it->second.session.lock() == session) {
+      it->second.session.reset();
+    }
+  }
+
+  // Closes the idle connections of `key` and drops its waiters and HTTP/2
+  // session, called when the io_context of the key shuts down
+  void purge(const std::string &key) {
+    std::vector<std::unique_ptr<connection>> idle;
+    {
+      std::lock_guard lock{mutex_};
+      closed_keys_.insert(key);
+      if (const auto it = sessions_.find(key); it != sessions_.end()) {
+        wake_followers(it->second);
+        sessions_.erase(it);
+      }
+      const auto it = hosts_.find(key);
+      if (it == hosts_.end()) {
+        return;
+      }
+      idle = std::move(it->second.idle);
+      hosts_.erase(it);
+    }
+    for (auto &conn : idle) {
+      conn->shutdown();
+    }
+  }
+
+  // Idle connections per key, for diagnostics
+  [[nodiscard]] std::size_t idle_count(const std::string &key) {
+    std::lock_guard lock{mutex_};
+    const auto it = hosts_.find(key);
+    return it == hosts_.end() ? 0 : it->second.idle.size();
+  }
+};
+
+inline void pool_context_service::shutdown() {
+  std::vector<std::pair<std::weak_ptr<connection_pool>, std::string>> keys;
+  {
+    std::lock_guard lock{mutex_};
+    keys.swap(keys_);
+  }
+  for (const auto &[weak_pool, key] : keys) {
+    if (const auto pool = weak_pool.lock()) {
+      pool->purge(key);
+    }
+  }
+}
+
+inline connection::~connection() {
+  if (pool_) {
+    auto pool = std::move(pool_);
+    pool->closed(key_);
+  }
+}
+
+// Shared by every request that does not bring its own pool
+inline const std::shared_ptr<connection_pool> &default_pool() {
+  static const auto pool = connection_pool::create();
+  return pool;
+}
+} // namespace cpp_http::client
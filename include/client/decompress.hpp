@@ -0,0 +1,379 @@
+#pragma once
+#include <boost/outcome/result.hpp>
+#include <boost/system/detail/errc.hpp>
+#include <boost/system/detail/error_code.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Codings are compiled in when their library was found by CMake, see
+// CPP_HTTP_HAS_ZLIB, CPP_HTTP_HAS_BROTLI and CPP_HTTP_HAS_ZSTD
+#ifdef CPP_HTTP_HAS_ZLIB
+#include <zlib.h>
+#endif
+#ifdef CPP_HTTP_HAS_BROTLI
+#include <brotli/decode.h>
+#endif
+#ifdef CPP_HTTP_HAS_ZSTD
+#include <zstd.h>
+#endif
+
+namespace cpp_http::client {
+enum class content_coding { identity, gzip, deflate, br, zstd, unsupported };
+
+inline content_coding parse_content_coding(std::string_view value) {
+  const auto equals = [value](std::string_view name) {
+    if (value.size() != name.size()) {
+      return false;
+    }
+    for (std::size_t i = 0; i < value.size(); ++i) {
+      const auto c = value[i] >= 'A' && value[i] <= 'Z'
+                         ? static_cast<char>(value[i] - 'A' + 'a')
+                         : value[i];
+      if (c != name[i]) {
+        return false;
+      }
+    }
+    return true;
+  };
+  if (value.empty() || equals("identity")) {
+    return content_coding::identity;
+  }
+  if (equals("gzip") || equals("x-gzip")) {
+    return content_coding::gzip;
+  }
+  if (equals("deflate")) {
+    return content_coding::deflate;
+  }
+  if (equals("br")) {
+    return content_coding::br;
+  }
+  if (equals("zstd")) {
+    return content_coding::zstd;
+  }
+  return content_coding::unsupported;
+}
+
+// Accept-Encoding value listing the codings this build can decode
+inline std::string_view accepted_encodings() {
+  static const std::string value = [] {
+    std::string codings;
+    const auto add = [&codings](std::string_view coding) {
+      if (!codings.empty()) {
+        codings.append(", ");
+      }
+      codings.append(coding);
+    };
+#ifdef CPP_HTTP_HAS_ZSTD
+    add("zstd");
+#endif
+#ifdef CPP_HTTP_HAS_BROTLI
+    add("br");
+#endif
+#ifdef CPP_HTTP_HAS_ZLIB
+    add("gzip");
+    add("deflate");
+#endif
+    if (codings.empty()) {
+      codings = "identity";
+    }
+    return codings;
+  }();
+  return value;
+}
+
+/**
+ * Incremental decoder for one response body.
+ *
+ * Input may be split anywhere. decode_some() produces at most one piece of
+ * output per call and reports how much input it used, the caller keeps the
+ * rest for the next call. Memory then stays bounded by the coding's window
+ * and the piece size, however far the input expands. decode() appends
+ * everything the input decodes to, for callers that keep the whole body.
+ */
+class decompressor {
+public:
+  // Output is produced in pieces of this size
+  static constexpr std::size_t piece_size = 16 * 1024;
+
+  virtual ~decompressor() = default;
+
+  // Appends at most `limit` decoded bytes to `out` and returns the number
+  // of input bytes used. When `limit` bytes came out the decoder may hold
+  // more, the next call returns it even with empty input.
+  virtual boost::outcome_v2::result<std::size_t>
+  decode_some(std::string_view input, std::string &out,
+              std::size_t limit) = 0;
+
+  boost::outcome_v2::result<void> decode(std::string_view input,
+                                         std::string &out) {
+    while (true) {
+      const auto before = out.size();
+      auto used = decode_some(input, out, piece_size);
+      if (used.has_error()) {
+        return used.error();
+      }
+      input.remove_prefix(used.value());
+      const auto produced = out.size() - before;
+      // Bytes after the end of the stream that the coding ignores make no
+      // progress
+      if (produced < piece_size && (input.empty() || used.value() == 0)) {
+        return boost::outcome_v2::success();
+      }
+    }
+  }
+
+  // Null when the coding is identity or not compiled in
+  static inline std::unique_ptr<decompressor> create(content_coding coding);
+
+protected:
+  static boost::system::error_code corrupt() {
+    return boost::system::errc::make_error_code(
+        boost::system::errc::illegal_byte_sequence);
+  }
+};
+
+#ifdef CPP_HTTP_HAS_ZLIB
+class zlib_decompressor : public decompressor {
+  // Inflate states are reused by later responses on the same thread,
+  // inflateReset2() is much cheaper than inflateInit2() and its allocations
+  struct state {
+    z_stream stream{};
+    ~state() { inflateEnd(&stream); }
+  };
+
+  static std::vector<std::unique_ptr<state>> &cache() {
+    thread_local std::vector<std::unique_ptr<state>> states;
+    return states;
+  }
+
+  std::unique_ptr<state> state_;
+  int window_bits_;
+  // deflate is meant to be zlib wrapped but some servers send it raw, the
+  // first two bytes tell which one it is
+  bool detect_wrapper_;
+  std::string prefix_;
+  bool failed_{false};
+
+  bool reset(int window_bits) {
+    window_bits_ = window_bits;
+    return inflateReset2(&state_->stream, window_bits) == Z_OK;
+  }
+
+  static bool is_zlib_header(std::string_view bytes) {
+    const auto cmf = static_cast<unsigned char>(bytes[0]);
+    const auto flg = static_cast<unsigned char>(bytes[1]);
+    return (cmf & 0x0f) == Z_DEFLATED && (cmf * 256 + flg) % 31 == 0;
+  }
+
+  boost::outcome_v2::result<std::size_t>
+  inflate_some(std::string_view input, std::string &out, std::size_t limit) {
+    auto &stream = state_->stream;
+    stream.next_in =
+        reinterpret_cast<Bytef *>(const_cast<char *>(input.data()));
+    stream.avail_in = static_cast<uInt>(input.size());
+    const auto before = out.size();
+    out.resize(before + limit);
+    stream.next_out = reinterpret_cast<Bytef *>(out.data() + before);
+    stream.avail_out = static_cast<uInt>(limit);
+    while (stream.avail_out > 0) {
+      const auto ret = inflate(&stream, Z_NO_FLUSH);
+      if (ret == Z_STREAM_END) {
+        // gzip bodies may hold several members
+        if (stream.avail_in == 0) {
+          break;
+        }
+        if (!reset(window_bits_)) {
+          failed_ = true;
+          out.resize(before);
+          return corrupt();
+        }
+      } else if (ret == Z_BUF_ERROR) {
+        break;
+      } else if (ret != Z_OK) {
+        failed_ = true;
+        out.resize(before);
+        return corrupt();
+      } else if (stream.avail_in == 0) {
+        break;
+      }
+    }
+    out.resize(before + limit - stream.avail_out);
+    return input.size() - stream.avail_in;
+  }
+
+public:
+  explicit zlib_decompressor(content_coding coding)
+      : window_bits_(coding == content_coding::gzip ? 15 + 16 : 15),
+        detect_wrapper_(coding == content_coding::deflate) {
+    auto &states = cache();
+    if (!states.empty()) {
+      state_ = std::move(states.back());
+      states.pop_back();
+      failed_ = !reset(window_bits_);
+    } else {
+      state_ = std::make_unique<state>();
+      failed_ = inflateInit2(&state_->stream, window_bits_) != Z_OK;
+    }
+  }
+
+  ~zlib_decompressor() override {
+    auto &states = cache();
+    if (!failed_ && states.size() < 16) {
+      states.push_back(std::move(state_));
+    }
+  }
+
+  boost::outcome_v2::result<std::size_t>
+  decode_some(std::string_view input, std::string &out,
+              std::size_t limit) override {
+    if (failed_) {
+      return corrupt();
+    }
+    if (!detect_wrapper_) {
+      return inflate_some(input, out, limit);
+    }
+    if (prefix_.size() + input.size() < 2) {
+      prefix_.append(input);
+      return input.size();
+    }
+    detect_wrapper_ = false;
+    const auto taken = 2 - prefix_.size();
+    prefix_.append(input.substr(0, taken));
+    if (!is_zlib_header(prefix_) && !reset(-15)) {
+      failed_ = true;
+      return corrupt();
+    }
+    // A single held back byte is a header byte or part of the first block
+    // header and never decodes to output on its own
+    if (taken == 1) {
+      const auto held =
+          inflate_some(std::string_view{prefix_.data(), 1}, out, limit);
+      if (held.has_error()) {
+        return held.error();
+      }
+    }
+    prefix_ = std::string{};
+    return inflate_some(input, out, limit);
+  }
+};
+#endif
+
+#ifdef CPP_HTTP_HAS_BROTLI
+class brotli_decompressor : public decompressor {
+  // Brotli has no reset, each body gets its own instance
+  std::unique_ptr<BrotliDecoderState, decltype(&BrotliDecoderDestroyInstance)>
+      state_{BrotliDecoderCreateInstance(nullptr, nullptr, nullptr),
+             &BrotliDecoderDestroyInstance};
+
+public:
+  boost::outcome_v2::result<std::size_t>
+  decode_some(std::string_view input, std::string &out,
+              std::size_t limit) override {
+    if (!state_) {
+      return corrupt();
+    }
+    auto available_in = input.size();
+    const auto *next_in = reinterpret_cast<const std::uint8_t *>(input.data());
+    const auto before = out.size();
+    out.resize(before + limit);
+    auto available_out = limit;
+    auto *next_out = reinterpret_cast<std::uint8_t *>(out.data() + before);
+    const auto ret = BrotliDecoderDecompressStream(
+        state_.get(), &available_in, &next_in, &available_out, &next_out,
+        nullptr);
+    out.resize(before + limit - available_out);
+    if (ret == BROTLI_DECODER_RESULT_ERROR) {
+      return corrupt();
+    }
+    return input.size() - available_in;
+  }
+};
+#endif
+
+#ifdef CPP_HTTP_HAS_ZSTD
+class zstd_decompressor : public decompressor {
+  struct context_deleter {
+    void operator()(ZSTD_DCtx *context) const { ZSTD_freeDCtx(context); }
+  };
+  using context_ptr = std::unique_ptr<ZSTD_DCtx, context_deleter>;
+
+  static std::vector<context_ptr> &cache() {
+    thread_local std::vector<context_ptr> contexts;
+    return contexts;
+  }
+
+  context_ptr context_;
+
+public:
+  zstd_decompressor() {
+    auto &contexts = cache();
+    if (!contexts.empty()) {
+      context_ = std::move(contexts.back());
+      contexts.pop_back();
+      ZSTD_DCtx_reset(context_.get(), ZSTD_reset_session_only);
+    } else {
+      context_.reset(ZSTD_createDCtx());
+    }
+  }
+
+  ~zstd_decompressor() override {
+    auto &contexts = cache();
+    if (context_ && contexts.size() < 16) {
+      contexts.push_back(std::move(context_));
+    }
+  }
+
+  boost::outcome_v2::result<std::size_t>
+  decode_some(std::string_view input, std::string &out,
+              std::size_t limit) override {
+    if (!context_) {
+      return corrupt();
+    }
+    ZSTD_inBuffer in{input.data(), input.size(), 0};
+    const auto before = out.size();
+    out.resize(before + limit);
+    ZSTD_outBuffer output{out.data() + before, limit, 0};
+    while (output.pos < output.size) {
+      const auto in_pos = in.pos;
+      const auto out_pos = output.pos;
+      const auto ret = ZSTD_decompressStream(context_.get(), &output, &in);
+      if (ZSTD_isError(ret)) {
+        out.resize(before);
+        return corrupt();
+      }
+      if (in.pos == in.size || (in.pos == in_pos && output.pos == out_pos)) {
+        break;
+      }
+    }
+    out.resize(before + output.pos);
+    return in.pos;
+  }
+};
+#endif
+
+inline std::unique_ptr<decompressor>
+decompressor::create(content_coding coding) {
+  switch (coding) {
+#ifdef CPP_HTTP_HAS_ZLIB
+  case content_coding::gzip:
+  case content_coding::deflate:
+    return std::make_unique<zlib_decompressor>(coding);
+#endif
+#ifdef CPP_HTTP_HAS_BROTLI
+  case content_coding::br:
+    return std::make_unique<brotli_decompressor>();
+#endif
+#ifdef CPP_HTTP_HAS_ZSTD
+  case content_coding::zstd:
+    return std::make_unique<zstd_decompressor>();
+#endif
+  default:
+    return nullptr;
+  }
+}
+} // namespace cpp_http::client
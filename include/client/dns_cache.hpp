@@ -0,0 +1,298 @@
+#pragma once
+#include <boost/asio/detached.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/experimental/concurrent_channel.hpp>
+#include <boost/asio/ip/address.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/outcome/result.hpp>
+#include <boost/system/detail/error_code.hpp>
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace cpp_http::client {
+using endpoint_list = std::vector<boost::asio::ip::tcp::endpoint>;
+
+// Resolves `host` and `port`, replaceable by a stub for offline use
+using lookup_function = std::function<boost::outcome_v2::result<endpoint_list>(
+    const std::string &host, const std::string &port,
+    boost::asio::yield_context yield)>;
+
+struct dns_options {
+  // getaddrinfo() does not report record TTLs, answers are kept this long
+  std::chrono::milliseconds positive_ttl{std::chrono::seconds{60}};
+  // Failed lookups are remembered this long
+  std::chrono::milliseconds negative_ttl{std::chrono::seconds{5}};
+  // Past its TTL an answer is still served this long while a background
+  // lookup refreshes it
+  std::chrono::milliseconds stale_ttl{std::chrono::seconds{30}};
+  std::size_t max_entries{4096};
+};
+
+// Lookup through the system resolver on the caller's executor
+inline boost::outcome_v2::result<endpoint_list>
+system_lookup(const std::string &host, const std::string &port,
+              boost::asio::yield_context yield) {
+  boost::system::error_code ec;
+  boost::asio::ip::tcp::resolver resolver{yield.get_executor()};
+  auto results = resolver.async_resolve(host, port, yield[ec]);
+  if (ec) {
+    return ec;
+  }
+  endpoint_list endpoints;
+  endpoints.reserve(results.size());
+  for (const auto &entry : results) {
+    endpoints.push_back(entry.endpoint());
+  }
+  return endpoints;
+}
+
+/**
+ * Name resolution shared by every request.
+ *
+ * Answers are cached per host and port with a positive and a negative TTL.
+ * Concurrent lookups of the same name wait for a single query, expired
+ * answers are served while a background lookup refreshes them, and each
+ * resolve() rotates the endpoint list so connections spread over all
+ * addresses. Overrides, e.g. from a hosts file, take precedence over
+ * lookups and never expire.
+ */
+class dns_cache : public std::enable_shared_from_this<dns_cache> {
+  using clock = std::chrono::steady_clock;
+  using wakeup_channel = boost::asio::experimental::concurrent_channel<void(
+      boost::system::error_code)>;
+
+  struct entry {
+    endpoint_list endpoints;
+    boost::system::error_code error;
+    clock::time_point expires{};
+    clock::time_point stale_until{};
+    bool resolving{false};
+    std::vector<std::shared_ptr<wakeup_channel>> waiters;
+    std::uint64_t next{0};
+  };
+
+  dns_options options_;
+  lookup_function lookup_;
+  std::mutex mutex_;
+  std::unordered_map<std::string, entry> entries_;
+  std::unordered_map<std::string, std::vector<boost::asio::ip::address>>
+      overrides_;
+
+  struct private_tag {};
+
+  // Copy of the answer starting at the next endpoint, called with the mutex
+  // held
+  static endpoint_list rotated(entry &entry) {
+    endpoint_list endpoints;
+    const auto size = entry.endpoints.size();
+    endpoints.reserve(size);
+    const auto first = size == 0 ? 0 : entry.next++ % size;
+    for (std::size_t i = 0; i < size; ++i) {
+      endpoints.push_back(entry.endpoints[(first + i) % size]);
+    }
+    return endpoints;
+  }
+
+  // Drops answers past their stale window once the cache is full, called
+  // with the mutex held
+  void trim(clock::time_point now) {
+    if (entries_.size() < options_.max_entries) {
+      return;
+    }
+    for (auto it = entries_.begin(); it != entries_.end();) {
+      if (!it->second.resolving && it->second.stale_until < now) {
+        it = entries_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  // Runs the lookup for `key` and wakes everyone waiting for it
+  void refresh(const std::string &key, const std::string &host,
+               const std::string &port, boost::asio::yield_context yield) {
+    auto answer = lookup_(host, port, yield);
+    std::vector<std::shared_ptr<wakeup_channel>> waiters;
+    {
+      std::lock_guard lock{mutex_};
+      const auto now = clock::now();
+      auto &state = entries_[key];
+      state.resolving = false;
+      waiters.swap(state.waiters);
+      if (answer.has_value() && !answer.value().empty()) {
+        state.endpoints = std::move(answer).value();
+        state.error = {};
+        state.expires = now + options_.positive_ttl;
+        state.stale_until = state.expires + options_.stale_ttl;
+      } else if (!state.endpoints.empty() && state.stale_until > now) {
+        // A failed refresh keeps serving the stale answer and is retried
+        // after the negative TTL
+        state.expires = std::min(now + options_.negative_ttl, state.stale_until);
+      } else {
+        state.endpoints.clear();
+        state.error = answer.has_error()
+                          ? answer.error()
+                          : boost::asio::error::host_not_found;
+        state.expires = now + options_.negative_ttl;
+        state.stale_until = state.expires;
+      }
+    }
+    for (const auto &waiter : waiters) {
+      waiter->try_send(boost::system::error_code{});
+    }
+  }
+
+public:
+  dns_cache(private_tag, dns_options options, lookup_function lookup)
+      : options_(options),
+        lookup_(lookup ? std::move(lookup) : lookup_function{system_lookup}) {}
+
+  static std::shared_ptr<dns_cache> create(dns_options options = {},
+                                           lookup_function lookup = {}) {
+    return std::make_shared<dns_cache>(private_tag{}, options,
+                                       std::move(lookup));
+  }
+
+  // Resolves `host` to `addresses` without any lookup
+  void set_override(const std::string &host,
+                    std::vector<boost::asio::ip::address> addresses) {
+    std::lock_guard lock{mutex_};
+    overrides_[host] = std::move(addresses);
+  }
+
+  // Reads overrides in /etc/hosts format, returns false when the file
+  // cannot be opened
+  bool load_hosts_file(const std::string &path) {
+    std::ifstream file{path};
+    if (!file) {
+      return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+      line = line.substr(0, line.find('#'));
+      std::istringstream fields{line};
+      std::string address_text;
+      if (!(fields >> address_text)) {
+        continue;
+      }
+      boost::system::error_code ec;
+      const auto address = boost::asio::ip::make_address(address_text, ec);
+      if (ec) {
+        continue;
+      }
+      std::string name;
+      std::lock_guard lock{mutex_};
+      while (fields >> name) {
+        overrides_[name].push_back(address);
+      }
+    }
+    return true;
+  }
+
+  // Forgets every cached answer, overrides are kept
+  void clear() {
+    std::lock_guard lock{mutex_};
+    for (auto it = entries_.begin(); it != entries_.end();) {
+      if (it->second.resolving) {
+        ++it;
+      } else {
+        it = entries_.erase(it);
+      }
+    }
+  }
+
+  boost::outcome_v2::result<endpoint_list>
+  resolve(const std::string &host, const std::string &port,
+          boost::asio::yield_context yield) {
+    auto key = host + ":" + port;
+    std::shared_ptr<wakeup_channel> wakeup;
+    bool lead = false;
+    {
+      std::lock_guard lock{mutex_};
+      if (const auto it = overrides_.find(host); it != overrides_.end()) {
+        std::uint16_t number = 0;
+        std::from_chars(port.data(), port.data() + port.size(), number);
+        endpoint_list endpoints;
+        for (const auto &address : it->second) {
+          endpoints.emplace_back(address, number);
+        }
+        return endpoints;
+      }
+      const auto now = clock::now();
+      auto found = entries_.find(key);
+      if (found == entries_.end()) {
+        trim(now);
+        found = entries_.emplace(key, entry{}).first;
+      }
+      auto &state = found->second;
+      if (state.expires > now) {
+        if (state.error) {
+          return state.error;
+        }
+        return rotated(state);
+      }
+      if (state.stale_until > now && !state.endpoints.empty()) {
+        if (!state.resolving) {
+          state.resolving = true;
+          boost::asio::spawn(
+              yield.get_executor(),
+              [self = shared_from_this(), key, host,
+               port](boost::asio::yield_context yield) {
+                self->refresh(key, host, port, yield);
+              },
+              boost::asio::detached);
+        }
+        return rotated(state);
+      }
+      if (state.resolving) {
+        wakeup = std::make_shared<wakeup_channel>(yield.get_executor(), 1);
+        state.waiters.push_back(wakeup);
+      } else {
+        state.resolving = true;
+        lead = true;
+      }
+    }
+
+    if (lead) {
+      refresh(key, host, port, yield);
+    } else {
+      boost::system::error_code ec;
+      wakeup->async_receive(yield[ec]);
+      if (ec) {
+        return ec;
+      }
+    }
+    std::lock_guard lock{mutex_};
+    auto &state = entries_[key];
+    if (state.error) {
+      return state.error;
+    }
+    if (state.endpoints.empty()) {
+      // Trimmed between the lookup and this read
+      return boost::asio::error::host_not_found;
+    }
+    return rotated(state);
+  }
+};
+
+// Shared by every request that does not bring its own cache
+inline const std::shared_ptr<dns_cache> &default_dns_cache() {
+  static const auto cache = dns_cache::create();
+  return cache;
+}
+} // namespace cpp_http::client
@@ -0,0 +1,243 @@
+#pragma once
+#include "client/dns_cache.hpp"
+#include <boost/asio/error.hpp>
+#include <boost/asio/experimental/channel.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/beast/core/tcp_stream.hpp>
+#include <boost/outcome/result.hpp>
+#include <boost/system/detail/error_code.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// Connection racing over all resolved addresses, RFC 8305
+namespace cpp_http::client {
+struct happy_eyeballs_options {
+  // Delay before the next address is tried while earlier attempts are still
+  // pending, section 5 recommends 250ms
+  std::chrono::milliseconds attempt_delay{250};
+  // A failed address is tried last for this long, doubling with every
+  // further failure up to max_penalty
+  std::chrono::milliseconds penalty{std::chrono::seconds{10}};
+  std::chrono::milliseconds max_penalty{std::chrono::minutes{5}};
+};
+
+/**
+ * Recent connect failures per address.
+ *
+ * Addresses that failed recently are moved behind the others, so a dead
+ * address costs one attempt delay once instead of on every connection.
+ * A successful connect clears the history of the address.
+ */
+class endpoint_history {
+  using clock = std::chrono::steady_clock;
+
+  struct failures {
+    std::uint32_t count{0};
+    clock::time_point until{};
+  };
+
+  std::mutex mutex_;
+  std::map<boost::asio::ip::tcp::endpoint, failures> failures_;
+
+public:
+  void record_failure(const boost::asio::ip::tcp::endpoint &endpoint,
+                      const happy_eyeballs_options &options) {
+    std::lock_guard lock{mutex_};
+    auto &entry = failures_[endpoint];
+    entry.count = std::min<std::uint32_t>(entry.count + 1, 16);
+    const std::chrono::milliseconds penalty =
+        options.penalty * (1U << (entry.count - 1));
+    entry.until = clock::now() + std::min(penalty, options.max_penalty);
+  }
+
+  void record_success(const boost::asio::ip::tcp::endpoint &endpoint) {
+    std::lock_guard lock{mutex_};
+    failures_.erase(endpoint);
+  }
+
+  [[nodiscard]] bool
+  is_penalized(const boost::asio::ip::tcp::endpoint &endpoint) {
+    std::lock_guard lock{mutex_};
+    const auto it = failures_.find(endpoint);
+    if (it == failures_.end()) {
+      return false;
+    }
+    if (it->second.until < clock::now()) {
+      // Worth another try, a further failure doubles the penalty
+      return false;
+    }
+    return true;
+  }
+};
+
+inline endpoint_history &default_endpoint_history() {
+  static endpoint_history history;
+  return history;
+}
+
+// Alternates address families starting with the family of the first
+// address, section 4
+inline endpoint_list interleave_families(const endpoint_list &endpoints) {
+  if (endpoints.empty()) {
+    return {};
+  }
+  const bool v6_first = endpoints.front().address().is_v6();
+  endpoint_list preferred;
+  endpoint_list other;
+  for (const auto &endpoint : endpoints) {
+    (endpoint.address().is_v6() == v6_first ? preferred : other)
+        .push_back(endpoint);
+  }
+  endpoint_list ordered;
+  ordered.reserve(endpoints.size());
+  for (std::size_t i = 0; i < std::max(preferred.size(), other.size()); ++i) {
+    if (i < preferred.size()) {
+      ordered.push_back(preferred[i]);
+    }
+    if (i < other.size()) {
+      ordered.push_back(other[i]);
+    }
+  }
+  return ordered;
+}
+
+// Order in which connect attempts are started: addresses without recent
+// failures first, each group with interleaved families
+inline endpoint_list order_endpoints(const endpoint_list &endpoints,
+                                     endpoint_history &history) {
+  endpoint_list healthy;
+  endpoint_list penalized;
+  for (const auto &endpoint : endpoints) {
+    (history.is_penalized(endpoint) ? penalized : healthy).push_back(endpoint);
+  }
+  auto ordered = interleave_families(healthy);
+  for (auto &endpoint : interleave_families(penalized)) {
+    ordered.push_back(endpoint);
+  }
+  return ordered;
+}
+
+/**
+ * Connects to the first address that answers.
+ *
+ * Attempts start one attempt delay apart, or right away when the previous
+ * one failed. The first established connection wins and the others are
+ * closed. `timeout` bounds the whole race, zero waits forever.
+ */
+inline boost::outcome_v2::result<std::unique_ptr<boost::beast::tcp_stream>>
+race_connect(const endpoint_list &endpoints, std::chrono::milliseconds timeout,
+             boost::asio::yield_context yield,
+             endpoint_history &history = default_endpoint_history(),
+             const happy_eyeballs_options &options = {}) {
+  using result_channel = boost::asio::experimental::channel<void(
+      boost::system::error_code, std::size_t)>;
+  static constexpr auto timer_fired = std::numeric_limits<std::size_t>::max();
+
+  const auto ordered = order_endpoints(endpoints, history);
+  if (ordered.empty()) {
+    return boost::asio::error::host_not_found;
+  }
+  const auto executor = yield.get_executor();
+  // Attempts and timers outlive this frame when they complete after the
+  // race was decided, they report into a channel kept alive by their
+  // handlers
+  auto results =
+      std::make_shared<result_channel>(executor, 2 * ordered.size() + 2);
+  std::vector<std::unique_ptr<boost::beast::tcp_stream>> attempts(
+      ordered.size());
+  // Start time of attempts that have not completed yet
+  std::vector<std::optional<std::chrono::steady_clock::time_point>> started(
+      ordered.size());
+  std::size_t next = 0;
+  std::size_t pending = 0;
+  const auto start_attempt = [&] {
+    const auto index = next++;
+    ++pending;
+    started[index] = std::chrono::steady_clock::now();
+    attempts[index] = std::make_unique<boost::beast::tcp_stream>(executor);
+    attempts[index]->async_connect(
+        ordered[index], [results, index](boost::system::error_code ec) {
+          results->try_send(ec, index);
+        });
+  };
+  const auto close_attempts = [&](std::size_t keep) {
+    for (std::size_t i = 0; i < attempts.size(); ++i) {
+      if (i != keep && attempts[i]) {
+        attempts[i]->close();
+      }
+    }
+  };
+
+  const auto deadline = timeout.count() > 0
+                            ? std::chrono::steady_clock::now() + timeout
+                            : std::chrono::steady_clock::time_point::max();
+  boost::asio::steady_timer timer{executor};
+  auto generation = std::make_shared<std::uint64_t>(0);
+  boost::system::error_code last_error = boost::asio::error::timed_out;
+  start_attempt();
+  while (true) {
+    auto wake_at = deadline;
+    if (next < ordered.size()) {
+      wake_at = std::min(wake_at, std::chrono::steady_clock::now() +
+                                      options.attempt_delay);
+    }
+    timer.expires_at(wake_at);
+    timer.async_wait([results, generation,
+                      expected = ++*generation](boost::system::error_code ec) {
+      // A timer that fired while the race moved on is stale
+      if (!ec && *generation == expected) {
+        results->try_send(boost::system::error_code{}, timer_fired);
+      }
+    });
+
+    boost::system::error_code ec;
+    const auto index = results->async_receive(yield[ec]);
+    timer.cancel();
+    ++*generation;
+
+    if (index == timer_fired) {
+      if (std::chrono::steady_clock::now() >= deadline) {
+        close_attempts(timer_fired);
+        return boost::asio::error::timed_out;
+      }
+      if (next < ordered.size()) {
+        start_attempt();
+      }
+      continue;
+    }
+    --pending;
+    started[index].reset();
+    if (!ec) {
+      history.record_success(ordered[index]);
+      // An address that stayed silent for a whole attempt delay while a
+      // later one won is likely blackholed, it goes to the back next time
+      const auto now = std::chrono::steady_clock::now();
+      for (std::size_t i = 0; i < index; ++i) {
+        if (started[i] && now - *started[i] >= options.attempt_delay) {
+          history.record_failure(ordered[i], options);
+        }
+      }
+      close_attempts(index);
+      return std::move(attempts[index]);
+    }
+    history.record_failure(ordered[index], options);
+    last_error = ec;
+    if (next < ordered.size()) {
+      start_attempt();
+    } else if (pending == 0) {
+      return last_error;
+    }
+  }
+}
+} // namespace cpp_http::client
@@ -0,0 +1,417 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// HPACK header compression for HTTP/2, RFC 7541
+namespace cpp_http::client::hpack {
+struct header_field {
+  std::string name;
+  std::string value;
+};
+
+struct static_entry {
+  std::string_view name;
+  std::string_view value;
+};
+
+// Appendix A, index 1 is the first entry
+inline constexpr std::array<static_entry, 61> static_table{{
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+}};
+
+// Appendix B code lengths per symbol. The code is canonical, the codes
+// themselves follow from the lengths.
+inline constexpr std::array<std::uint8_t, 256> huffman_code_lengths{{
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+}};
+
+namespace detail {
+struct huffman_tables {
+  std::array<std::uint32_t, 256> codes{};
+  // Canonical decoding: per code length the first code, the number of codes
+  // and where their symbols start in `symbols`
+  std::array<std::uint32_t, 31> first{};
+  std::array<std::uint32_t, 31> count{};
+  std::array<std::uint32_t, 31> offset{};
+  std::array<std::uint8_t, 256> symbols{};
+
+  huffman_tables() {
+    std::size_t next = 0;
+    for (std::uint32_t length = 1; length <= 30; ++length) {
+      offset[length] = static_cast<std::uint32_t>(next);
+      for (std::size_t symbol = 0; symbol < 256; ++symbol) {
+        if (huffman_code_lengths[symbol] == length) {
+          symbols[next++] = static_cast<std::uint8_t>(symbol);
+        }
+      }
+      count[length] = static_cast<std::uint32_t>(next) - offset[length];
+    }
+    std::uint32_t code = 0;
+    for (std::uint32_t length = 1; length <= 30; ++length) {
+      first[length] = code;
+      for (std::uint32_t i = 0; i < count[length]; ++i) {
+        codes[symbols[offset[length] + i]] = code++;
+      }
+      code <<= 1;
+    }
+  }
+};
+
+inline const huffman_tables &huffman() {
+  static const huffman_tables tables;
+  return tables;
+}
+} // namespace detail
+
+inline std::size_t huffman_encoded_size(std::string_view text) {
+  std::size_t bits = 0;
+  for (const auto c : text) {
+    bits += huffman_code_lengths[static_cast<std::uint8_t>(c)];
+  }
+  return (bits + 7) / 8;
+}
+
+inline void huffman_encode(std::string_view text, std::string &out) {
+  const auto &tables = detail::huffman();
+  std::uint64_t bits = 0;
+  unsigned pending = 0;
+  for (const auto c : text) {
+    const auto symbol = static_cast<std::uint8_t>(c);
+    bits = (bits << huffman_code_lengths[symbol]) | tables.codes[symbol];
+    pending += huffman_code_lengths[symbol];
+    while (pending >= 8) {
+      pending -= 8;
+      out.push_back(static_cast<char>(bits >> pending));
+    }
+  }
+  if (pending > 0) {
+    // Padded with the most significant bits of EOS, all ones
+    out.push_back(
+        static_cast<char>((bits << (8 - pending)) | (0xffU >> pending)));
+  }
+}
+
+// Empty on a malformed string: EOS inside the data or padding longer than
+// seven bits or not all ones
+inline std::optional<std::string> huffman_decode(std::string_view data) {
+  const auto &tables = detail::huffman();
+  std::string out;
+  out.reserve(data.size() * 8 / 5);
+  std::uint32_t code = 0;
+  std::uint32_t length = 0;
+  for (const auto byte : data) {
+    for (int bit = 7; bit >= 0; --bit) {
+      code = (code << 1) | ((static_cast<std::uint8_t>(byte) >> bit) & 1U);
+      ++length;
+      if (length > 30) {
+        return std::nullopt;
+      }
+      const auto index = code - tables.first[length];
+      if (code >= tables.first[length] && index < tables.count[length]) {
+        out.push_back(
+            static_cast<char>(tables.symbols[tables.offset[length] + index]));
+        code = 0;
+        length = 0;
+      }
+    }
+  }
+  if (length > 7 || code != (1U << length) - 1) {
+    return std::nullopt;
+  }
+  return out;
+}
+
+// Section 5.1, `prefix` bits of the first byte are available
+inline void encode_integer(std::uint64_t value, unsigned prefix,
+                           std::uint8_t flags, std::string &out) {
+  const std::uint64_t limit = (1U << prefix) - 1;
+  if (value < limit) {
+    out.push_back(static_cast<char>(flags | value));
+    return;
+  }
+  out.push_back(static_cast<char>(flags | limit));
+  value -= limit;
+  while (value >= 128) {
+    out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+inline std::optional<std::uint64_t>
+decode_integer(std::string_view data, std::size_t &pos, unsigned prefix) {
+  if (pos >= data.size()) {
+    return std::nullopt;
+  }
+  const std::uint64_t limit = (1U << prefix) - 1;
+  std::uint64_t value = static_cast<std::uint8_t>(data[pos++]) & limit;
+  if (value < limit) {
+    return value;
+  }
+  for (unsigned shift = 0; shift < 63; shift += 7) {
+    if (pos >= data.size()) {
+      return std::nullopt;
+    }
+    const auto byte = static_cast<std::uint8_t>(data[pos++]);
+    value += static_cast<std::uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return value;
+    }
+  }
+  return std::nullopt;
+}
+
+// Section 5.2, Huffman coded when that is shorter
+inline void encode_string(std::string_view text, std::string &out) {
+  const auto huffman_size = huffman_encoded_size(text);
+  if (huffman_size < text.size()) {
+    encode_integer(huffman_size, 7, 0x80, out);
+    huffman_encode(text, out);
+  } else {
+    encode_integer(text.size(), 7, 0, out);
+    out.append(text);
+  }
+}
+
+inline std::optional<std::string> decode_string(std::string_view data,
+                                                std::size_t &pos) {
+  if (pos >= data.size()) {
+    return std::nullopt;
+  }
+  const bool huffman = (static_cast<std::uint8_t>(data[pos]) & 0x80) != 0;
+  const auto length = decode_integer(data, pos, 7);
+  if (!length.has_value() || *length > data.size() - pos) {
+    return std::nullopt;
+  }
+  const auto text = data.substr(pos, *length);
+  pos += *length;
+  if (huffman) {
+    return huffman_decode(text);
+  }
+  return std::string(text);
+}
+
+/**
+ * Stateless header block encoder.
+ *
+ * Fields are sent as static table references or as literals that are never
+ * added to the dynamic table, so the peer's table size setting never
+ * matters and a connection needs no shared encoder state.
+ */
+class encoder {
+public:
+  // `sensitive` fields like authorization are marked never-indexed
+  static void encode(std::string_view name, std::string_view value,
+                     std::string &out, bool sensitive = false) {
+    std::size_t name_index = 0;
+    for (std::size_t i = 0; i < static_table.size(); ++i) {
+      if (static_table[i].name != name) {
+        continue;
+      }
+      if (static_table[i].value == value && !sensitive) {
+        encode_integer(i + 1, 7, 0x80, out);
+        return;
+      }
+      if (name_index == 0) {
+        name_index = i + 1;
+      }
+    }
+    const std::uint8_t flags = sensitive ? 0x10 : 0x00;
+    if (name_index != 0) {
+      encode_integer(name_index, 4, flags, out);
+    } else {
+      out.push_back(static_cast<char>(flags));
+      encode_string(name, out);
+    }
+    encode_string(value, out);
+  }
+};
+
+// Header block decoder with the dynamic table of one connection
+class decoder {
+  std::deque<header_field> dynamic_;
+  std::size_t size_{0};
+  std::size_t max_size_;
+  std::size_t limit_;
+
+  // Section 4.1
+  static std::size_t entry_size(const header_field &field) {
+    return field.name.size() + field.value.size() + 32;
+  }
+
+  void evict() {
+    while (size_ > max_size_ && !dynamic_.empty()) {
+      size_ -= entry_size(dynamic_.back());
+      dynamic_.pop_back();
+    }
+  }
+
+  void insert(header_field field) {
+    size_ += entry_size(field);
+    dynamic_.push_front(std::move(field));
+    evict();
+  }
+
+  std::optional<header_field> lookup(std::uint64_t index) const {
+    if (index == 0) {
+      return std::nullopt;
+    }
+    if (index <= static_table.size()) {
+      const auto &entry = static_table[index - 1];
+      return header_field{std::string(entry.name), std::string(entry.value)};
+    }
+    index -= static_table.size() + 1;
+    if (index >= dynamic_.size()) {
+      return std::nullopt;
+    }
+    return dynamic_[index];
+  }
+
+public:
+  // `limit` is the SETTINGS_HEADER_TABLE_SIZE we announced
+  explicit decoder(std::size_t limit = 4096)
+      : max_size_(limit), limit_(limit) {}
+
+  // Decodes a complete header block, empty on a compression error
+  std::optional<std::vector<header_field>> decode(std::string_view block) {
+    std::vector<header_field> fields;
+    std::size_t pos = 0;
+    while (pos < block.size()) {
+      const auto first = static_cast<std::uint8_t>(block[pos]);
+      if ((first & 0x80) != 0) {
+        // Indexed field
+        const auto index = decode_integer(block, pos, 7);
+        auto field = index ? lookup(*index) : std::nullopt;
+        if (!field) {
+          return std::nullopt;
+        }
+        fields.push_back(std::move(*field));
+        continue;
+      }
+      if ((first & 0xe0) == 0x20) {
+        // Dynamic table size update
+        const auto size = decode_integer(block, pos, 5);
+        if (!size || *size > limit_) {
+          return std::nullopt;
+        }
+        max_size_ = *size;
+        evict();
+        continue;
+      }
+      // Literal with incremental indexing (01), without indexing (0000) or
+      // never indexed (0001)
+      const bool indexing = (first & 0xc0) == 0x40;
+      const auto name_index = decode_integer(block, pos, indexing ? 6 : 4);
+      if (!name_index) {
+        return std::nullopt;
+      }
+      header_field field;
+      if (*name_index == 0) {
+        auto name = decode_string(block, pos);
+        if (!name) {
+          return std::nullopt;
+        }
+        field.name = std::move(*name);
+      } else {
+        auto named = lookup(*name_index);
+        if (!named) {
+          return std::nullopt;
+        }
+        field.name = std::move(named->name);
+      }
+      auto value = decode_string(block, pos);
+      if (!value) {
+        return std::nullopt;
+      }
+      field.value = std::move(*value);
+      if (indexing) {
+        insert(field);
+      }
+      fields.push_back(std::move(field));
+    }
+    return fields;
+  }
+};
+} // namespace cpp_http::client::hpack
@@ -0,0 +1,814 @@
+#pragma once
+#include "client/connection_pool.hpp"
+#include "client/hpack.hpp"
+#include "client/http2_stream.hpp"
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/experimental/channel.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/beast/http/message.hpp>
+#include <boost/outcome/result.hpp>
+#include <boost/system/detail/error_code.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// HTTP/2 framing, RFC 9113
+namespace cpp_http::client {
+namespace http2 {
+enum class frame_type : std::uint8_t {
+  data = 0x0,
+  headers = 0x1,
+  priority = 0x2,
+  rst_stream = 0x3,
+  settings = 0x4,
+  push_promise = 0x5,
+  ping = 0x6,
+  goaway = 0x7,
+  window_update = 0x8,
+  continuation = 0x9,
+};
+
+namespace flags {
+inline constexpr std::uint8_t end_stream = 0x1;
+inline constexpr std::uint8_t ack = 0x1;
+inline constexpr std::uint8_t end_headers = 0x4;
+inline constexpr std::uint8_t padded = 0x8;
+inline constexpr std::uint8_t priority = 0x20;
+} // namespace flags
+
+enum class setting : std::uint16_t {
+  header_table_size = 0x1,
+  enable_push = 0x2,
+  max_concurrent_streams = 0x3,
+  initial_window_size = 0x4,
+  max_frame_size = 0x5,
+  max_header_list_size = 0x6,
+};
+
+enum class error_code : std::uint32_t {
+  no_error = 0x0,
+  protocol_error = 0x1,
+  flow_control_error = 0x3,
+  frame_size_error = 0x6,
+  cancel = 0x8,
+  compression_error = 0x9,
+};
+
+inline constexpr std::string_view preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+inline constexpr std::size_t frame_header_size = 9;
+inline constexpr std::uint32_t default_window = 65535;
+inline constexpr std::uint32_t max_window = 0x7fffffff;
+
+inline void put_u16(std::string &out, std::uint16_t value) {
+  out.push_back(static_cast<char>(value >> 8));
+  out.push_back(static_cast<char>(value));
+}
+
+inline void put_u32(std::string &out, std::uint32_t value) {
+  put_u16(out, static_cast<std::uint16_t>(value >> 16));
+  put_u16(out, static_cast<std::uint16_t>(value));
+}
+
+inline std::uint32_t get_u32(const char *data) {
+  const auto *bytes = reinterpret_cast<const unsigned char *>(data);
+  return (std::uint32_t{bytes[0]} << 24) | (std::uint32_t{bytes[1]} << 16) |
+         (std::uint32_t{bytes[2]} << 8) | std::uint32_t{bytes[3]};
+}
+
+inline void append_frame(std::string &out, frame_type type, std::uint8_t flag,
+                         std::uint32_t stream, std::string_view payload) {
+  const auto length = static_cast<std::uint32_t>(payload.size());
+  out.push_back(static_cast<char>(length >> 16));
+  put_u16(out, static_cast<std::uint16_t>(length));
+  out.push_back(static_cast<char>(type));
+  out.push_back(static_cast<char>(flag));
+  put_u32(out, stream & max_window);
+  out.append(payload);
+}
+} // namespace http2
+
+struct http2_options {
+  // Receive window per stream, announced in SETTINGS
+  std::uint32_t stream_window{1U << 20};
+  // Receive window of the whole connection
+  std::uint32_t connection_window{16U << 20};
+  // Streams the session opens when the server does not limit them
+  std::uint32_t max_concurrent_streams{100};
+  // A session without streams is closed after this long
+  std::chrono::milliseconds idle_timeout{std::chrono::seconds{30}};
+};
+
+/**
+ * Client side of one HTTP/2 connection.
+ *
+ * Concurrent submit() calls become streams on the shared connection, their
+ * responses are read through http2_stream. A reader coroutine dispatches
+ * incoming frames, a writer coroutine flushes queued frames in batches.
+ * Request bodies respect the peer's connection and stream windows, the
+ * receive windows reopen as the application consumes response bodies.
+ *
+ * Everything touching session state runs on a strand of the io_context the
+ * session was started on, including its streams, so requests on any thread
+ * running that io_context may share the session.
+ */
+class http2_session : public http2_stream_owner,
+                      public std::enable_shared_from_this<http2_session> {
+  using wakeup_channel =
+      boost::asio::experimental::channel<void(boost::system::error_code)>;
+
+  struct stream_state {
+    std::shared_ptr<http2_stream> stream;
+    std::int64_t send_window{0};
+    bool final_headers{false};
+    bool remote_closed{false};
+    bool local_closed{false};
+  };
+
+  std::unique_ptr<connection> transport_;
+  // Every operation on the state below runs on this strand
+  boost::asio::any_io_executor strand_;
+  http2_options options_;
+  hpack::decoder decoder_;
+  std::unordered_map<std::uint32_t, stream_state> streams_;
+  std::uint32_t next_stream_id_{1};
+
+  std::uint32_t peer_max_streams_;
+  std::uint32_t peer_initial_window_{http2::default_window};
+  std::uint32_t peer_max_frame_size_{16384};
+  std::int64_t send_window_{http2::default_window};
+  std::uint64_t unacknowledged_{0};
+
+  std::string outgoing_;
+  wakeup_channel write_wakeup_;
+  // Streams waiting for a stream slot or send window
+  std::vector<std::shared_ptr<wakeup_channel>> waiters_;
+  boost::asio::steady_timer idle_timer_;
+
+  // HEADERS followed by CONTINUATION frames being collected
+  std::string header_block_;
+  std::uint32_t header_stream_{0};
+  bool header_end_stream_{false};
+
+  bool closed_{false};
+  // Read by is_open() off the strand
+  std::atomic<bool> going_away_{false};
+  std::uint32_t last_stream_id_{std::numeric_limits<std::uint32_t>::max()};
+
+  struct private_tag {};
+
+  void queue(http2::frame_type type, std::uint8_t flag, std::uint32_t stream,
+             std::string_view payload) {
+    if (closed_) {
+      return;
+    }
+    http2::append_frame(outgoing_, type, flag, stream, payload);
+    write_wakeup_.try_send(boost::system::error_code{});
+  }
+
+  void queue_rst_stream(std::uint32_t stream, http2::error_code code) {
+    std::string payload;
+    http2::put_u32(payload, static_cast<std::uint32_t>(code));
+    queue(http2::frame_type::rst_stream, 0, stream, payload);
+  }
+
+  void queue_window_update(std::uint32_t stream, std::uint32_t increment) {
+    std::string payload;
+    http2::put_u32(payload, increment);
+    queue(http2::frame_type::window_update, 0, stream, payload);
+  }
+
+  void wake_waiters() {
+    auto waiters = std::move(waiters_);
+    waiters_.clear();
+    for (const auto &waiter : waiters) {
+      waiter->try_send(boost::system::error_code{});
+    }
+  }
+
+  void wait(boost::asio::yield_context yield) {
+    auto wakeup = std::make_shared<wakeup_channel>(yield.get_executor(), 1);
+    waiters_.push_back(wakeup);
+    boost::system::error_code ec;
+    wakeup->async_receive(yield[ec]);
+  }
+
+  void erase_stream(std::uint32_t id) {
+    if (streams_.erase(id) == 0) {
+      return;
+    }
+    wake_waiters();
+    if (streams_.empty()) {
+      if (going_away_) {
+        close(boost::asio::error::connection_aborted);
+        return;
+      }
+      idle_timer_.expires_after(options_.idle_timeout);
+      idle_timer_.async_wait(
+          [weak = weak_from_this()](boost::system::error_code ec) {
+            auto self = weak.lock();
+            if (!ec && self && self->streams_.empty()) {
+              self->go_away();
+            }
+          });
+    }
+  }
+
+  void close_if_done(std::uint32_t id) {
+    const auto it = streams_.find(id);
+    if (it != streams_.end() && it->second.remote_closed &&
+        it->second.local_closed) {
+      erase_stream(id);
+    }
+  }
+
+  void close(boost::system::error_code ec) {
+    if (closed_) {
+      return;
+    }
+    closed_ = true;
+    going_away_ = true;
+    auto streams = std::move(streams_);
+    streams_.clear();
+    for (auto &[id, state] : streams) {
+      state.stream->fail(ec);
+    }
+    wake_waiters();
+    idle_timer_.cancel();
+    write_wakeup_.close();
+    transport_->shutdown();
+  }
+
+  // Sends GOAWAY and closes once the last stream is done
+  void go_away() {
+    std::string payload;
+    http2::put_u32(payload, 0);
+    http2::put_u32(payload, static_cast<std::uint32_t>(http2::error_code::no_error));
+    queue(http2::frame_type::goaway, 0, 0, payload);
+    going_away_ = true;
+    if (streams_.empty()) {
+      // Lets the writer flush the GOAWAY before the socket goes away
+      boost::asio::post(idle_timer_.get_executor(),
+                        [self = shared_from_this()] {
+                          self->close(boost::asio::error::connection_aborted);
+                        });
+    }
+  }
+
+  void protocol_error(http2::error_code code) {
+    std::string payload;
+    http2::put_u32(payload, next_stream_id_ > 1 ? next_stream_id_ - 2 : 0);
+    http2::put_u32(payload, static_cast<std::uint32_t>(code));
+    queue(http2::frame_type::goaway, 0, 0, payload);
+    close(boost::asio::error::fault);
+  }
+
+  void write_loop(boost::asio::yield_context yield) {
+    std::string writing;
+    boost::system::error_code ec;
+    while (true) {
+      if (outgoing_.empty()) {
+        write_wakeup_.async_receive(yield[ec]);
+        if (ec && outgoing_.empty()) {
+          return;
+        }
+        continue;
+      }
+      writing.clear();
+      writing.swap(outgoing_);
+      transport_->with_stream([&](auto &stream) {
+        boost::asio::async_write(stream, boost::asio::buffer(writing),
+                                 yield[ec]);
+      });
+      if (ec) {
+        close(ec);
+        return;
+      }
+    }
+  }
+
+  void read_loop(boost::asio::yield_context yield) {
+    char header[http2::frame_header_size];
+    std::string payload;
+    boost::system::error_code ec;
+    while (!closed_) {
+      transport_->with_stream([&](auto &stream) {
+        boost::asio::async_read(stream, boost::asio::buffer(header), yield[ec]);
+      });
+      if (ec) {
+        break;
+      }
+      const auto length = (static_cast<std::uint32_t>(
+                               static_cast<unsigned char>(header[0]))
+                           << 16) |
+                          (static_cast<std::uint32_t>(
+                               static_cast<unsigned char>(header[1]))
+                           << 8) |
+                          static_cast<unsigned char>(header[2]);
+      // We never raise SETTINGS_MAX_FRAME_SIZE above its default
+      if (length > 16384) {
+        protocol_error(http2::error_code::frame_size_error);
+        return;
+      }
+      payload.resize(length);
+      transport_->with_stream([&](auto &stream) {
+        boost::asio::async_read(stream, boost::asio::buffer(payload),
+                                yield[ec]);
+      });
+      if (ec) {
+        break;
+      }
+      const auto type = static_cast<http2::frame_type>(header[3]);
+      const auto flag = static_cast<std::uint8_t>(header[4]);
+      const auto stream = http2::get_u32(header + 5) & http2::max_window;
+      if (!handle_frame(type, flag, stream, payload)) {
+        return;
+      }
+    }
+    close(ec ? ec : boost::asio::error::eof);
+  }
+
+  // Strips padding, false when the padding does not fit
+  static bool unpad(std::uint8_t flag, std::string_view &payload,
+                    std::size_t &padding) {
+    padding = 0;
+    if ((flag & http2::flags::padded) == 0) {
+      return true;
+    }
+    if (payload.empty()) {
+      return false;
+    }
+    padding = static_cast<unsigned char>(payload[0]);
+    payload.remove_prefix(1);
+    if (padding > payload.size()) {
+      return false;
+    }
+    payload.remove_suffix(padding);
+    ++padding;
+    return true;
+  }
+
+  bool handle_frame(http2::frame_type type, std::uint8_t flag,
+                    std::uint32_t stream, std::string_view payload) {
+    if (header_stream_ != 0 && type != http2::frame_type::continuation) {
+      protocol_error(http2::error_code::protocol_error);
+      return false;
+    }
+    switch (type) {
+    case http2::frame_type::data:
+      return on_data(flag, stream, payload);
+    case http2::frame_type::headers: {
+      std::size_t padding = 0;
+      if (stream == 0 || !unpad(flag, payload, padding)) {
+        protocol_error(http2::error_code::protocol_error);
+        return false;
+      }
+      if ((flag & http2::flags::priority) != 0) {
+        if (payload.size() < 5) {
+          protocol_error(http2::error_code::protocol_error);
+          return false;
+        }
+        payload.remove_prefix(5);
+      }
+      header_block_.assign(payload);
+      header_stream_ = stream;
+      header_end_stream_ = (flag & http2::flags::end_stream) != 0;
+      if ((flag & http2::flags::end_headers) != 0) {
+        return on_header_block();
+      }
+      return true;
+    }
+    case http2::frame_type::continuation:
+      if (stream != header_stream_ || header_stream_ == 0) {
+        protocol_error(http2::error_code::protocol_error);
+        return false;
+      }
+      header_block_.append(payload);
+      if ((flag & http2::flags::end_headers) != 0) {
+        return on_header_block();
+      }
+      return true;
+    case http2::frame_type::rst_stream:
+      if (const auto it = streams_.find(stream); it != streams_.end()) {
+        it->second.stream->fail(boost::asio::error::connection_reset);
+        erase_stream(stream);
+      }
+      return true;
+    case http2::frame_type::settings:
+      return on_settings(flag, payload);
+    case http2::frame_type::ping:
+      if ((flag & http2::flags::ack) == 0) {
+        queue(http2::frame_type::ping, http2::flags::ack, 0, payload);
+      }
+      return true;
+    case http2::frame_type::goaway:
+      return on_goaway(payload);
+    case http2::frame_type::window_update:
+      return on_window_update(stream, payload);
+    case http2::frame_type::push_promise:
+      // SETTINGS_ENABLE_PUSH is 0
+      protocol_error(http2::error_code::protocol_error);
+      return false;
+    default:
+      // PRIORITY and unknown frames are ignored
+      return true;
+    }
+  }
+
+  bool on_data(std::uint8_t flag, std::uint32_t stream,
+               std::string_view payload) {
+    const auto length = payload.size();
+    std::size_t padding = 0;
+    if (stream == 0 || !unpad(flag, payload, padding)) {
+      protocol_error(http2::error_code::protocol_error);
+      return false;
+    }
+    // The connection window is replenished right away, stream windows
+    // limit how much an unread response may buffer
+    unacknowledged_ += length;
+    if (unacknowledged_ >= options_.connection_window / 2) {
+      queue_window_update(0, static_cast<std::uint32_t>(unacknowledged_));
+      unacknowledged_ = 0;
+    }
+    const auto it = streams_.find(stream);
+    if (it == streams_.end()) {
+      return true;
+    }
+    const bool end_stream = (flag & http2::flags::end_stream) != 0;
+    if (padding > 0 && !end_stream) {
+      queue_window_update(stream, static_cast<std::uint32_t>(padding));
+    }
+    it->second.stream->on_data(payload, end_stream);
+    if (end_stream) {
+      it->second.remote_closed = true;
+      close_if_done(stream);
+    }
+    return true;
+  }
+
+  bool on_header_block() {
+    const auto stream = header_stream_;
+    header_stream_ = 0;
+    auto fields = decoder_.decode(header_block_);
+    header_block_.clear();
+    if (!fields) {
+      protocol_error(http2::error_code::compression_error);
+      return false;
+    }
+    const auto it = streams_.find(stream);
+    if (it == streams_.end()) {
+      return true;
+    }
+    auto &state = it->second;
+    if (state.final_headers) {
+      // Trailers
+      state.stream->end();
+    } else {
+      for (const auto &field : *fields) {
+        if (field.name == ":status") {
+          state.final_headers = field.value.empty() || field.value[0] != '1';
+        }
+      }
+      state.stream->on_headers(std::move(*fields), header_end_stream_);
+    }
+    if (header_end_stream_) {
+      state.stream->end();
+      state.remote_closed = true;
+      close_if_done(stream);
+    }
+    return true;
+  }
+
+  bool on_settings(std::uint8_t flag, std::string_view payload) {
+    if ((flag & http2::flags::ack) != 0) {
+      return true;
+    }
+    if (payload.size() % 6 != 0) {
+      protocol_error(http2::error_code::frame_size_error);
+      return false;
+    }
+    for (std::size_t pos = 0; pos < payload.size(); pos += 6) {
+      const auto id = static_cast<http2::setting>(
+          (static_cast<unsigned char>(payload[pos]) << 8) |
+          static_cast<unsigned char>(payload[pos + 1]));
+      const auto value = http2::get_u32(payload.data() + pos + 2);
+      switch (id) {
+      case http2::setting::max_concurrent_streams:
+        peer_max_streams_ = value;
+        break;
+      case http2::setting::initial_window_size: {
+        if (value > http2::max_window) {
+          protocol_error(http2::error_code::flow_control_error);
+          return false;
+        }
+        const auto delta = static_cast<std::int64_t>(value) -
+                           static_cast<std::int64_t>(peer_initial_window_);
+        for (auto &[id, state] : streams_) {
+          state.send_window += delta;
+        }
+        peer_initial_window_ = value;
+        break;
+      }
+      case http2::setting::max_frame_size:
+        if (value < 16384 || value > 16777215) {
+          protocol_error(http2::error_code::protocol_error);
+          return false;
+        }
+        peer_max_frame_size_ = value;
+        break;
+      default:
+        // The encoder never uses the dynamic table, the table size does
+        // not matter
+        break;
+      }
+    }
+    queue(http2::frame_type::settings, http2::flags::ack, 0, {});
+    wake_waiters();
+    return true;
+  }
+
+  bool on_goaway(std::string_view payload) {
+    if (payload.size() < 8) {
+      protocol_error(http2::error_code::frame_size_error);
+      return false;
+    }
+    going_away_ = true;
+    last_stream_id_ = http2::get_u32(payload.data()) & http2::max_window;
+    std::vector<std::uint32_t> refused;
+    for (const auto &[id, state] : streams_) {
+      if (id > last_stream_id_) {
+        refused.push_back(id);
+      }
+    }
+    for (const auto id : refused) {
+      // Never processed by the server, safe to send again
+      streams_[id].stream->fail(boost::asio::error::connection_aborted);
+      streams_.erase(id);
+    }
+    if (streams_.empty()) {
+      close(boost::asio::error::connection_aborted);
+      return false;
+    }
+    wake_waiters();
+    return true;
+  }
+
+  bool on_window_update(std::uint32_t stream, std::string_view payload) {
+    if (payload.size() != 4) {
+      protocol_error(http2::error_code::frame_size_error);
+      return false;
+    }
+    const auto increment = http2::get_u32(payload.data()) & http2::max_window;
+    if (stream == 0) {
+      send_window_ += increment;
+    } else if (const auto it = streams_.find(stream); it != streams_.end()) {
+      it->second.send_window += increment;
+    }
+    wake_waiters();
+    return true;
+  }
+
+  template <class Body>
+  static boost::outcome_v2::result<std::string>
+  serialize_body(const boost::beast::http::request<Body> &request) {
+    boost::system::error_code ec;
+    std::string body;
+    typename Body::writer writer{request.base(), request.body()};
+    writer.init(ec);
+    if (ec) {
+      return ec;
+    }
+    while (true) {
+      auto buffers = writer.get(ec);
+      if (ec) {
+        return ec;
+      }
+      if (!buffers) {
+        break;
+      }
+      for (auto it = boost::asio::buffer_sequence_begin(buffers->first);
+           it != boost::asio::buffer_sequence_end(buffers->first); ++it) {
+        const boost::asio::const_buffer buffer = *it;
+        body.append(static_cast<const char *>(buffer.data()), buffer.size());
+      }
+      if (!buffers->second) {
+        break;
+      }
+    }
+    return body;
+  }
+
+  // Connection-specific fields have no meaning in HTTP/2, section 8.2.2
+  static bool is_connection_specific(std::string_view name) {
+    return name == "connection" || name == "keep-alive" ||
+           name == "proxy-connection" || name == "transfer-encoding" ||
+           name == "upgrade" || name == "host";
+  }
+
+  void start() {
+    std::string settings;
+    http2::put_u16(settings,
+                   static_cast<std::uint16_t>(http2::setting::enable_push));
+    http2::put_u32(settings, 0);
+    http2::put_u16(settings, static_cast<std::uint16_t>(
+                                 http2::setting::initial_window_size));
+    http2::put_u32(settings, options_.stream_window);
+    outgoing_.append(http2::preface);
+    queue(http2::frame_type::settings, 0, 0, settings);
+    if (options_.connection_window > http2::default_window) {
+      queue_window_update(0,
+                          options_.connection_window - http2::default_window);
+    }
+    boost::asio::spawn(
+        write_wakeup_.get_executor(),
+        [self = shared_from_this()](boost::asio::yield_context yield) {
+          self->write_loop(yield);
+        },
+        boost::asio::detached);
+    boost::asio::spawn(
+        write_wakeup_.get_executor(),
+        [self = shared_from_this()](boost::asio::yield_context yield) {
+          self->read_loop(yield);
+        },
+        boost::asio::detached);
+  }
+
+public:
+  http2_session(private_tag, std::unique_ptr<connection> transport,
+                http2_options options)
+      : transport_(std::move(transport)),
+        strand_(boost::asio::make_strand(
+            transport_->lowest_layer().get_executor())),
+        options_(options), peer_max_streams_(options.max_concurrent_streams),
+        write_wakeup_(strand_, 1), idle_timer_(strand_) {}
+
+  // Starts HTTP/2 on a connected transport, after ALPN selected h2 or with
+  // prior knowledge on plain TCP
+  static std::shared_ptr<http2_session> start(std::unique_ptr<connection> transport,
+                                              http2_options options = {}) {
+    auto session = std::make_shared<http2_session>(
+        private_tag{}, std::move(transport), options);
+    session->start();
+    return session;
+  }
+
+  // False once the session no longer takes new streams
+  [[nodiscard]] bool is_open() const { return !going_away_; }
+
+  // Only meaningful on the session's strand
+  [[nodiscard]] std::size_t active_streams() const { return streams_.size(); }
+
+  // Opens a stream for `request` and sends it. `weight` is the RFC 7540
+  // priority weight from 1 to 256, 16 sends no priority information. The
+  // work runs in a coroutine on the session's strand, the caller is resumed
+  // on its own executor.
+  template <class Body>
+  boost::outcome_v2::result<std::shared_ptr<http2_stream>>
+  submit(const boost::beast::http::request<Body> &request,
+         std::string_view scheme, std::string_view authority,
+         boost::asio::yield_context yield, unsigned weight = 16) {
+    boost::outcome_v2::result<std::shared_ptr<http2_stream>> stream{
+        boost::asio::error::connection_aborted};
+    boost::asio::spawn(
+        strand_,
+        [&](boost::asio::yield_context on_strand) {
+          stream = open_stream(request, scheme, authority, on_strand, weight);
+        },
+        yield);
+    return stream;
+  }
+
+  // Called by streams on the session's strand
+
+  void consumed(std::uint32_t id, std::size_t bytes) override {
+    const auto it = streams_.find(id);
+    if (it != streams_.end() && !it->second.remote_closed) {
+      queue_window_update(id, static_cast<std::uint32_t>(bytes));
+    }
+  }
+
+  void cancel(std::uint32_t id) override {
+    if (streams_.find(id) == streams_.end()) {
+      return;
+    }
+    queue_rst_stream(id, http2::error_code::cancel);
+    erase_stream(id);
+  }
+
+private:
+  template <class Body>
+  boost::outcome_v2::result<std::shared_ptr<http2_stream>>
+  open_stream(const boost::beast::http::request<Body> &request,
+              std::string_view scheme, std::string_view authority,
+              boost::asio::yield_context yield, unsigned weight) {
+    while (!going_away_ && streams_.size() >= peer_max_streams_) {
+      wait(yield);
+    }
+    if (going_away_ || next_stream_id_ > http2::max_window) {
+      return boost::asio::error::connection_aborted;
+    }
+    auto body = serialize_body(request);
+    if (body.has_error()) {
+      return body.error();
+    }
+    idle_timer_.cancel();
+
+    std::string block;
+    hpack::encoder::encode(":method", request.method_string(), block);
+    hpack::encoder::encode(":scheme", scheme, block);
+    hpack::encoder::encode(":authority", authority, block);
+    hpack::encoder::encode(":path", request.target(), block);
+    std::string name;
+    for (const auto &field : request) {
+      name.assign(field.name_string());
+      std::transform(name.begin(), name.end(), name.begin(), [](char c) {
+        return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+      });
+      if (is_connection_specific(name) ||
+          (name == "te" && field.value() != "trailers")) {
+        continue;
+      }
+      hpack::encoder::encode(name, field.value(), block,
+                             name == "authorization" || name == "cookie");
+    }
+
+    const auto id = next_stream_id_;
+    next_stream_id_ += 2;
+    auto stream = std::make_shared<http2_stream>(
+        strand_, id,
+        std::static_pointer_cast<http2_stream_owner>(shared_from_this()));
+    auto &state = streams_[id];
+    state.stream = stream;
+    state.send_window = peer_initial_window_;
+    state.local_closed = body.value().empty();
+
+    // HEADERS and its CONTINUATION frames are queued in one piece, nothing
+    // may come between them
+    std::string first;
+    std::uint8_t flag = body.value().empty() ? http2::flags::end_stream : 0;
+    if (weight != 16 && weight >= 1 && weight <= 256) {
+      flag |= http2::flags::priority;
+      http2::put_u32(first, 0);
+      first.push_back(static_cast<char>(weight - 1));
+    }
+    const auto max_frame = static_cast<std::size_t>(peer_max_frame_size_);
+    std::string_view remaining{block};
+    const auto head = std::min(remaining.size(), max_frame - first.size());
+    first.append(remaining.substr(0, head));
+    remaining.remove_prefix(head);
+    if (remaining.empty()) {
+      flag |= http2::flags::end_headers;
+    }
+    queue(http2::frame_type::headers, flag, id, first);
+    while (!remaining.empty()) {
+      const auto part = std::min(remaining.size(), max_frame);
+      queue(http2::frame_type::continuation,
+            part == remaining.size() ? http2::flags::end_headers : 0, id,
+            remaining.substr(0, part));
+      remaining.remove_prefix(part);
+    }
+
+    std::string_view data{body.value()};
+    while (!data.empty()) {
+      const auto it = streams_.find(id);
+      if (it == streams_.end() || closed_) {
+        return boost::asio::error::connection_aborted;
+      }
+      const auto window = std::min(send_window_, it->second.send_window);
+      if (window <= 0) {
+        wait(yield);
+        continue;
+      }
+      const auto part = std::min<std::size_t>(
+          {data.size(), max_frame, static_cast<std::size_t>(window)});
+      send_window_ -= static_cast<std::int64_t>(part);
+      it->second.send_window -= static_cast<std::int64_t>(part);
+      queue(http2::frame_type::data,
+            part == data.size() ? http2::flags::end_stream : 0, id,
+            data.substr(0, part));
+      data.remove_prefix(part);
+    }
+    if (const auto it = streams_.find(id); it != streams_.end()) {
+      it->second.local_closed = true;
+      close_if_done(id);
+    }
+    return stream;
+  }
+};
+} // namespace cpp_http::client
@@ -0,0 +1,287 @@
+#pragma once
+#include "client/hpack.hpp"
+#include <boost/asio/any_completion_handler.hpp>
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/append.hpp>
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/dispatch.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/beast/http/status.hpp>
+#include <boost/system/detail/error_code.hpp>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace cpp_http::client {
+// The session side of an http2_stream, called on the stream's executor
+class http2_stream_owner {
+public:
+  virtual ~http2_stream_owner() = default;
+  // The application read `bytes` of DATA payload, the window may reopen
+  virtual void consumed(std::uint32_t id, std::size_t bytes) = 0;
+  // The application gave up on the stream, send RST_STREAM
+  virtual void cancel(std::uint32_t id) = 0;
+};
+
+/**
+ * One HTTP/2 response as an AsyncReadStream of HTTP/1.1 bytes.
+ *
+ * The session turns HEADERS into a status line and header fields and DATA
+ * frames into the body, chunk encoded unless the server sent a
+ * content-length. Everything that reads an HTTP/1.1 response with
+ * Beast's parser, including chunked and SSE reading, works unchanged on
+ * top of it.
+ *
+ * The executor is the session's strand. The session side runs on it, the
+ * application side hops onto it, so the stream may be read from any thread.
+ */
+class http2_stream : public std::enable_shared_from_this<http2_stream> {
+public:
+  using executor_type = boost::asio::any_io_executor;
+
+  http2_stream(executor_type executor, std::uint32_t id,
+               std::weak_ptr<http2_stream_owner> owner)
+      : executor_(std::move(executor)), id_(id), owner_(std::move(owner)),
+        timer_(executor_) {}
+  http2_stream(const http2_stream &) = delete;
+  http2_stream &operator=(const http2_stream &) = delete;
+
+  executor_type get_executor() const { return executor_; }
+  [[nodiscard]] std::uint32_t id() const { return id_; }
+  [[nodiscard]] bool finished() const { return ended_ || error_; }
+
+  template <class MutableBufferSequence, class ReadToken>
+  auto async_read_some(const MutableBufferSequence &buffers,
+                       ReadToken &&token) {
+    return boost::asio::async_initiate<ReadToken,
+                                       void(boost::system::error_code,
+                                            std::size_t)>(
+        [self = shared_from_this()](auto handler,
+                                    const MutableBufferSequence &buffers) {
+          std::vector<boost::asio::mutable_buffer> copy(
+              boost::asio::buffer_sequence_begin(buffers),
+              boost::asio::buffer_sequence_end(buffers));
+          boost::asio::dispatch(
+              self->executor_,
+              [self, handler = std::move(handler),
+               copy = std::move(copy)]() mutable {
+                self->buffers_ = std::move(copy);
+                self->handler_.emplace(std::move(handler));
+                self->complete_read();
+              });
+        },
+        token, buffers);
+  }
+
+  // Requests are sent as frames by the session, not through the stream
+  template <class ConstBufferSequence, class WriteToken>
+  auto async_write_some(const ConstBufferSequence &, WriteToken &&token) {
+    return boost::asio::async_initiate<WriteToken,
+                                       void(boost::system::error_code,
+                                            std::size_t)>(
+        [executor = executor_](auto handler) {
+          boost::asio::post(
+              executor,
+              boost::asio::append(std::move(handler),
+                                  boost::system::error_code{
+                                      boost::asio::error::operation_not_supported},
+                                  std::size_t{0}));
+        },
+        token);
+  }
+
+  // Fails the stream with timed_out unless it ended before
+  void expires_after(std::chrono::steady_clock::duration duration) {
+    boost::asio::dispatch(executor_, [self = shared_from_this(), duration] {
+      self->timer_.expires_after(duration);
+      self->timer_.async_wait(
+          [weak = self->weak_from_this()](boost::system::error_code ec) {
+            auto self = weak.lock();
+            if (ec || !self || self->finished()) {
+              return;
+            }
+            if (auto owner = self->owner_.lock()) {
+              owner->cancel(self->id_);
+            }
+            self->fail(boost::asio::error::timed_out);
+          });
+    });
+  }
+
+  void expires_never() {
+    boost::asio::dispatch(executor_, [self = shared_from_this()] {
+      self->timer_.cancel();
+    });
+  }
+
+  // Resets the stream unless the response already ended
+  void cancel() {
+    boost::asio::dispatch(executor_, [self = shared_from_this()] {
+      if (self->finished()) {
+        return;
+      }
+      if (auto owner = self->owner_.lock()) {
+        owner->cancel(self->id_);
+      }
+      self->fail(boost::asio::error::operation_aborted);
+    });
+  }
+
+  // Session side, on the executor
+
+  void on_headers(std::vector<hpack::header_field> fields, bool end_stream) {
+    std::string head;
+    std::string status;
+    bool has_length = false;
+    for (const auto &field : fields) {
+      if (field.name == ":status") {
+        status = field.value;
+      } else if (field.name == "content-length") {
+        has_length = true;
+      }
+    }
+    unsigned code = 0;
+    if (status.size() != 3 ||
+        std::from_chars(status.data(), status.data() + status.size(), code)
+                .ec != std::errc{}) {
+      fail(boost::asio::error::invalid_argument);
+      return;
+    }
+    if (code < 200) {
+      // Interim responses are not passed on
+      return;
+    }
+    head.append("HTTP/1.1 ").append(status).append(" ");
+    head.append(boost::beast::http::obsolete_reason(
+        boost::beast::http::int_to_status(code)));
+    head.append("\r\n");
+    for (const auto &field : fields) {
+      if (field.name.empty() || field.name[0] == ':' ||
+          (end_stream && field.name == "content-length")) {
+        continue;
+      }
+      head.append(field.name).append(": ").append(field.value).append("\r\n");
+    }
+    if (end_stream) {
+      head.append("content-length: 0\r\n");
+    } else if (!has_length) {
+      chunked_ = true;
+      head.append("transfer-encoding: chunked\r\n");
+    }
+    head.append("\r\n");
+    append(head);
+    if (end_stream) {
+      ended_ = true;
+    }
+    complete_read();
+  }
+
+  void on_data(std::string_view data, bool end_stream) {
+    if (chunked_ && !data.empty()) {
+      static constexpr char digits[] = "0123456789abcdef";
+      std::string size;
+      for (auto n = data.size(); n > 0; n >>= 4) {
+        size.insert(size.begin(), digits[n & 0xf]);
+      }
+      append(size + "\r\n");
+      append(data);
+      append("\r\n");
+    } else {
+      append(data);
+    }
+    credit_ += data.size();
+    if (end_stream) {
+      end();
+    }
+    complete_read();
+  }
+
+  // END_STREAM without DATA, e.g. on trailers
+  void end() {
+    if (ended_) {
+      return;
+    }
+    if (chunked_) {
+      append("0\r\n\r\n");
+    }
+    ended_ = true;
+    complete_read();
+  }
+
+  void fail(boost::system::error_code ec) {
+    if (!error_ && !ended_) {
+      error_ = ec;
+    }
+    timer_.cancel();
+    complete_read();
+  }
+
+private:
+  void append(std::string_view bytes) {
+    if (offset_ == pending_.size()) {
+      pending_.clear();
+      offset_ = 0;
+    }
+    pending_.append(bytes);
+  }
+
+  // Completes a waiting read when there is something to report
+  void complete_read() {
+    if (!handler_) {
+      return;
+    }
+    boost::system::error_code ec;
+    std::size_t copied = 0;
+    if (offset_ < pending_.size()) {
+      copied = boost::asio::buffer_copy(
+          buffers_, boost::asio::buffer(pending_.data() + offset_,
+                                        pending_.size() - offset_));
+      offset_ += copied;
+      if (offset_ == pending_.size() && credit_ > 0) {
+        // The body was handed over completely, the window may reopen
+        if (auto owner = owner_.lock()) {
+          owner->consumed(id_, credit_);
+        }
+        credit_ = 0;
+      }
+    } else if (error_) {
+      ec = error_;
+    } else if (ended_) {
+      ec = boost::asio::error::eof;
+    } else {
+      return;
+    }
+    auto handler = std::move(*handler_);
+    handler_.reset();
+    boost::asio::post(executor_,
+                      boost::asio::append(std::move(handler), ec, copied));
+  }
+
+  executor_type executor_;
+  std::uint32_t id_;
+  std::weak_ptr<http2_stream_owner> owner_;
+  boost::asio::steady_timer timer_;
+  std::string pending_;
+  std::size_t offset_{0};
+  // DATA payload bytes not yet returned to the flow control window
+  std::size_t credit_{0};
+  bool chunked_{false};
+  bool ended_{false};
+  boost::system::error_code error_;
+  std::vector<boost::asio::mutable_buffer> buffers_;
+  std::optional<boost::asio::any_completion_handler<void(
+      boost::system::error_code, std::size_t)>>
+      handler_;
+};
+} // namespace cpp_http::client
@@ -0,0 +1,497 @@
+#pragma once
+#include "client/connection_pool.hpp"
+#include "client/memory_stream.hpp"
+#include "client/response.hpp"
+#include "hash.hpp"
+#include "http_date.hpp"
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/beast/http/field.hpp>
+#include <boost/beast/http/fields.hpp>
+#include <boost/beast/http/message.hpp>
+#include <boost/beast/http/status.hpp>
+#include <boost/outcome/result.hpp>
+#include <boost/url/url_view.hpp>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Private in-memory HTTP cache, RFC 9111
+namespace cpp_http::client {
+struct http_cache_options {
+  // Heads and bodies over all shards, least recently used entries go first
+  std::size_t max_bytes{64 * 1024 * 1024};
+  // Responses with larger or unknown content-length are not stored
+  std::size_t max_entry_bytes{1024 * 1024};
+  // Independently locked parts of the cache
+  std::size_t shards{16};
+};
+
+struct http_cache_stats {
+  std::uint64_t hits{0};
+  std::uint64_t misses{0};
+  // Stored responses confirmed by a 304
+  std::uint64_t revalidated{0};
+  // Stale responses served while a background revalidation ran
+  std::uint64_t stale_served{0};
+  std::uint64_t stores{0};
+  std::uint64_t evictions{0};
+};
+
+struct cache_control {
+  std::optional<std::chrono::seconds> max_age;
+  std::optional<std::chrono::seconds> stale_while_revalidate;
+  bool no_store{false};
+  bool no_cache{false};
+  bool must_revalidate{false};
+};
+
+inline cache_control parse_cache_control(std::string_view value) {
+  const auto lower_equals = [](std::string_view text, std::string_view name) {
+    const auto lower = [](char a, char b) {
+      return (a >= 'A' && a <= 'Z' ? a - 'A' + 'a' : a) == b;
+    };
+    return text.size() == name.size() &&
+           std::equal(text.begin(), text.end(), name.begin(), lower);
+  };
+  const auto trim = [](std::string_view text) {
+    while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) {
+      text.remove_prefix(1);
+    }
+    while (!text.empty() && (text.back() == ' ' || text.back() == '\t')) {
+      text.remove_suffix(1);
+    }
+    return text;
+  };
+  const auto seconds =
+      [](std::string_view text) -> std::optional<std::chrono::seconds> {
+    if (text.size() >= 2 && text.front() == '"' && text.back() == '"') {
+      text = text.substr(1, text.size() - 2);
+    }
+    std::int64_t count = 0;
+    const auto [end, ec] =
+        std::from_chars(text.data(), text.data() + text.size(), count);
+    if (ec != std::errc{} || end != text.data() + text.size() || count < 0) {
+      return std::nullopt;
+    }
+    return std::chrono::seconds{count};
+  };
+
+  cache_control directives;
+  std::size_t pos = 0;
+  while (pos <= value.size()) {
+    auto comma = value.find(',', pos);
+    if (comma == std::string_view::npos) {
+      comma = value.size();
+    }
+    const auto directive = trim(value.substr(pos, comma - pos));
+    pos = comma + 1;
+    const auto equals = directive.find('=');
+    const auto name = trim(directive.substr(0, equals));
+    const auto argument = equals == std::string_view::npos
+                              ? std::string_view{}
+                              : trim(directive.substr(equals + 1));
+    if (lower_equals(name, "max-age")) {
+      directives.max_age = seconds(argument);
+    } else if (lower_equals(name, "stale-while-revalidate")) {
+      directives.stale_while_revalidate = seconds(argument);
+    } else if (lower_equals(name, "no-store")) {
+      directives.no_store = true;
+    } else if (lower_equals(name, "no-cache")) {
+      directives.no_cache = true;
+    } else if (lower_equals(name, "must-revalidate") ||
+               lower_equals(name, "proxy-revalidate")) {
+      directives.must_revalidate = true;
+    }
+  }
+  return directives;
+}
+
+// Status codes that may be stored without explicit freshness, RFC 9110
+// section 15.1
+inline bool is_heuristically_cacheable(boost::beast::http::status status) {
+  switch (static_cast<unsigned>(status)) {
+  case 200:
+  case 203:
+  case 204:
+  case 300:
+  case 301:
+  case 308:
+  case 404:
+  case 405:
+  case 410:
+  case 414:
+  case 501:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/**
+ * One stored response with what is needed to compute its age, section 4.2.
+ *
+ * Entries are immutable once stored, a revalidation stores an updated copy
+ * that shares the body.
+ */
+struct cached_response {
+  using clock = std::chrono::system_clock;
+
+  boost::beast::http::response_header<> head;
+  std::shared_ptr<const std::string> body;
+  // Request header values selected by Vary when the response was stored
+  std::vector<std::pair<std::string, std::string>> vary;
+  clock::time_point response_time;
+  std::chrono::seconds corrected_initial_age{0};
+  std::chrono::seconds freshness_lifetime{0};
+  std::chrono::seconds stale_while_revalidate{0};
+  bool must_revalidate{false};
+
+  [[nodiscard]] std::chrono::seconds current_age(clock::time_point now) const {
+    return corrected_initial_age +
+           std::chrono::duration_cast<std::chrono::seconds>(
+               std::max(now - response_time, clock::duration::zero()));
+  }
+
+  [[nodiscard]] bool is_fresh(clock::time_point now) const {
+    return current_age(now) < freshness_lifetime;
+  }
+
+  // Stale but still allowed to be served while a revalidation runs
+  [[nodiscard]] bool may_serve_stale(clock::time_point now) const {
+    return !must_revalidate &&
+           current_age(now) < freshness_lifetime + stale_while_revalidate;
+  }
+
+  [[nodiscard]] bool has_validator() const {
+    return head.count(boost::beast::http::field::etag) > 0 ||
+           head.count(boost::beast::http::field::last_modified) > 0;
+  }
+
+  [[nodiscard]] std::size_t size() const {
+    std::size_t bytes = sizeof(cached_response) + body->size();
+    for (const auto &field : head) {
+      bytes += field.name_string().size() + field.value().size() + 4;
+    }
+    for (const auto &[name, value] : vary) {
+      bytes += name.size() + value.size();
+    }
+    return bytes;
+  }
+
+  // Sets the age and freshness of `head` received for a request sent at
+  // `request_time`
+  void update_age(clock::time_point request_time, clock::time_point now) {
+    using std::chrono::seconds;
+    response_time = now;
+    const auto date =
+        parse_http_date(head[boost::beast::http::field::date]).value_or(now);
+    const auto apparent_age = std::max(
+        std::chrono::duration_cast<seconds>(now - date), seconds{0});
+    seconds age_value{0};
+    const auto age = head[boost::beast::http::field::age];
+    std::int64_t count = 0;
+    if (std::from_chars(age.data(), age.data() + age.size(), count).ec ==
+            std::errc{} &&
+        count > 0) {
+      age_value = seconds{count};
+    }
+    const auto response_delay =
+        std::chrono::duration_cast<seconds>(now - request_time);
+    corrected_initial_age = std::max(
+        apparent_age, age_value + std::max(response_delay, seconds{0}));
+
+    const auto directives =
+        parse_cache_control(head[boost::beast::http::field::cache_control]);
+    must_revalidate = directives.no_cache || directives.must_revalidate;
+    stale_while_revalidate =
+        directives.stale_while_revalidate.value_or(seconds{0});
+    if (directives.no_cache) {
+      freshness_lifetime = seconds{0};
+    } else if (directives.max_age) {
+      freshness_lifetime = *directives.max_age;
+    } else if (const auto expires = head[boost::beast::http::field::expires];
+               !expires.empty()) {
+      // An invalid Expires means already expired
+      const auto at = parse_http_date(expires);
+      freshness_lifetime =
+          at ? std::max(std::chrono::duration_cast<seconds>(*at - date),
+                        seconds{0})
+             : seconds{0};
+    } else if (const auto last_modified = parse_http_date(
+                   head[boost::beast::http::field::last_modified]);
+               last_modified && is_heuristically_cacheable(head.result())) {
+      // Section 4.2.2, a tenth of the time since the last change
+      freshness_lifetime = std::min(
+          std::chrono::duration_cast<seconds>(date - *last_modified) / 10,
+          seconds{std::chrono::hours{24}});
+    } else {
+      freshness_lifetime = seconds{0};
+    }
+  }
+};
+
+class http_cache {
+  struct shard {
+    using entry_ptr = std::shared_ptr<const cached_response>;
+    using lru_list = std::list<std::pair<std::string, entry_ptr>>;
+    std::mutex mutex;
+    lru_list entries;
+    std::unordered_map<std::string, lru_list::iterator> index;
+    std::unordered_set<std::string> revalidating;
+    std::size_t bytes{0};
+  };
+
+  http_cache_options options_;
+  std::vector<shard> shards_;
+  std::size_t shard_bytes_;
+  std::atomic<std::uint64_t> hits_{0};
+  std::atomic<std::uint64_t> misses_{0};
+  std::atomic<std::uint64_t> revalidated_{0};
+  std::atomic<std::uint64_t> stale_served_{0};
+  std::atomic<std::uint64_t> stores_{0};
+  std::atomic<std::uint64_t> evictions_{0};
+
+  shard &shard_for(std::string_view key) {
+    return shards_[hash64(key) % shards_.size()];
+  }
+
+  static void erase(shard &part, shard::lru_list::iterator it) {
+    part.bytes -= it->second->size();
+    part.index.erase(it->first);
+    part.entries.erase(it);
+  }
+
+public:
+  explicit http_cache(http_cache_options options = {})
+      : options_(options), shards_(std::max<std::size_t>(options.shards, 1)),
+        shard_bytes_(options.max_bytes / shards_.size()) {}
+  http_cache(const http_cache &) = delete;
+  http_cache &operator=(const http_cache &) = delete;
+
+  [[nodiscard]] const http_cache_options &options() const { return options_; }
+
+  // Absolute URL without fragment, GET is the only method stored
+  static std::string key_for(boost::urls::url_view url) {
+    std::string key{url.scheme()};
+    key.append("://").append(url.encoded_host_and_port());
+    key.append(url.encoded_path().empty() ? "/" : url.encoded_path());
+    if (url.has_query()) {
+      key.append("?").append(url.encoded_query());
+    }
+    return key;
+  }
+
+  // The entry for `key` whose Vary fields match `request`
+  template <class Fields>
+  std::shared_ptr<const cached_response> lookup(const std::string &key,
+                                                const Fields &request) {
+    auto &part = shard_for(key);
+    std::lock_guard lock{part.mutex};
+    const auto found = part.index.find(key);
+    if (found == part.index.end()) {
+      misses_.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    const auto &entry = found->second->second;
+    for (const auto &[name, value] : entry->vary) {
+      if (request[name] != value) {
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+      }
+    }
+    part.entries.splice(part.entries.begin(), part.entries, found->second);
+    return entry;
+  }
+
+  void store(const std::string &key,
+             std::shared_ptr<const cached_response> entry) {
+    const auto bytes = entry->size();
+    auto &part = shard_for(key);
+    std::lock_guard lock{part.mutex};
+    if (const auto found = part.index.find(key); found != part.index.end()) {
+      erase(part, found->second);
+    }
+    if (bytes > shard_bytes_) {
+      return;
+    }
+    while (part.bytes + bytes > shard_bytes_ && !part.entries.empty()) {
+      erase(part, std::prev(part.entries.end()));
+      evictions_.fetch_add(1, std::memory_order_relaxed);
+    }
+    part.entries.emplace_front(key, std::move(entry));
+    part.index.emplace(key, part.entries.begin());
+    part.bytes += bytes;
+    stores_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Section 4.4, after an unsafe request or a response that cannot be
+  // stored
+  void invalidate(const std::string &key) {
+    auto &part = shard_for(key);
+    std::lock_guard lock{part.mutex};
+    if (const auto found = part.index.find(key); found != part.index.end()) {
+      erase(part, found->second);
+    }
+  }
+
+  void clear() {
+    for (auto &part : shards_) {
+      std::lock_guard lock{part.mutex};
+      part.entries.clear();
+      part.index.clear();
+      part.bytes = 0;
+    }
+  }
+
+  // One background revalidation per key at a time, false when one is
+  // already running
+  bool begin_revalidation(const std::string &key) {
+    auto &part = shard_for(key);
+    std::lock_guard lock{part.mutex};
+    return part.revalidating.insert(key).second;
+  }
+
+  void end_revalidation(const std::string &key) {
+    auto &part = shard_for(key);
+    std::lock_guard lock{part.mutex};
+    part.revalidating.erase(key);
+  }
+
+  void count_hit() { hits_.fetch_add(1, std::memory_order_relaxed); }
+  void count_revalidated() {
+    revalidated_.fetch_add(1, std::memory_order_relaxed);
+  }
+  void count_stale_served() {
+    stale_served_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  [[nodiscard]] http_cache_stats stats() const {
+    return {hits_.load(std::memory_order_relaxed),
+            misses_.load(std::memory_order_relaxed),
+            revalidated_.load(std::memory_order_relaxed),
+            stale_served_.load(std::memory_order_relaxed),
+            stores_.load(std::memory_order_relaxed),
+            evictions_.load(std::memory_order_relaxed)};
+  }
+};
+
+// Builds the entry for a response to a GET, null when it must not be
+// stored, section 3
+template <class Fields>
+inline std::shared_ptr<cached_response>
+make_cache_entry(const Fields &request,
+                 const boost::beast::http::response_header<> &head,
+                 std::chrono::system_clock::time_point request_time) {
+  const auto directives =
+      parse_cache_control(head[boost::beast::http::field::cache_control]);
+  if (directives.no_store ||
+      head.result() == boost::beast::http::status::partial_content ||
+      head.result() == boost::beast::http::status::not_modified) {
+    return nullptr;
+  }
+  auto entry = std::make_shared<cached_response>();
+  entry->head = head;
+  const auto vary = head[boost::beast::http::field::vary];
+  std::size_t pos = 0;
+  while (pos < vary.size()) {
+    auto comma = vary.find(',', pos);
+    if (comma == std::string_view::npos) {
+      comma = vary.size();
+    }
+    auto name = vary.substr(pos, comma - pos);
+    pos = comma + 1;
+    while (!name.empty() && (name.front() == ' ' || name.front() == '\t')) {
+      name.remove_prefix(1);
+    }
+    while (!name.empty() && (name.back() == ' ' || name.back() == '\t')) {
+      name.remove_suffix(1);
+    }
+    if (name == "*") {
+      return nullptr;
+    }
+    if (!name.empty()) {
+      entry->vary.emplace_back(std::string(name), std::string(request[name]));
+    }
+  }
+  entry->update_age(request_time, std::chrono::system_clock::now());
+  const bool explicit_freshness =
+      directives.max_age.has_value() ||
+      head.count(boost::beast::http::field::expires) > 0;
+  if (!explicit_freshness && !is_heuristically_cacheable(head.result())) {
+    return nullptr;
+  }
+  if (entry->freshness_lifetime.count() == 0 && !entry->has_validator()) {
+    // Could neither be served nor revalidated
+    return nullptr;
+  }
+  return entry;
+}
+
+// The stored response with the fields of a 304 applied, section 4.3.4
+inline std::shared_ptr<cached_response>
+refresh_cache_entry(const cached_response &stored,
+                    const boost::beast::http::response_header<> &not_modified,
+                    std::chrono::system_clock::time_point request_time) {
+  auto entry = std::make_shared<cached_response>(stored);
+  for (const auto &field : not_modified) {
+    if (field.name() == boost::beast::http::field::content_length ||
+        field.name() == boost::beast::http::field::transfer_encoding ||
+        field.name() == boost::beast::http::field::connection) {
+      continue;
+    }
+    entry->head.set(field.name_string(), field.value());
+  }
+  entry->update_age(request_time, std::chrono::system_clock::now());
+  return entry;
+}
+
+// Replays `entry` as a response read through the usual API
+template <class Response>
+inline boost::outcome_v2::result<std::unique_ptr<response<Response>>>
+make_cached_response(const cached_response &entry, bool decompress,
+                     boost::asio::yield_context yield) {
+  std::string head = "HTTP/1.1 ";
+  head.append(std::to_string(entry.head.result_int())).append(" ");
+  head.append(entry.head.reason()).append("\r\n");
+  for (const auto &field : entry.head) {
+    if (field.name() == boost::beast::http::field::content_length ||
+        field.name() == boost::beast::http::field::transfer_encoding ||
+        field.name() == boost::beast::http::field::connection ||
+        field.name() == boost::beast::http::field::keep_alive ||
+        field.name() == boost::beast::http::field::age) {
+      continue;
+    }
+    head.append(field.name_string()).append(": ");
+    head.append(field.value()).append("\r\n");
+  }
+  head.append("content-length: ")
+      .append(std::to_string(entry.body->size()))
+      .append("\r\nage: ")
+      .append(std::to_string(
+          entry.current_age(std::chrono::system_clock::now()).count()))
+      .append("\r\n\r\n");
+  auto conn = std::make_unique<connection>(std::make_unique<memory_stream>(
+      yield.get_executor(), std::move(head), entry.body));
+  auto resp = std::make_unique<response<Response>>(std::move(conn));
+  resp->decompress(decompress);
+  if (auto init_result = resp->init_parser(yield); init_result.has_error()) {
+    return init_result.error();
+  }
+  return boost::outcome_v2::success(std::move(resp));
+}
+} // namespace cpp_http::client
@@ -0,0 +1,84 @@
+#pragma once
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/append.hpp>
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/system/detail/error_code.hpp>
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <utility>
+
+namespace cpp_http::client {
+/**
+ * A stored response replayed as an AsyncReadStream of HTTP/1.1 bytes.
+ *
+ * The head is built for every replay, the body is shared with whoever
+ * stored it and never copied until it is read.
+ */
+class memory_stream {
+public:
+  using executor_type = boost::asio::any_io_executor;
+
+  memory_stream(executor_type executor, std::string head,
+                std::shared_ptr<const std::string> body)
+      : executor_(std::move(executor)), head_(std::move(head)),
+        body_(std::move(body)) {}
+
+  executor_type get_executor() const { return executor_; }
+
+  template <class MutableBufferSequence, class ReadToken>
+  auto async_read_some(const MutableBufferSequence &buffers,
+                       ReadToken &&token) {
+    return boost::asio::async_initiate<ReadToken,
+                                       void(boost::system::error_code,
+                                            std::size_t)>(
+        [this](auto handler, const MutableBufferSequence &buffers) {
+          boost::system::error_code ec;
+          std::size_t copied = 0;
+          if (offset_ < head_.size()) {
+            const std::array<boost::asio::const_buffer, 2> rest = {
+                boost::asio::buffer(head_) + offset_,
+                boost::asio::buffer(*body_)};
+            copied = boost::asio::buffer_copy(buffers, rest);
+          } else if (offset_ < head_.size() + body_->size()) {
+            copied = boost::asio::buffer_copy(
+                buffers,
+                boost::asio::buffer(*body_) + (offset_ - head_.size()));
+          } else {
+            ec = boost::asio::error::eof;
+          }
+          offset_ += copied;
+          boost::asio::post(executor_, boost::asio::append(std::move(handler),
+                                                           ec, copied));
+        },
+        token, buffers);
+  }
+
+  // Nothing is sent to a stored response
+  template <class ConstBufferSequence, class WriteToken>
+  auto async_write_some(const ConstBufferSequence &, WriteToken &&token) {
+    return boost::asio::async_initiate<WriteToken,
+                                       void(boost::system::error_code,
+                                            std::size_t)>(
+        [executor = executor_](auto handler) {
+          boost::asio::post(
+              executor,
+              boost::asio::append(std::move(handler),
+                                  boost::system::error_code{
+                                      boost::asio::error::operation_not_supported},
+                                  std::size_t{0}));
+        },
+        token);
+  }
+
+private:
+  executor_type executor_;
+  std::string head_;
+  std::shared_ptr<const std::string> body_;
+  std::size_t offset_{0};
+};
+} // namespace cpp_http::client
@@ -0,0 +1,165 @@
+#pragma once
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/experimental/channel.hpp>
+#include <boost/asio/experimental/channel_error.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/beast/core/tcp_stream.hpp>
+#include <boost/beast/http/chunk_encode.hpp>
+#include <boost/beast/http/file_body.hpp>
+#include <boost/beast/http/message.hpp>
+#include <boost/beast/http/serializer.hpp>
+#include <boost/beast/http/write.hpp>
+#include <boost/system/detail/error_code.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+namespace cpp_http::client {
+// Producer side of a streamed request body. Every message goes out as one
+// chunk without being copied, closing the channel ends the body and sending
+// an error aborts the request.
+using body_channel = boost::asio::experimental::channel<void(
+    boost::system::error_code, std::string)>;
+
+// Writes the chunks received from `source` and the last chunk, the header
+// must have been written with chunked transfer encoding
+template <class Stream>
+inline boost::system::error_code
+write_body_stream(Stream &stream, body_channel &source,
+                  boost::asio::yield_context yield) {
+  boost::system::error_code ec;
+  while (true) {
+    auto piece = source.async_receive(yield[ec]);
+    if (ec == boost::asio::experimental::error::channel_closed) {
+      break;
+    }
+    if (ec) {
+      return ec;
+    }
+    if (piece.empty()) {
+      // An empty chunk would end the body
+      continue;
+    }
+    boost::asio::async_write(
+        stream, boost::beast::http::make_chunk(boost::asio::buffer(piece)),
+        yield[ec]);
+    if (ec) {
+      return ec;
+    }
+  }
+  boost::asio::async_write(stream, boost::beast::http::make_chunk_last(),
+                           yield[ec]);
+  return ec;
+}
+
+#ifdef __linux__
+// Sends `size` bytes of `fd` from its current position with sendfile(2), so
+// the body goes from the page cache to the socket without passing through
+// user space. The file position is left unchanged, a retried request sends
+// the same bytes again. `timeout` bounds every wait for socket buffer space,
+// zero waits forever.
+inline boost::system::error_code
+send_file(boost::asio::ip::tcp::socket &socket, int fd, std::uint64_t size,
+          std::chrono::milliseconds timeout, boost::asio::yield_context yield) {
+  off_t offset = ::lseek(fd, 0, SEEK_CUR);
+  if (offset < 0) {
+    return {errno, boost::system::system_category()};
+  }
+  boost::system::error_code ec;
+  socket.native_non_blocking(true, ec);
+  if (ec) {
+    return ec;
+  }
+  boost::asio::steady_timer timer{socket.get_executor()};
+  while (size > 0) {
+    const auto sent =
+        ::sendfile(socket.native_handle(), fd, &offset,
+                   static_cast<std::size_t>(
+                       std::min<std::uint64_t>(size, std::uint64_t{1} << 30)));
+    if (sent > 0) {
+      size -= static_cast<std::uint64_t>(sent);
+      continue;
+    }
+    if (sent == 0) {
+      // The file shrank below the announced content-length
+      return boost::asio::error::eof;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      return {errno, boost::system::system_category()};
+    }
+    bool expired = false;
+    if (timeout.count() > 0) {
+      timer.expires_after(timeout);
+      timer.async_wait([&socket, &expired](boost::system::error_code ec) {
+        if (!ec) {
+          expired = true;
+          socket.cancel();
+        }
+      });
+    }
+    socket.async_wait(boost::asio::ip::tcp::socket::wait_write, yield[ec]);
+    timer.cancel();
+    if (expired) {
+      return boost::asio::error::timed_out;
+    }
+    if (ec) {
+      return ec;
+    }
+  }
+  return {};
+}
+#endif
+
+// Writes `request` to `stream`. Bodies streamed from `body_stream` and file
+// bodies on plain TCP bypass Beast's body writer, everything else goes
+// through http::async_write.
+template <class Stream, class Body>
+inline boost::system::error_code
+write_request(Stream &stream, boost::beast::http::request<Body> &request,
+              body_channel *body_stream, std::chrono::milliseconds timeout,
+              boost::asio::yield_context yield) {
+  boost::system::error_code ec;
+#ifdef __linux__
+  constexpr bool use_sendfile =
+      std::is_same_v<Stream, boost::beast::tcp_stream> &&
+      std::is_same_v<Body, boost::beast::http::file_body>;
+#else
+  constexpr bool use_sendfile = false;
+#endif
+  if (body_stream == nullptr && !use_sendfile) {
+    boost::beast::http::async_write(stream, request, yield[ec]);
+    return ec;
+  }
+  boost::beast::http::request_serializer<Body> serializer{request};
+  boost::beast::http::async_write_header(stream, serializer, yield[ec]);
+  if (ec) {
+    return ec;
+  }
+  if (body_stream != nullptr) {
+    return write_body_stream(stream, *body_stream, yield);
+  }
+#ifdef __linux__
+  if constexpr (use_sendfile) {
+    return send_file(stream.socket(), request.body().file().native_handle(),
+                     request.body().size(), timeout, yield);
+  }
+#endif
+  return ec;
+}
+} // namespace cpp_http::client
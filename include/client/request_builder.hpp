@@ -3,19 +3,53 @@
 #include "boost/beast/http/string_body_fwd.hpp"
 #include "boost/beast/http/verb.hpp"
 #include "boost/url/url.hpp"
+#include "client/connection_pool.hpp"
+#include "client/decompress.hpp"
+#include "client/dns_cache.hpp"
+#include "client/request_body.hpp"
+#include "client/retry.hpp"
+#include "client/tls.hpp"
 #include <boost/beast/http.hpp>
 #include <boost/beast/version.hpp>
 #include <boost/url.hpp>
 #include <chrono>
 #include <cstdint>
+#include <memory>
 
 namespace cpp_http::client {
+class http_cache;
+
 template <class Body = boost::beast::http::string_body> struct http_request {
   boost::urls::url url;
   boost::beast::http::request<Body> request;
   bool auto_redirect{true};
   uint64_t max_redirects{5};
   uint64_t timeout_ms{5000};
+  // Keep-alive connections to reuse, default_pool() when null
+  std::shared_ptr<connection_pool> pool;
+  // Name resolution, default_dns_cache() when null
+  std::shared_ptr<dns_cache> dns;
+  // TLS settings and session cache, default_tls_context() when null
+  std::shared_ptr<tls_context> tls;
+  // Offer HTTP/2 through ALPN on https, use it with prior knowledge (h2c) on
+  // http
+  bool http2{false};
+  // HTTP/2 priority weight from 1 to 256
+  unsigned priority{16};
+  // Advertise the compiled-in content codings and decode response bodies
+  bool decompress{false};
+  // Body sent chunked as the producer delivers it instead of `request.body()`
+  std::shared_ptr<body_channel> body_stream;
+  // Retries after connect errors, and after resets and timeouts for
+  // idempotent methods
+  retry_policy retry;
+  // Duplicate an idempotent request still waiting for its response header
+  // after this long, e.g. the observed p95 latency. Zero disables hedging.
+  std::chrono::milliseconds hedge_after{0};
+  // Caps retries and hedges, default_retry_budget() when null
+  std::shared_ptr<retry_budget> budget;
+  // Serves GET requests from stored responses when set
+  std::shared_ptr<http_cache> cache;
 };
 
 template <class Body = boost::beast::http::string_body> class request_builder {
@@ -62,6 +96,13 @@ public:
     return *this;
   }
 
+  // Streams the body from `source` with chunked transfer encoding, the
+  // producer closes the channel after the last piece
+  request_builder &body_stream(std::shared_ptr<body_channel> source) {
+    request_.body_stream = std::move(source);
+    return *this;
+  }
+
   request_builder &timeout(std::chrono::milliseconds duration) {
     request_.timeout_ms = duration.count();
     return *this;
@@ -77,14 +118,86 @@ public:
     return *this;
   }
 
+  request_builder &pool(std::shared_ptr<connection_pool> pool) {
+    request_.pool = std::move(pool);
+    return *this;
+  }
+
+  request_builder &dns(std::shared_ptr<dns_cache> dns) {
+    request_.dns = std::move(dns);
+    return *this;
+  }
+
+  request_builder &tls(std::shared_ptr<tls_context> tls) {
+    request_.tls = std::move(tls);
+    return *this;
+  }
+
+  request_builder &http2(bool enable) {
+    request_.http2 = enable;
+    return *this;
+  }
+
+  request_builder &priority(unsigned weight) {
+    request_.priority = weight;
+    return *this;
+  }
+
+  request_builder &retry(retry_policy policy) {
+    request_.retry = policy;
+    return *this;
+  }
+
+  request_builder &hedge(std::chrono::milliseconds after) {
+    request_.hedge_after = after;
+    return *this;
+  }
+
+  request_builder &budget(std::shared_ptr<retry_budget> budget) {
+    request_.budget = std::move(budget);
+    return *this;
+  }
+
+  request_builder &cache(std::shared_ptr<http_cache> cache) {
+    request_.cache = std::move(cache);
+    return *this;
+  }
+
+  // Sends Accept-Encoding and hands out decoded bodies
+  request_builder &decompress(bool enable) {
+    request_.decompress = enable;
+    if (enable) {
+      request_.request.set(boost::beast::http::field::accept_encoding,
+                           accepted_encodings());
+    } else {
+      request_.request.erase(boost::beast::http::field::accept_encoding);
+    }
+    return *this;
+  }
+
   // Build request
-  http_request<Body> build() {
-    request_.request.target(request_.url.encoded_target());
-    request_.request.prepare_payload(); // sets Content-Length etc. if needed
+  http_request<Body> build() & {
+    prepare();
     return request_;
   }
 
+  // Moves the request out, the body is not copied
+  http_request<Body> build() && {
+    prepare();
+    return std::move(request_);
+  }
+
 private:
+  void prepare() {
+    request_.request.target(request_.url.encoded_target());
+    if (request_.body_stream) {
+      request_.request.chunked(true);
+    } else {
+      request_.request.prepare_payload(); // sets Content-Length etc. if needed
+    }
+  }
+
+
   http_request<Body> request_;
 };
 
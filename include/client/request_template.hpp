@@ -0,0 +1,245 @@
+#pragma once
+#include "client/client.hpp"
+#include "client/connection_pool.hpp"
+#include "client/dns_cache.hpp"
+#include "client/request_builder.hpp"
+#include "client/response.hpp"
+#include "client/timing.hpp"
+#include "client/tls.hpp"
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/beast/http/dynamic_body.hpp>
+#include <boost/beast/http/error.hpp>
+#include <boost/beast/http/field.hpp>
+#include <boost/beast/http/string_body.hpp>
+#include <boost/beast/http/verb.hpp>
+#include <boost/outcome/result.hpp>
+#include <boost/outcome/success_failure.hpp>
+#include <boost/system/detail/error_code.hpp>
+#include <boost/url/url.hpp>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace cpp_http::client {
+/**
+ * A request serialized once and sent many times with a few parts changed.
+ *
+ * Every "{}" in the target or a header value of the request it is created
+ * from is a slot, in the target also its percent-encoded form that
+ * request_builder's param() and target() produce. send_template() fills
+ * the slots in order of appearance and writes the fixed parts and the slot
+ * values as one gather write, without building or serializing a message
+ * and without allocating for the request. Slot values are copied as given,
+ * target values have to be percent-encoded already.
+ *
+ * The pool key is fixed at creation, a template is used on the io_context
+ * of the executor it was created for.
+ */
+class request_template {
+public:
+  static constexpr std::size_t max_slots = 8;
+
+private:
+  struct private_tag {};
+
+  boost::urls::url url_;
+  std::shared_ptr<connection_pool> pool_;
+  std::shared_ptr<dns_cache> dns_;
+  std::shared_ptr<tls_context> tls_;
+  std::chrono::milliseconds timeout_;
+  boost::beast::http::verb method_;
+  bool idempotent_;
+  bool decompress_;
+  std::string key_;
+  // Head with the slot markers taken out, followed by the body
+  std::string bytes_;
+  std::array<std::size_t, max_slots> slots_{};
+  std::size_t slot_count_{0};
+
+public:
+  request_template(private_tag, const http_request<> &req, std::string key)
+      : url_(req.url), pool_(req.pool ? req.pool : default_pool()),
+        dns_(req.dns ? req.dns : default_dns_cache()),
+        tls_(req.tls ? req.tls : default_tls_context()),
+        timeout_(req.timeout_ms), method_(req.request.method()),
+        idempotent_(is_idempotent(method_)), decompress_(req.decompress),
+        key_(std::move(key)) {}
+
+  // Serializes `req` for requests running on `executor`. Streamed bodies
+  // and more than max_slots slots are refused.
+  template <class Executor>
+  static boost::outcome_v2::result<request_template>
+  create(http_request<> req, const Executor &executor) {
+    namespace http = boost::beast::http;
+    if (req.body_stream || req.request.chunked()) {
+      return boost::asio::error::operation_not_supported;
+    }
+    auto key = connection_pool::key_for(req.url, executor);
+    request_template result{private_tag{}, req, std::move(key)};
+    auto &message = req.request;
+    const std::string target = message.target().empty()
+                                   ? std::string(req.url.encoded_target())
+                                   : std::string(message.target());
+    message.set(http::field::host, req.url.host_address());
+    message.set(http::field::user_agent, user_agent());
+    message.prepare_payload();
+
+    auto &bytes = result.bytes_;
+    // Slots are only looked for where values go
+    const auto append = [&](std::string_view text, bool encoded) {
+      while (true) {
+        auto marker = text.find("{}");
+        auto length = std::size_t{2};
+        if (const auto escaped = text.find("%7B%7D");
+            encoded && escaped < marker) {
+          marker = escaped;
+          length = 6;
+        }
+        if (marker == std::string_view::npos) {
+          break;
+        }
+        if (result.slot_count_ == max_slots) {
+          return false;
+        }
+        bytes.append(text.substr(0, marker));
+        result.slots_[result.slot_count_++] = bytes.size();
+        text.remove_prefix(marker + length);
+      }
+      bytes.append(text);
+      return true;
+    };
+    bytes.append(message.method_string()).append(" ");
+    if (!append(target, true)) {
+      return boost::asio::error::invalid_argument;
+    }
+    bytes.append(" HTTP/1.1\r\n");
+    for (const auto &field : message) {
+      bytes.append(field.name_string()).append(": ");
+      if (!append(field.value(), false)) {
+        return boost::asio::error::invalid_argument;
+      }
+      bytes.append("\r\n");
+    }
+    bytes.append("\r\n").append(message.body());
+    return boost::outcome_v2::success(std::move(result));
+  }
+
+  [[nodiscard]] std::size_t slot_count() const { return slot_count_; }
+  [[nodiscard]] const boost::urls::url &url() const { return url_; }
+
+  // The fixed parts with `values` in between, unused entries stay empty
+  boost::outcome_v2::result<
+      std::array<boost::asio::const_buffer, 2 * max_slots + 1>>
+  buffers(std::initializer_list<std::string_view> values) const {
+    if (values.size() != slot_count_) {
+      return boost::asio::error::invalid_argument;
+    }
+    std::array<boost::asio::const_buffer, 2 * max_slots + 1> result{};
+    std::size_t from = 0;
+    std::size_t n = 0;
+    auto value = values.begin();
+    for (std::size_t i = 0; i < slot_count_; ++i, ++value) {
+      // A line break in a value would end the field, or the request
+      if (value->find_first_of("\r\n") != std::string_view::npos) {
+        return boost::beast::http::error::bad_value;
+      }
+      result[n++] =
+          boost::asio::buffer(bytes_.data() + from, slots_[i] - from);
+      result[n++] = boost::asio::buffer(value->data(), value->size());
+      from = slots_[i];
+    }
+    result[n] =
+        boost::asio::buffer(bytes_.data() + from, bytes_.size() - from);
+    return result;
+  }
+
+  // Used by send_template()
+  [[nodiscard]] connection_pool &pool() const { return *pool_; }
+  [[nodiscard]] dns_cache &dns() const { return *dns_; }
+  [[nodiscard]] tls_context &tls() const { return *tls_; }
+  [[nodiscard]] const std::string &key() const { return key_; }
+  [[nodiscard]] std::chrono::milliseconds timeout() const { return timeout_; }
+  [[nodiscard]] boost::beast::http::verb method() const { return method_; }
+  [[nodiscard]] bool idempotent() const { return idempotent_; }
+  [[nodiscard]] bool decompress() const { return decompress_; }
+};
+
+// Sends `tpl` with its slots set to `values` over HTTP/1.1 and reads the
+// response header. Redirects are returned, not followed.
+template <class Response = boost::beast::http::dynamic_body>
+inline boost::outcome_v2::result<std::unique_ptr<response<Response>>>
+send_template(const request_template &tpl,
+              std::initializer_list<std::string_view> values,
+              boost::asio::yield_context yield) {
+  auto buffers = tpl.buffers(values);
+  if (buffers.has_error()) {
+    return buffers.error();
+  }
+  request_timing timing;
+  timing.start = request_timing::clock::now();
+  boost::outcome_v2::result<std::unique_ptr<response<Response>>> resp{
+      boost::asio::error::not_connected};
+  for (bool retry = tpl.idempotent();; retry = false) {
+    auto conn = tpl.pool().checkout(tpl.key(), yield, tpl.timeout());
+    if (conn.has_error()) {
+      notify_timing_observer(timing, conn.error());
+      return conn.error();
+    }
+    timing.checked_out = request_timing::clock::now();
+    if (!conn.value()->is_connected()) {
+      const auto timeout_ms = static_cast<uint64_t>(tpl.timeout().count());
+      if (auto connected = connect(*conn.value(), tpl.url(), timeout_ms,
+                                   tpl.dns(), tpl.tls(), false, timing, yield);
+          connected.has_error()) {
+        notify_timing_observer(timing, connected.error());
+        return connected.error();
+      }
+    }
+    const bool reused = conn.value()->requests() > 0;
+    timing.reused_connection = reused;
+    conn.value()->mark_used();
+    if (tpl.timeout().count() > 0) {
+      conn.value()->expires_after(tpl.timeout());
+    }
+    boost::system::error_code ec;
+    conn.value()->with_stream([&](auto &stream) {
+      boost::asio::async_write(stream, buffers.value(), yield[ec]);
+    });
+    if (!ec) {
+      timing.request_written = request_timing::clock::now();
+      auto created =
+          std::make_unique<response<Response>>(std::move(conn).value());
+      created->decompress(tpl.decompress());
+      if (auto init_result = created->init_parser(yield, tpl.method());
+          init_result.has_error()) {
+        ec = init_result.error();
+      } else {
+        timing.header_received = request_timing::clock::now();
+        created->set_timing(timing);
+        resp = std::move(created);
+      }
+    }
+    if (ec) {
+      resp = ec;
+    }
+    // A kept-alive connection the server closed meanwhile gets one more
+    // try on a new connection
+    if (!ec || !reused || !retry || !is_stale_connection(ec)) {
+      break;
+    }
+  }
+  notify_timing_observer(timing, resp.has_error()
+                                     ? resp.error()
+                                     : boost::system::error_code{});
+  return resp;
+}
+} // namespace cpp_http::client
@@ -1,20 +1,24 @@
 #pragma once
 #include "boost/asio/experimental/channel.hpp"
-#include "boost/asio/read_until.hpp"
 #include "boost/asio/spawn.hpp"
-#include "boost/asio/streambuf.hpp"
 #include "boost/beast/core/flat_buffer.hpp"
 #include "boost/beast/core/tcp_stream.hpp"
 #include "boost/beast/http/dynamic_body_fwd.hpp"
 #include "boost/beast/http/impl/read.hpp"
 #include "boost/outcome.hpp"
+#include "client/body_sink.hpp"
+#include "client/connection_pool.hpp"
+#include "client/decompress.hpp"
+#include "client/sse_parser.hpp"
+#include "client/timing.hpp"
 #include "message.hpp"
-#include <boost/asio/basic_streambuf_fwd.hpp>
+#include "simd.hpp"
 #include <boost/asio/buffer.hpp>
 #include <boost/asio/buffers_iterator.hpp>
 #include <boost/asio/error.hpp>
 #include <boost/asio/ssl/stream.hpp>
 #include <boost/beast/core/basic_stream.hpp>
+#include <boost/beast/core/buffers_range.hpp>
 #include <boost/beast/core/buffers_to_string.hpp>
 #include <boost/beast/core/error.hpp>
 #include <boost/beast/core/impl/error.hpp>
@@ -26,6 +30,7 @@
 #include <boost/beast/http/parser_fwd.hpp>
 #include <boost/beast/http/status.hpp>
 #include <boost/beast/http/string_body_fwd.hpp>
+#include <boost/beast/http/verb.hpp>
 #include <boost/beast/ssl.hpp>
 #include <boost/core/detail/string_view.hpp>
 #include <boost/outcome/result.hpp>
@@ -35,35 +40,56 @@
 #include <boost/url/url.hpp>
 #include <boost/utility/string_view_fwd.hpp>
 #include <charconv>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
+#include <deque>
 #include <memory>
 #include <optional>
-#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <system_error>
+#include <type_traits>
+#include <utility>
 
 namespace cpp_http::client {
 template <class Body = boost::beast::http::dynamic_body> class response {
 public:
   using value_type = typename Body::value_type;
+  explicit response(std::unique_ptr<connection> conn)
+      : connection_(std::move(conn)), reused_(connection_->is_reused()),
+        done_(false) {}
   explicit response(std::unique_ptr<boost::beast::tcp_stream> stream)
-      : stream_(std::move(stream)), done_(false) {}
+      : response(std::make_unique<connection>(std::move(stream))) {}
   explicit response(
       std::unique_ptr<boost::asio::ssl::stream<boost::beast::tcp_stream>>
           ssl_stream)
-      : ssl_stream_(std::move(ssl_stream)), done_(false) {}
+      : response(std::make_unique<connection>(std::move(ssl_stream))) {}
   ~response() { close(); }
 
+  // Decode the body according to Content-Encoding, may be switched after
+  // init_parser() as long as no body was read
+  inline void decompress(bool enable) {
+    decompress_ = enable;
+    decoder_.reset();
+    if (decompress_ && parser_.is_header_done()) {
+      // Unknown codings are passed through undecoded
+      decoder_ = decompressor::create(parse_content_coding(
+          head()[boost::beast::http::field::content_encoding]));
+    }
+  }
+
+  // Reads the response header. `method` is the request's, the answer to a
+  // HEAD request has no body whatever its Content-Length says.
   inline boost::outcome_v2::result<void>
-  init_parser(boost::asio::yield_context yield) {
-    if (stream_) {
-      boost::beast::http::async_read_header(*stream_, buffer_, parser_,
+  init_parser(boost::asio::yield_context yield,
+              boost::beast::http::verb method = boost::beast::http::verb::get) {
+    parser_.skip(method == boost::beast::http::verb::head);
+    connection_->with_stream([&](auto &stream) {
+      boost::beast::http::async_read_header(stream, buffer_, parser_,
                                             yield[ec_]);
-    } else if (ssl_stream_) {
-      boost::beast::http::async_read_header(*ssl_stream_, buffer_, parser_,
-                                            yield[ec_]);
-    }
+    });
     if (ec_) {
       return ec_;
     }
@@ -72,17 +98,16 @@ public:
     std::string ctype = parser_.get().base()["Content-Type"];
     sse_ = ctype.find("text/event-stream") != std::string::npos;
     chunked_ = parser_.get().chunked();
-    if (stream_) {
-      stream_->expires_never();
-    } else if (ssl_stream_) {
-      boost::beast::get_lowest_layer(*ssl_stream_).expires_never();
-    }
+    decompress(decompress_);
+    connection_->expires_never();
+    // Bodiless responses (HEAD, 204, 304) are complete with the header
+    release_if_done();
     return boost::outcome_v2::success();
   }
 
-  inline auto status() const { return parser_.get().result(); }
+  inline auto status() const { return head().result(); }
 
-  inline auto reason() const { return parser_.get().reason(); }
+  inline auto reason() const { return head().reason(); }
 
   inline auto is_redirection() const {
     auto status_code = status();
@@ -93,13 +118,13 @@ public:
            status_code == boost::beast::http::status::permanent_redirect;
   }
 
-  inline const auto &header() const { return parser_.get().base(); }
+  inline const auto &header() const { return head(); }
 
   inline std::optional<boost::urls::url> redirect_url() const {
     if (!is_redirection()) {
       return std::nullopt;
     }
-    auto loc = parser_.get().base()["Location"];
+    auto loc = head()["Location"];
     if (loc.empty()) {
       return std::nullopt;
     }
@@ -128,40 +153,7 @@ public:
     if (chunked_) {
       return read_chunked_sse(tx, yield);
     }
-    boost::asio::streambuf buffer{};
-    while (!done_) {
-      size_t line_length{};
-      if (stream_) {
-        line_length =
-            boost::asio::async_read_until(*stream_, buffer, "\n\n", yield[ec_]);
-      } else if (ssl_stream_) {
-        line_length = boost::asio::async_read_until(*ssl_stream_, buffer,
-                                                    "\n\n", yield[ec_]);
-      }
-      if (ec_) {
-        if (ec_ == boost::beast::http::error::need_buffer) {
-          continue;
-        }
-        if (ec_ == boost::asio::error::eof) {
-          done_ = true;
-          break;
-        }
-        return ec_;
-      }
-
-      std::string block{static_cast<const char *>(buffer.data().data()),
-                        line_length};
-      auto message = parse_sse_block(block);
-      if (!message.has_value()) {
-        continue;
-      }
-      buffer.consume(line_length);
-      tx.async_send(ec_, std::move(message).value(), yield[ec_]);
-      if (ec_) {
-        return ec_;
-      }
-    }
-    return ec_;
+    return read_plain_sse(tx, yield);
   }
 
   inline boost::outcome_v2::result<void> read_chunked_encoding(
@@ -174,25 +166,27 @@ public:
     if (!chunked_) {
       return boost::beast::http::error::bad_transfer_encoding;
     }
-    parser_.body_limit(std::numeric_limits<std::uint64_t>::max());
     http_chunk message;
+    std::deque<http_chunk> ready;
     auto on_chunk_header = [&message](uint64_t size,
                                       boost::core::string_view extensions,
                                       boost::beast::error_code &ec) {
       message.extensions = extensions;
       message.chunked_body.reserve(size);
     };
-    auto on_chunk_body = [&message, &tx, yield](uint64_t remain,
-                                                boost::core::string_view body,
-                                                boost::beast::error_code &ec) {
-      message.chunked_body.append(body);
+    auto on_chunk_body = [&message, &ready,
+                          this](uint64_t remain, boost::core::string_view body,
+                                boost::beast::error_code &ec) {
+      if (!append_body(body, message.chunked_body, ec)) {
+        return body.length();
+      }
       if (remain == body.size()) {
-        // tx.async_send(ec, std::move(message), yield[ec]);
-        tx.try_send(ec, std::move(message));
+        ready.push_back(std::exchange(message, http_chunk{}));
       }
       return body.length();
     };
-    return read_chunked_encoding(on_chunk_header, on_chunk_body, yield);
+    return read_chunked_encoding(on_chunk_header, on_chunk_body, ready, tx,
+                                 yield);
   }
 
   // read next available chunk
@@ -205,12 +199,9 @@ public:
       return boost::beast::http::error::bad_transfer_encoding;
     }
     parser_.get().body().clear();
-    if (stream_) {
-      boost::beast::http::async_read(*stream_, buffer_, parser_, yield[ec_]);
-    } else if (ssl_stream_) {
-      boost::beast::http::async_read(*ssl_stream_, buffer_, parser_,
-                                     yield[ec_]);
-    }
+    connection_->with_stream([&](auto &stream) {
+      boost::beast::http::async_read(stream, buffer_, parser_, yield[ec_]);
+    });
     if (ec_) {
       if (ec_ == boost::beast::http::error::need_buffer) {
         return read(yield);
@@ -223,79 +214,196 @@ public:
     }
 
     auto &body_data = parser_.get().body();
+    if (decoder_) {
+      if (auto decoded = decode_body(body_data); decoded.has_error()) {
+        return decoded.error();
+      }
+    }
     done_ = parser_.is_done();
+    release_if_done();
     return body_data;
   }
 
-  inline bool complete() const { return done_; }
+  // Reads the next piece of the body straight into `buffer` and returns
+  // the number of bytes stored, decoded when the response is compressed.
+  // Use instead of read(), the body is never held by the response.
+  inline boost::outcome_v2::result<std::size_t>
+  read_some(boost::asio::mutable_buffer buffer,
+            boost::asio::yield_context yield) {
+    if (!decoder_) {
+      return read_raw(buffer, yield);
+    }
+    while (decoded_offset_ == decoded_.size()) {
+      decoded_.clear();
+      decoded_offset_ = 0;
+      if (scratch_offset_ == scratch_size_ && !decoder_full_) {
+        if (done_) {
+          return boost::asio::error::eof;
+        }
+        scratch_.resize(16 * 1024);
+        auto raw = read_raw(boost::asio::buffer(scratch_), yield);
+        if (raw.has_error()) {
+          return raw.error();
+        }
+        scratch_offset_ = 0;
+        scratch_size_ = raw.value();
+      }
+      // One piece per round, a small read of a compressed body may expand
+      // to far more than the caller asked for
+      const std::string_view input{scratch_.data() + scratch_offset_,
+                                   scratch_size_ - scratch_offset_};
+      auto used =
+          decoder_->decode_some(input, decoded_, decompressor::piece_size);
+      if (used.has_error()) {
+        ec_ = used.error();
+        return ec_;
+      }
+      decoder_full_ = decoded_.size() == decompressor::piece_size;
+      // Bytes the coding ignores, e.g. after the end of the stream, are
+      // dropped instead of offered again
+      scratch_offset_ = used.value() == 0 && decoded_.empty()
+                            ? scratch_size_
+                            : scratch_offset_ + used.value();
+      if (done_ && decoded_.empty() && scratch_offset_ == scratch_size_ &&
+          !decoder_full_) {
+        return 0;
+      }
+    }
+    const auto copied = boost::asio::buffer_copy(
+        buffer, boost::asio::buffer(decoded_.data() + decoded_offset_,
+                                    decoded_.size() - decoded_offset_));
+    decoded_offset_ += copied;
+    return copied;
+  }
 
-  inline void close() {
-    if (stream_) {
-      stream_->socket().shutdown(boost::asio::ip::tcp::socket::shutdown_both,
-                                 ec_);
-      // not_connected happens sometimes
-      // so don't bother reporting it.
-      if (ec_ && ec_ != boost::beast::errc::not_connected) {
+  // Hands the body to `on_data(std::string_view)` piece by piece, reading
+  // stops early when it returns false
+  template <class OnData>
+  inline boost::outcome_v2::result<void>
+  read_body(OnData &&on_data, boost::asio::yield_context yield,
+            std::size_t piece_size = 64 * 1024) {
+    std::string piece(piece_size, '\0');
+    while (!complete()) {
+      auto bytes = read_some(boost::asio::buffer(piece), yield);
+      if (bytes.has_error()) {
+        return bytes.error();
+      }
+      if (bytes.value() > 0 &&
+          !on_data(std::string_view(piece.data(), bytes.value()))) {
+        return boost::asio::error::operation_aborted;
+      }
+    }
+    return boost::outcome_v2::success();
+  }
+
+  // Streams the body into `sink` and waits until it reached the file,
+  // returns the number of bytes written
+  inline boost::outcome_v2::result<std::uint64_t>
+  read_to_file(file_sink &sink, boost::asio::yield_context yield) {
+    while (!complete()) {
+      auto bytes = read_some(sink.prepare(), yield);
+      if (bytes.has_error()) {
+        // The write in flight still has to finish before the error is
+        // reported
+        (void)sink.finish(yield);
+        return bytes.error();
+      }
+      if (auto committed = sink.commit(bytes.value(), yield);
+          committed.has_error()) {
+        return committed.error();
       }
     }
-    if (ssl_stream_) {
-      // do nothing is ok, ssl shutdown will require a yield_context
+    if (auto finished = sink.finish(yield); finished.has_error()) {
+      return finished.error();
+    }
+    return sink.size();
+  }
+
+  inline boost::outcome_v2::result<std::uint64_t>
+  read_to_file(const std::string &path, boost::asio::yield_context yield,
+               std::size_t write_behind = 1024 * 1024) {
+    auto sink = file_sink::create(path, yield.get_executor(), write_behind);
+    if (sink.has_error()) {
+      return sink.error();
+    }
+    return read_to_file(sink.value(), yield);
+  }
+
+  inline bool complete() const {
+    return done_ && decoded_offset_ == decoded_.size() &&
+           scratch_offset_ == scratch_size_ && !decoder_full_;
+  }
+
+  // Time the chunk and SSE readers spent waiting for the consumer to make
+  // room in its channel, the socket is not read meanwhile
+  [[nodiscard]] inline std::chrono::nanoseconds blocked_on_consumer() const {
+    return blocked_;
+  }
+
+  // True when the request went over a kept-alive connection
+  inline bool is_reused_connection() const { return reused_; }
+
+  // Phases of the request up to the response header
+  [[nodiscard]] inline const request_timing &timing() const {
+    return timing_;
+  }
+
+  inline void set_timing(const request_timing &timing) { timing_ = timing; }
+
+  // Gives the connection back to its pool when the response was read to the
+  // end and keep-alive holds, shuts it down otherwise
+  inline void close() {
+    release_if_done();
+    if (connection_) {
+      connection_->shutdown();
+      connection_.reset();
     }
     done_ = true;
   }
 
-private:
-  inline static void parse_sse_line(std::string line,
-                                    server_sent_event &event) {
-    auto colon = line.find(':');
-    std::string field;
-    std::string value;
-    if (colon == std::string::npos) {
-      field = std::move(line);
-    } else {
-      field = line.substr(0, colon);
-      value = line.substr(colon + 1);
-      if (boost::string_view{value}.starts_with(' ')) {
-        value.erase(0, 1);
-      }
+  // Reads and drops the rest of a small body so the connection can be
+  // reused, e.g. for the body of a redirect
+  inline void discard_body(boost::asio::yield_context yield,
+                           std::uint64_t limit = 64 * 1024) {
+    if (done_ || chunked_ || sse_ || !connection_) {
+      return;
     }
-    if (field == "data") {
-      if (!event.data.has_value()) {
-        event.data = std::move(value);
-      } else {
-        event.data->append("\n");
-        event.data->append(value);
-      }
-    } else if (field == "event") {
-      event.event = std::move(value);
-    } else if (field == "id") {
-      event.id = std::move(value);
-    } else if (field == "retry") {
-      uint64_t v{};
-      if (auto err = std::from_chars(value.c_str(),
-                                     value.c_str() + value.size(), v, 10);
-          err.ec == std::error_code{}) {
-        event.retry = v;
+    const auto length = parser_.content_length();
+    if (!length.has_value() || *length > limit) {
+      return;
+    }
+    while (!done_) {
+      if (read(yield).has_error()) {
+        return;
       }
     }
   }
 
+  // True while the response still owns a connection, false once it was
+  // closed or handed back to the pool
+  [[nodiscard]] inline bool holds_connection() const {
+    return connection_ != nullptr;
+  }
+
+  // Parses one event without its terminating blank line, all fields of
+  // `block` end up in the same event
   inline static std::optional<server_sent_event>
-  parse_sse_block(const std::string &block) {
-    if (block.empty()) {
-      return {};
-    }
+  parse_sse_block(std::string_view block) {
     server_sent_event message;
-    std::istringstream iss{block};
-    std::string line;
-    while (std::getline(iss, line)) {
-      if (!line.empty() && line.back() == '\n') {
-        line.pop_back();
+    std::size_t pos = 0;
+    while (pos < block.size()) {
+      auto end = simd::find_any<'\r', '\n'>(block, pos);
+      if (end == std::string_view::npos) {
+        end = block.size();
+      }
+      if (end > pos) {
+        sse_parser::parse_line(block.substr(pos, end - pos), message);
       }
-      if (!line.empty() && line.back() == '\r') {
-        line.pop_back();
+      pos = end + 1;
+      if (end < block.size() && block[end] == '\r' && pos < block.size() &&
+          block[pos] == '\n') {
+        ++pos;
       }
-      parse_sse_line(std::move(line), message);
     }
     if (message.valid()) {
       return message;
@@ -303,11 +411,35 @@ private:
     return {};
   }
 
-  template <class OnChunkHeader, class OnChunkbody>
-  inline boost::outcome_v2::result<void>
-  read_chunked_encoding(OnChunkHeader &on_chunk_header,
-                        OnChunkbody &on_chunk_body,
-                        boost::asio::yield_context yield) {
+private:
+  // Hands `message` to the consumer, waiting while its channel is full so
+  // that nothing is dropped
+  template <class Message>
+  inline boost::beast::error_code
+  deliver(boost::asio::experimental::channel<
+              void(boost::system::error_code, Message)> &tx,
+          Message &&message, boost::asio::yield_context yield) {
+    boost::beast::error_code ec;
+    // try_send leaves the message alone when the channel is full
+    if (tx.try_send(ec, std::move(message))) {
+      return ec;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    tx.async_send(boost::system::error_code{}, std::move(message), yield[ec]);
+    blocked_ += std::chrono::steady_clock::now() - start;
+    return ec;
+  }
+
+  // The parser callbacks only queue complete messages in `ready`, they are
+  // delivered between two reads. A consumer that falls behind stops reading
+  // from the socket, so at most one read worth of messages is held here.
+  template <class Message, class OnChunkHeader, class OnChunkbody>
+  inline boost::outcome_v2::result<void> read_chunked_encoding(
+      OnChunkHeader &on_chunk_header, OnChunkbody &on_chunk_body,
+      std::deque<Message> &ready,
+      boost::asio::experimental::channel<void(boost::system::error_code,
+                                              Message)> &tx,
+      boost::asio::yield_context yield) {
     if (done_) {
       return boost::asio::error::eof;
     }
@@ -318,28 +450,33 @@ private:
     parser_.on_chunk_header(on_chunk_header);
     parser_.on_chunk_body(on_chunk_body);
 
-    while (!done_) {
-      if (stream_) {
-        boost::beast::http::async_read(*stream_, buffer_, parser_, yield[ec_]);
-      } else if (ssl_stream_) {
-        boost::beast::http::async_read(*ssl_stream_, buffer_, parser_,
-                                       yield[ec_]);
+    while (true) {
+      connection_->with_stream([&](auto &stream) {
+        boost::beast::http::async_read_some(stream, buffer_, parser_,
+                                            yield[ec_]);
+      });
+      if (ec_ == boost::beast::http::error::need_buffer) {
+        ec_ = {};
       }
-      done_ = true;
-      if (ec_) {
-        if (ec_ == boost::beast::http::error::need_buffer) {
-          continue;
+      for (; !ready.empty(); ready.pop_front()) {
+        if (auto ec = deliver(tx, std::move(ready.front()), yield)) {
+          ec_ = ec;
+          return ec_;
         }
+      }
+      if (ec_) {
+        done_ = true;
         if (ec_ == boost::asio::error::eof) {
           return boost::outcome_v2::success();
         }
         return boost::outcome_v2::failure(ec_);
       }
+      if (parser_.is_done()) {
+        done_ = true;
+        release_if_done();
+        return boost::outcome_v2::success();
+      }
     }
-    if (ec_) {
-      return ec_;
-    }
-    return boost::outcome_v2::success();
   }
 
   inline boost::outcome_v2::result<void> read_chunked_sse(
@@ -352,43 +489,215 @@ private:
     if (!sse_ || !chunked_) {
       return boost::beast::http::error::bad_transfer_encoding;
     }
-    std::string block;
+    sse_parser parser;
+    // Partial line carried over to the next piece of the body
+    std::string pending;
+    std::deque<server_sent_event> ready;
     parser_.body_limit(std::numeric_limits<std::uint64_t>::max());
     parser_.get().keep_alive(true);
     parser_.eager(true);
-    auto on_chunk_header =
-        [&block](uint64_t size, boost::core::string_view extensions,
-                 boost::beast::error_code &ec) { block.reserve(size); };
-    auto on_chunk_body = [&tx, yield, &block,
+    auto on_chunk_header = [](uint64_t size,
+                              boost::core::string_view extensions,
+                              boost::beast::error_code &ec) {};
+    auto on_chunk_body = [&ready, &parser, &pending,
                           this](uint64_t remain, boost::core::string_view body,
                                 boost::beast::error_code &ec) {
-      block.append(body);
-      if (body.size() == remain) {
-        if (!boost::core::string_view{block}.ends_with("\n\n")) {
-          return body.length();
-        }
-        auto message = parse_sse_block(block);
-        if (!message.has_value()) {
-          return body.length();
-        }
-        block.clear();
-        // tx.async_send(ec, std::move(message), yield[ec]);
-        tx.try_send(ec, std::move(message.value()));
+      auto on_event = [&ready](server_sent_event &&event) {
+        ready.push_back(std::move(event));
+        return true;
+      };
+      if (pending.empty() && !decoder_) {
+        // Complete lines are parsed right out of the read buffer
+        const std::string_view data{body.data(), body.size()};
+        pending.assign(data.substr(parser.parse(data, on_event)));
+        return body.length();
+      }
+      if (!append_body(body, pending, ec)) {
+        return body.length();
       }
+      pending.erase(0, parser.parse(pending, on_event));
       return body.length();
     };
-    return read_chunked_encoding(on_chunk_header, on_chunk_body, yield);
+    return read_chunked_encoding(on_chunk_header, on_chunk_body, ready, tx,
+                                 yield);
+  }
+
+  // SSE without chunked encoding, the body runs until the server closes the
+  // connection. Events are parsed in place in the read buffer, compressed
+  // bodies are decoded into a separate buffer first.
+  inline boost::outcome_v2::result<void> read_plain_sse(
+      boost::asio::experimental::channel<void(boost::system::error_code,
+                                              server_sent_event)> &tx,
+      boost::asio::yield_context yield) {
+    static constexpr std::size_t read_size = 8192;
+    sse_parser parser;
+    std::string text;
+    auto on_event = [&tx, &yield, this](server_sent_event &&event) {
+      ec_ = deliver(tx, std::move(event), yield);
+      return !ec_;
+    };
+    // Body bytes read together with the header are parsed first
+    while (true) {
+      const std::string_view data{
+          static_cast<const char *>(buffer_.data().data()), buffer_.size()};
+      if (decoder_) {
+        if (auto decoded = decoder_->decode(data, text); decoded.has_error()) {
+          ec_ = decoded.error();
+          return ec_;
+        }
+        buffer_.consume(buffer_.size());
+        text.erase(0, parser.parse(text, on_event));
+      } else {
+        buffer_.consume(parser.parse(data, on_event));
+      }
+      if (ec_) {
+        return ec_;
+      }
+      const auto bytes = connection_->with_stream([&](auto &stream) {
+        return stream.async_read_some(buffer_.prepare(read_size), yield[ec_]);
+      });
+      buffer_.commit(bytes);
+      if (ec_ == boost::asio::error::eof) {
+        done_ = true;
+        ec_ = {};
+        return boost::outcome_v2::success();
+      }
+      if (ec_) {
+        return ec_;
+      }
+    }
+  }
+
+  // Appends a piece of the raw body to `out`, decoded when the response is
+  // compressed
+  inline bool append_body(boost::core::string_view body, std::string &out,
+                          boost::beast::error_code &ec) {
+    if (!decoder_) {
+      out.append(body.data(), body.size());
+      return true;
+    }
+    if (auto decoded =
+            decoder_->decode(std::string_view(body.data(), body.size()), out);
+        decoded.has_error()) {
+      ec = decoded.error();
+      return false;
+    }
+    return true;
+  }
+
+  // Replaces a complete raw body with its decoded form, bodies that are
+  // neither strings nor dynamic buffers are left as they are
+  inline boost::outcome_v2::result<void> decode_body(value_type &body) {
+    std::string decoded;
+    if constexpr (std::is_same_v<value_type, std::string>) {
+      if (auto result = decoder_->decode(body, decoded); result.has_error()) {
+        return result.error();
+      }
+      body = std::move(decoded);
+    } else if constexpr (boost::beast::is_dynamic_buffer<value_type>::value) {
+      for (const auto piece : boost::beast::buffers_range_ref(body.data())) {
+        if (auto result = decoder_->decode(
+                std::string_view(static_cast<const char *>(piece.data()),
+                                 piece.size()),
+                decoded);
+            result.has_error()) {
+          return result.error();
+        }
+      }
+      body.consume(body.size());
+      body.commit(boost::asio::buffer_copy(body.prepare(decoded.size()),
+                                           boost::asio::buffer(decoded)));
+    }
+    return boost::outcome_v2::success();
+  }
+
+  // Header of the response, it moves to the streaming parser with the body
+  inline const boost::beast::http::response_header<> &head() const {
+    return stream_parser_ ? stream_parser_->get().base()
+                          : parser_.get().base();
+  }
+
+  // Reads undecoded body bytes into `buffer` through a buffer_body parser,
+  // which takes over from parser_ on first use
+  inline boost::outcome_v2::result<std::size_t>
+  read_raw(boost::asio::mutable_buffer buffer,
+           boost::asio::yield_context yield) {
+    if (done_) {
+      return boost::asio::error::eof;
+    }
+    if (sse_) {
+      return boost::beast::http::error::bad_transfer_encoding;
+    }
+    if (!stream_parser_) {
+      try {
+        stream_parser_.emplace(std::move(parser_));
+      } catch (const std::invalid_argument &) {
+        // read() or a chunk reader already started on the body
+        return boost::beast::http::error::bad_transfer_encoding;
+      }
+      stream_parser_->body_limit(std::numeric_limits<std::uint64_t>::max());
+    }
+    auto &body = stream_parser_->get().body();
+    body.data = buffer.data();
+    body.size = buffer.size();
+    connection_->with_stream([&](auto &stream) {
+      boost::beast::http::async_read(stream, buffer_, *stream_parser_,
+                                     yield[ec_]);
+    });
+    if (ec_ == boost::beast::http::error::need_buffer) {
+      ec_ = {};
+    }
+    if (ec_) {
+      return ec_;
+    }
+    const auto bytes = buffer.size() - body.size;
+    if (stream_parser_->is_done()) {
+      done_ = true;
+      release_if_done();
+    }
+    return bytes;
   }
 
 private:
-  std::unique_ptr<boost::beast::tcp_stream> stream_;
-  std::unique_ptr<boost::asio::ssl::stream<boost::beast::tcp_stream>>
-      ssl_stream_;
+  // A connection may only be reused once its response was read exactly to
+  // the end and neither side asked to close it
+  inline void release_if_done() {
+    const bool is_done =
+        stream_parser_ ? stream_parser_->is_done() : parser_.is_done();
+    const bool keep_alive =
+        stream_parser_ ? stream_parser_->keep_alive() : parser_.keep_alive();
+    if (!connection_ || !connection_->pool() || ec_ || !is_done ||
+        !keep_alive || buffer_.size() != 0) {
+      return;
+    }
+    auto pool = connection_->pool();
+    pool->release(std::move(connection_));
+    done_ = true;
+  }
+
+  std::unique_ptr<connection> connection_;
+  bool reused_;
   boost::beast::flat_buffer buffer_;
   boost::beast::http::response_parser<Body> parser_;
+  std::optional<
+      boost::beast::http::response_parser<boost::beast::http::buffer_body>>
+      stream_parser_;
   boost::beast::error_code ec_;
   bool done_;
   bool sse_ = false;
   bool chunked_ = false;
+  bool decompress_ = false;
+  std::unique_ptr<decompressor> decoder_;
+  std::chrono::nanoseconds blocked_{0};
+  request_timing timing_;
+  // Decoded bytes read_some() could not hand out yet
+  std::string decoded_;
+  std::size_t decoded_offset_{0};
+  // Raw bytes read_some() has not decoded yet, and whether the decoder may
+  // hold output that did not fit the last piece
+  std::size_t scratch_offset_{0};
+  std::size_t scratch_size_{0};
+  bool decoder_full_{false};
+  std::string scratch_;
 };
 } // namespace cpp_http::client
@@ -0,0 +1,134 @@
+#pragma once
+#include <boost/asio/error.hpp>
+#include <boost/beast/core/error.hpp>
+#include <boost/beast/http/error.hpp>
+#include <boost/system/detail/error_code.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <random>
+
+namespace cpp_http::client {
+struct retry_policy {
+  // Further attempts after a failed one, zero disables retries
+  unsigned max_retries{0};
+  // The wait before retry n is drawn uniformly from zero to
+  // min(max_backoff, base_backoff * 2^n), "full jitter"
+  std::chrono::milliseconds base_backoff{25};
+  std::chrono::milliseconds max_backoff{1000};
+};
+
+struct retry_budget_options {
+  // Retries and hedges allowed per request, 0.1 adds at most 10% load
+  double ratio{0.1};
+  // Allowance that refills with time, so a quiet client can still retry
+  double min_per_second{10};
+  // Most tokens that can be saved up for a burst of failures
+  double max_balance{100};
+};
+
+struct retry_budget_stats {
+  std::uint64_t allowed{0};
+  std::uint64_t rejected{0};
+};
+
+/**
+ * Process-wide limit on retries and hedged requests.
+ *
+ * Every request deposits `ratio` tokens, every retry or hedge has to take
+ * out a whole one. When a backend fails for everybody, retries stop at a
+ * fixed share of the traffic instead of multiplying it.
+ */
+class retry_budget {
+  using clock = std::chrono::steady_clock;
+
+  retry_budget_options options_;
+  std::mutex mutex_;
+  double balance_;
+  clock::time_point refilled_{clock::now()};
+  std::atomic<std::uint64_t> allowed_{0};
+  std::atomic<std::uint64_t> rejected_{0};
+
+public:
+  explicit retry_budget(retry_budget_options options = {})
+      : options_(options), balance_(options.min_per_second) {}
+  retry_budget(const retry_budget &) = delete;
+  retry_budget &operator=(const retry_budget &) = delete;
+
+  void record_request() {
+    std::lock_guard lock{mutex_};
+    balance_ = std::min(balance_ + options_.ratio, options_.max_balance);
+  }
+
+  // Takes a token for one retry or hedge, false when the budget is spent
+  [[nodiscard]] bool try_withdraw() {
+    {
+      std::lock_guard lock{mutex_};
+      const auto now = clock::now();
+      const std::chrono::duration<double> elapsed = now - refilled_;
+      refilled_ = now;
+      balance_ = std::min(balance_ + elapsed.count() * options_.min_per_second,
+                          options_.max_balance);
+      if (balance_ >= 1) {
+        balance_ -= 1;
+        allowed_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+    rejected_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  [[nodiscard]] retry_budget_stats stats() const {
+    return {allowed_.load(std::memory_order_relaxed),
+            rejected_.load(std::memory_order_relaxed)};
+  }
+};
+
+// Shared by every request that does not bring its own budget
+inline const std::shared_ptr<retry_budget> &default_retry_budget() {
+  static const auto budget = std::make_shared<retry_budget>();
+  return budget;
+}
+
+inline std::chrono::milliseconds backoff_delay(const retry_policy &policy,
+                                               unsigned retry) {
+  thread_local std::minstd_rand random{std::random_device{}()};
+  const auto ceiling = std::min<std::chrono::milliseconds::rep>(
+      policy.max_backoff.count(),
+      policy.base_backoff.count() << std::min(retry, 20U));
+  if (ceiling <= 0) {
+    return std::chrono::milliseconds{0};
+  }
+  return std::chrono::milliseconds{
+      std::uniform_int_distribution<std::chrono::milliseconds::rep>{
+          0, ceiling}(random)};
+}
+
+// Failures before any byte of the request reached the server, every
+// method may be sent again
+inline bool is_connect_error(const boost::system::error_code &ec) {
+  return ec == boost::asio::error::connection_refused ||
+         ec == boost::asio::error::host_unreachable ||
+         ec == boost::asio::error::network_unreachable ||
+         ec == boost::asio::error::network_down;
+}
+
+// Failures worth another attempt, requests that may have been processed
+// are only repeated when they are idempotent
+inline bool is_retryable(const boost::system::error_code &ec,
+                         bool idempotent) {
+  if (is_connect_error(ec)) {
+    return true;
+  }
+  return idempotent && (ec == boost::asio::error::connection_reset ||
+                        ec == boost::asio::error::eof ||
+                        ec == boost::asio::error::broken_pipe ||
+                        ec == boost::asio::error::timed_out ||
+                        ec == boost::beast::error::timeout ||
+                        ec == boost::beast::http::error::end_of_stream);
+}
+} // namespace cpp_http::client
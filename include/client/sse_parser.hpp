@@ -0,0 +1,113 @@
+#pragma once
+#include "message.hpp"
+#include "simd.hpp"
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+namespace cpp_http::client {
+/**
+ * Incremental text/event-stream parser.
+ *
+ * parse() scans its input in place and consumes every complete line, a
+ * trailing partial line is left to the caller, who passes it again with
+ * more bytes appended. Lines may end in CRLF, LF or CR, even when a CRLF is
+ * split between two calls. Only field values are copied, into the event
+ * that is handed out on each blank line.
+ */
+class sse_parser {
+public:
+  // Calls `on_event(server_sent_event &&)` for each complete event and stops
+  // early when it returns false. Returns the number of bytes consumed.
+  template <class OnEvent>
+  std::size_t parse(std::string_view data, OnEvent &&on_event) {
+    std::size_t pos = 0;
+    if (skip_lf_ && !data.empty()) {
+      skip_lf_ = false;
+      if (data.front() == '\n') {
+        pos = 1;
+      }
+    }
+    while (pos < data.size()) {
+      const auto end = simd::find_any<'\r', '\n'>(data, pos);
+      if (end == std::string_view::npos) {
+        break;
+      }
+      const auto line = data.substr(pos, end - pos);
+      pos = end + 1;
+      if (data[end] == '\r') {
+        if (pos == data.size()) {
+          skip_lf_ = true;
+        } else if (data[pos] == '\n') {
+          ++pos;
+        }
+      }
+      if (!line.empty()) {
+        parse_line(line, event_);
+        continue;
+      }
+      if (!event_.valid()) {
+        continue;
+      }
+      auto event = std::exchange(event_, server_sent_event{});
+      if (!on_event(std::move(event))) {
+        break;
+      }
+    }
+    return pos;
+  }
+
+  // Drops a partially parsed event, e.g. when the stream reconnects
+  void reset() {
+    event_ = server_sent_event{};
+    skip_lf_ = false;
+  }
+
+  // Applies one line without its line ending to `event`
+  static void parse_line(std::string_view line, server_sent_event &event) {
+    const auto colon = line.find(':');
+    if (colon == 0) {
+      // Comment, often sent as a keep-alive
+      return;
+    }
+    auto field = line.substr(0, colon);
+    std::string_view value;
+    if (colon != std::string_view::npos) {
+      value = line.substr(colon + 1);
+      if (!value.empty() && value.front() == ' ') {
+        value.remove_prefix(1);
+      }
+    }
+    if (field == "data") {
+      if (!event.data.has_value()) {
+        event.data.emplace(value);
+      } else {
+        event.data->append("\n").append(value);
+      }
+    } else if (field == "event") {
+      event.event.emplace(value);
+    } else if (field == "id") {
+      // Ids containing NUL are ignored by the spec
+      if (value.find('\0') == std::string_view::npos) {
+        event.id.emplace(value);
+      }
+    } else if (field == "retry") {
+      std::uint64_t retry{};
+      const auto [end, ec] =
+          std::from_chars(value.data(), value.data() + value.size(), retry);
+      if (ec == std::errc{} && end == value.data() + value.size()) {
+        event.retry = retry;
+      }
+    }
+  }
+
+private:
+  server_sent_event event_;
+  // The last input ended in CR, a LF right after it belongs to that line
+  // ending
+  bool skip_lf_{false};
+};
+} // namespace cpp_http::client
@@ -0,0 +1,115 @@
+#pragma once
+#include <boost/system/detail/error_code.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace cpp_http::client {
+/**
+ * Where the time of one request went, from steady_clock readings taken
+ * between its phases.
+ *
+ * Phases that did not run, such as DNS, connect and TLS on a reused
+ * connection, keep a zero time point and report a zero duration. With
+ * redirects the record describes the last hop.
+ */
+struct request_timing {
+  using clock = std::chrono::steady_clock;
+
+  clock::time_point start{};
+  // A pooled connection or free slot was handed out
+  clock::time_point checked_out{};
+  clock::time_point resolved{};
+  clock::time_point connected{};
+  clock::time_point tls_done{};
+  clock::time_point request_written{};
+  clock::time_point header_received{};
+  std::uint64_t redirects{0};
+  bool reused_connection{false};
+  bool tls_resumed{false};
+  bool http2{false};
+
+  static clock::duration between(clock::time_point from,
+                                 clock::time_point to) {
+    if (from == clock::time_point{} || to == clock::time_point{}) {
+      return clock::duration::zero();
+    }
+    return to - from;
+  }
+
+  [[nodiscard]] clock::duration pool_wait() const {
+    return between(start, checked_out);
+  }
+  [[nodiscard]] clock::duration dns() const {
+    return between(checked_out, resolved);
+  }
+  [[nodiscard]] clock::duration connect() const {
+    return between(resolved, connected);
+  }
+  [[nodiscard]] clock::duration tls() const {
+    return between(connected, tls_done);
+  }
+  // From a usable connection to the last request byte handed to the socket
+  [[nodiscard]] clock::duration write() const {
+    const auto ready = tls_done != clock::time_point{}    ? tls_done
+                       : connected != clock::time_point{} ? connected
+                                                          : checked_out;
+    return between(ready, request_written);
+  }
+  // Server think time plus one round trip
+  [[nodiscard]] clock::duration wait() const {
+    return between(request_written, header_received);
+  }
+  [[nodiscard]] clock::duration total() const {
+    return between(start, header_received);
+  }
+};
+
+using timing_observer = std::function<void(const request_timing &,
+                                           const boost::system::error_code &)>;
+
+namespace detail {
+struct timing_observer_slot {
+  std::atomic<bool> installed{false};
+  std::mutex mutex;
+  std::shared_ptr<const timing_observer> observer;
+};
+
+inline timing_observer_slot &observer_slot() {
+  static timing_observer_slot slot;
+  return slot;
+}
+} // namespace detail
+
+// Installs a process-wide callback run after every request attempt, on the
+// thread that ran it, null removes it. Requests cost one relaxed load
+// while none is installed.
+inline void set_timing_observer(timing_observer observer) {
+  auto &slot = detail::observer_slot();
+  std::lock_guard lock{slot.mutex};
+  slot.observer = observer ? std::make_shared<const timing_observer>(
+                                 std::move(observer))
+                           : nullptr;
+  slot.installed.store(slot.observer != nullptr, std::memory_order_release);
+}
+
+inline void notify_timing_observer(const request_timing &timing,
+                                   const boost::system::error_code &ec) {
+  auto &slot = detail::observer_slot();
+  if (!slot.installed.load(std::memory_order_acquire)) {
+    return;
+  }
+  std::shared_ptr<const timing_observer> observer;
+  {
+    std::lock_guard lock{slot.mutex};
+    observer = slot.observer;
+  }
+  if (observer) {
+    (*observer)(timing, ec);
+  }
+}
+} // namespace cpp_http::client
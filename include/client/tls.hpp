@@ -0,0 +1,201 @@
+#pragma once
+#include <boost/asio/ssl/context.hpp>
+#include <boost/asio/ssl/verify_mode.hpp>
+#include <boost/outcome/result.hpp>
+#include <boost/system/detail/error_code.hpp>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <openssl/ssl.h>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace cpp_http::client {
+struct tls_options {
+  bool verify_peer{true};
+  // Trust anchors, the system defaults when both are empty
+  std::string ca_file;
+  std::string ca_path;
+  // Sessions kept for resumption, zero disables resumption
+  std::size_t max_sessions{1024};
+};
+
+struct tls_stats {
+  std::uint64_t full_handshakes{0};
+  std::uint64_t resumed_handshakes{0};
+};
+
+/**
+ * Client TLS context with a session cache keyed by host and port.
+ *
+ * prepare() offers the last session of the origin to a new connection
+ * before its handshake, so repeat connections skip the certificate
+ * exchange and key agreement. Sessions are collected from OpenSSL's
+ * new-session callback, which also delivers TLS 1.3 tickets arriving after
+ * the handshake. TLS 1.3 tickets are used once, as RFC 8446 recommends.
+ */
+class tls_context {
+  boost::asio::ssl::context context_{boost::asio::ssl::context::tls_client};
+  tls_options options_;
+  std::mutex mutex_;
+  std::unordered_map<std::string, SSL_SESSION *> sessions_;
+  std::atomic<std::uint64_t> full_{0};
+  std::atomic<std::uint64_t> resumed_{0};
+
+  struct private_tag {};
+
+  // SSL ex_data slot holding the origin of a connection, owned by the SSL
+  static int origin_index() {
+    static const int index = SSL_get_ex_new_index(
+        0, nullptr, nullptr, nullptr,
+        [](void *, void *origin, CRYPTO_EX_DATA *, int, long, void *) {
+          delete static_cast<std::string *>(origin);
+        });
+    return index;
+  }
+
+  // SSL_CTX ex_data slot pointing back to the tls_context. It holds a
+  // weak_ptr owned by the SSL_CTX, which outlives the tls_context as long
+  // as pooled connections use it. The app data slot is taken by Asio.
+  static int context_index() {
+    static const int index = SSL_CTX_get_ex_new_index(
+        0, nullptr, nullptr, nullptr,
+        [](void *, void *owner, CRYPTO_EX_DATA *, int, long, void *) {
+          delete static_cast<std::weak_ptr<tls_context> *>(owner);
+        });
+    return index;
+  }
+
+  static int on_new_session(SSL *ssl, SSL_SESSION *session) {
+    const auto *owner = static_cast<const std::weak_ptr<tls_context> *>(
+        SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), context_index()));
+    const auto *origin =
+        static_cast<const std::string *>(SSL_get_ex_data(ssl, origin_index()));
+    // A ticket arriving after the tls_context was destroyed is dropped
+    const auto self = owner ? owner->lock() : nullptr;
+    if (self == nullptr || origin == nullptr ||
+        !SSL_SESSION_is_resumable(session)) {
+      return 0;
+    }
+    SSL_SESSION *replaced = nullptr;
+    {
+      std::lock_guard lock{self->mutex_};
+      auto found = self->sessions_.find(*origin);
+      if (found == self->sessions_.end()) {
+        if (self->sessions_.size() >= self->options_.max_sessions) {
+          replaced = self->sessions_.begin()->second;
+          self->sessions_.erase(self->sessions_.begin());
+        }
+        self->sessions_.emplace(*origin, session);
+      } else {
+        replaced = found->second;
+        found->second = session;
+      }
+    }
+    if (replaced != nullptr) {
+      SSL_SESSION_free(replaced);
+    }
+    // The cache keeps the reference OpenSSL handed over
+    return 1;
+  }
+
+public:
+  tls_context(private_tag, tls_options options) : options_(std::move(options)) {
+    auto *native = context_.native_handle();
+    SSL_CTX_set_min_proto_version(native, TLS1_2_VERSION);
+    context_.set_verify_mode(options_.verify_peer
+                                 ? boost::asio::ssl::verify_peer
+                                 : boost::asio::ssl::verify_none);
+    if (options_.max_sessions > 0) {
+      SSL_CTX_set_session_cache_mode(native, SSL_SESS_CACHE_CLIENT |
+                                                 SSL_SESS_CACHE_NO_INTERNAL);
+      SSL_CTX_sess_set_new_cb(native, &tls_context::on_new_session);
+    }
+  }
+  tls_context(const tls_context &) = delete;
+  tls_context &operator=(const tls_context &) = delete;
+
+  ~tls_context() {
+    SSL_CTX_sess_set_new_cb(context_.native_handle(), nullptr);
+    for (auto &[origin, session] : sessions_) {
+      SSL_SESSION_free(session);
+    }
+  }
+
+  // Fails only when an explicitly configured trust anchor cannot be loaded
+  static boost::outcome_v2::result<std::shared_ptr<tls_context>>
+  create(tls_options options = {}) {
+    auto context = std::make_shared<tls_context>(private_tag{}, options);
+    if (options.max_sessions > 0) {
+      SSL_CTX_set_ex_data(context->context_.native_handle(), context_index(),
+                          new std::weak_ptr<tls_context>(context));
+    }
+    boost::system::error_code ec;
+    if (options.ca_file.empty() && options.ca_path.empty()) {
+      // A missing system trust store shows up as verification failures
+      context->context_.set_default_verify_paths(ec);
+      return context;
+    }
+    if (!options.ca_file.empty()) {
+      context->context_.load_verify_file(options.ca_file, ec);
+    }
+    if (!ec && !options.ca_path.empty()) {
+      context->context_.add_verify_path(options.ca_path, ec);
+    }
+    if (ec) {
+      return ec;
+    }
+    return context;
+  }
+
+  boost::asio::ssl::context &context() { return context_; }
+
+  // Tags `ssl` with its origin and offers a cached session for it, call
+  // before the handshake
+  void prepare(SSL *ssl, const std::string &origin) {
+    if (options_.max_sessions == 0) {
+      return;
+    }
+    SSL_set_ex_data(ssl, origin_index(), new std::string(origin));
+    SSL_SESSION *session = nullptr;
+    {
+      std::lock_guard lock{mutex_};
+      const auto found = sessions_.find(origin);
+      if (found == sessions_.end()) {
+        return;
+      }
+      session = found->second;
+      if (SSL_SESSION_get_protocol_version(session) >= TLS1_3_VERSION) {
+        sessions_.erase(found);
+      } else {
+        SSL_SESSION_up_ref(session);
+      }
+    }
+    SSL_set_session(ssl, session);
+    SSL_SESSION_free(session);
+  }
+
+  // Counts a completed handshake as resumed or full
+  void handshake_done(SSL *ssl) {
+    if (SSL_session_reused(ssl)) {
+      resumed_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      full_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  [[nodiscard]] tls_stats stats() const {
+    return {full_.load(std::memory_order_relaxed),
+            resumed_.load(std::memory_order_relaxed)};
+  }
+};
+
+// Shared by every request that does not bring its own context
+inline const std::shared_ptr<tls_context> &default_tls_context() {
+  static const auto context = tls_context::create().value();
+  return context;
+}
+} // namespace cpp_http::client
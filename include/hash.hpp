@@ -0,0 +1,190 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace cpp_http {
+namespace detail {
+inline constexpr std::uint64_t hash_prime64_1 = 0x9E3779B185EBCA87ULL;
+inline constexpr std::uint64_t hash_prime64_2 = 0xC2B2AE3D27D4EB4FULL;
+inline constexpr std::uint64_t hash_prime32_1 = 0x9E3779B1U;
+
+// 8 lanes of 8 bytes per stripe, 16 stripes per scrambled block
+inline constexpr std::size_t hash_stripe = 64;
+inline constexpr std::size_t hash_block = 16 * hash_stripe;
+
+inline constexpr std::array<std::uint64_t, 24> hash_secret = [] {
+  std::array<std::uint64_t, 24> secret{};
+  std::uint64_t state = hash_prime64_2;
+  for (auto &word : secret) {
+    state += 0x9E3779B97F4A7C15ULL;
+    std::uint64_t z = state;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    word = z ^ (z >> 31);
+  }
+  return secret;
+}();
+
+inline std::uint64_t read64(const unsigned char *p) {
+  std::uint64_t value;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+inline std::uint32_t read32(const unsigned char *p) {
+  std::uint32_t value;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+inline std::uint64_t fold_mul(std::uint64_t a, std::uint64_t b) {
+  const auto product = static_cast<unsigned __int128>(a) * b;
+  return static_cast<std::uint64_t>(product) ^
+         static_cast<std::uint64_t>(product >> 64);
+}
+
+inline std::uint64_t avalanche(std::uint64_t h) {
+  h ^= h >> 37;
+  h *= 0x165667919E3779F9ULL;
+  return h ^ (h >> 32);
+}
+
+inline std::uint64_t mix16(const unsigned char *p, const std::uint64_t *secret,
+                           std::uint64_t seed) {
+  return fold_mul(read64(p) ^ (secret[0] + seed),
+                  read64(p + 8) ^ (secret[1] - seed));
+}
+
+// acc[i] += data[i ^ 1] + lo32(k) * hi32(k) with k = data[i] ^ secret[i],
+// the 32x32 multiplies map onto pmuludq
+inline void accumulate_stripe(std::uint64_t *acc, const unsigned char *p,
+                              const std::uint64_t *secret) {
+#if defined(__AVX2__)
+  for (std::size_t i = 0; i < 8; i += 4) {
+    const auto data =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i * 8));
+    const auto key =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(secret + i));
+    const auto mixed = _mm256_xor_si256(data, key);
+    const auto product = _mm256_mul_epu32(
+        mixed, _mm256_shuffle_epi32(mixed, _MM_SHUFFLE(0, 3, 0, 1)));
+    const auto swapped = _mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+    auto *lanes = reinterpret_cast<__m256i *>(acc + i);
+    _mm256_storeu_si256(
+        lanes, _mm256_add_epi64(_mm256_loadu_si256(lanes),
+                                _mm256_add_epi64(product, swapped)));
+  }
+#elif defined(__SSE2__)
+  for (std::size_t i = 0; i < 8; i += 2) {
+    const auto data =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i * 8));
+    const auto key =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(secret + i));
+    const auto mixed = _mm_xor_si128(data, key);
+    const auto product =
+        _mm_mul_epu32(mixed, _mm_shuffle_epi32(mixed, _MM_SHUFFLE(0, 3, 0, 1)));
+    const auto swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+    auto *lanes = reinterpret_cast<__m128i *>(acc + i);
+    _mm_storeu_si128(lanes,
+                     _mm_add_epi64(_mm_loadu_si128(lanes),
+                                   _mm_add_epi64(product, swapped)));
+  }
+#else
+  for (std::size_t i = 0; i < 8; ++i) {
+    const auto data = read64(p + i * 8);
+    const auto mixed = data ^ secret[i];
+    acc[i ^ 1] += data;
+    acc[i] += (mixed & 0xFFFFFFFFU) * (mixed >> 32);
+  }
+#endif
+}
+
+inline void scramble(std::uint64_t *acc, const std::uint64_t *secret) {
+  for (std::size_t i = 0; i < 8; ++i) {
+    acc[i] = ((acc[i] ^ (acc[i] >> 47)) ^ secret[i]) * hash_prime32_1;
+  }
+}
+
+inline std::uint64_t hash_long(const unsigned char *p, std::size_t size,
+                               std::uint64_t seed) {
+  std::uint64_t acc[8] = {hash_prime32_1, hash_prime64_1, hash_prime64_2,
+                          seed,           hash_prime64_2, hash_prime32_1,
+                          hash_prime64_1, ~seed};
+  const auto *secret = hash_secret.data();
+  std::size_t offset = 0;
+  for (; offset + hash_block <= size; offset += hash_block) {
+    for (std::size_t stripe = 0; stripe < 16; ++stripe) {
+      accumulate_stripe(acc, p + offset + stripe * hash_stripe,
+                        secret + stripe);
+    }
+    scramble(acc, secret + 16);
+  }
+  for (std::size_t stripe = 0; offset + hash_stripe < size;
+       offset += hash_stripe, ++stripe) {
+    accumulate_stripe(acc, p + offset, secret + stripe);
+  }
+  // The last stripe overlaps the previous one when size is not a multiple
+  accumulate_stripe(acc, p + size - hash_stripe, secret + 16);
+
+  std::uint64_t result = size * hash_prime64_1 + seed;
+  for (std::size_t i = 0; i < 8; i += 2) {
+    result += fold_mul(acc[i] ^ secret[i + 3], acc[i + 1] ^ secret[i + 4]);
+  }
+  return avalanche(result);
+}
+} // namespace detail
+
+// 64-bit non-cryptographic hash in the style of XXH3: inputs longer than 128
+// bytes are consumed in 64 byte stripes across eight accumulators with SSE2
+// or AVX2 when the target supports them. Values are stable across builds but
+// do not match the reference XXH3 output.
+inline std::uint64_t hash64(const void *data, std::size_t size,
+                            std::uint64_t seed = 0) {
+  const auto *p = static_cast<const unsigned char *>(data);
+  const auto *secret = detail::hash_secret.data();
+  if (size > 128) {
+    return detail::hash_long(p, size, seed);
+  }
+  if (size > 16) {
+    std::uint64_t acc = size * detail::hash_prime64_1 + seed;
+    std::size_t offset = 0;
+    for (std::size_t i = 0; offset + 16 < size; offset += 16, i += 2) {
+      acc += detail::mix16(p + offset, secret + i, seed);
+    }
+    acc += detail::mix16(p + size - 16, secret + 16, seed);
+    return detail::avalanche(acc);
+  }
+  if (size >= 8) {
+    const auto low = detail::read64(p) ^ (secret[0] + seed);
+    const auto high = detail::read64(p + size - 8) ^ (secret[1] - seed);
+    return detail::avalanche(size + detail::fold_mul(low, high));
+  }
+  if (size >= 4) {
+    const auto combined =
+        (static_cast<std::uint64_t>(detail::read32(p)) << 32) |
+        detail::read32(p + size - 4);
+    return detail::avalanche(
+        detail::fold_mul(combined ^ (secret[2] + seed),
+                         detail::hash_prime64_1 + size));
+  }
+  if (size > 0) {
+    const std::uint64_t combined = (static_cast<std::uint64_t>(p[0]) << 16) |
+                                   (static_cast<std::uint64_t>(p[size >> 1])
+                                    << 8) |
+                                   p[size - 1] | (size << 24);
+    return detail::avalanche((combined ^ secret[3]) * detail::hash_prime64_1 +
+                             seed);
+  }
+  return detail::avalanche(seed ^ secret[4]);
+}
+
+inline std::uint64_t hash64(std::string_view data, std::uint64_t seed = 0) {
+  return hash64(data.data(), data.size(), seed);
+}
+} // namespace cpp_http
@@ -0,0 +1,125 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace cpp_http {
+namespace detail {
+inline constexpr std::array<std::string_view, 7> http_date_weekdays = {
+    "Thu", "Fri", "Sat", "Sun", "Mon", "Tue", "Wed"};
+inline constexpr std::array<std::string_view, 12> http_date_months = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+// Days since 1970-01-01 of a proleptic Gregorian date
+constexpr std::int64_t days_from_civil(std::int64_t y, unsigned m, unsigned d) {
+  y -= m <= 2;
+  const std::int64_t era = (y >= 0 ? y : y - 399) / 400;
+  const auto yoe = static_cast<unsigned>(y - era * 400);
+  const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + static_cast<std::int64_t>(doe) - 719468;
+}
+
+inline bool parse_digits(std::string_view text, std::size_t pos,
+                         std::size_t count, unsigned &out) {
+  if (pos + count > text.size()) {
+    return false;
+  }
+  out = 0;
+  for (std::size_t i = pos; i < pos + count; ++i) {
+    if (text[i] < '0' || text[i] > '9') {
+      return false;
+    }
+    out = out * 10 + static_cast<unsigned>(text[i] - '0');
+  }
+  return true;
+}
+} // namespace detail
+
+// IMF-fixdate as used by Date, Last-Modified and If-Modified-Since, e.g.
+// "Sun, 06 Nov 1994 08:49:37 GMT"
+inline std::string
+format_http_date(std::chrono::system_clock::time_point time) {
+  const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(
+                           time.time_since_epoch())
+                           .count();
+  auto days = seconds / 86400;
+  auto rest = seconds % 86400;
+  if (rest < 0) {
+    rest += 86400;
+    --days;
+  }
+  const auto weekday = ((days % 7) + 7) % 7;
+  // civil_from_days
+  const auto z = days + 719468;
+  const auto era = (z >= 0 ? z : z - 146096) / 146097;
+  const auto doe = static_cast<unsigned>(z - era * 146097);
+  const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  const unsigned mp = (5 * doy + 2) / 153;
+  const unsigned day = doy - (153 * mp + 2) / 5 + 1;
+  const unsigned month = mp < 10 ? mp + 3 : mp - 9;
+  const auto year = static_cast<std::int64_t>(yoe) + era * 400 + (month <= 2);
+
+  std::string out;
+  out.reserve(29);
+  const auto two = [&out](unsigned value) {
+    out += static_cast<char>('0' + value / 10);
+    out += static_cast<char>('0' + value % 10);
+  };
+  out += detail::http_date_weekdays[static_cast<std::size_t>(weekday)];
+  out += ", ";
+  two(day);
+  out += ' ';
+  out += detail::http_date_months[month - 1];
+  out += ' ';
+  out += std::to_string(year);
+  out += ' ';
+  two(static_cast<unsigned>(rest / 3600));
+  out += ':';
+  two(static_cast<unsigned>(rest / 60 % 60));
+  out += ':';
+  two(static_cast<unsigned>(rest % 60));
+  out += " GMT";
+  return out;
+}
+
+// Parses an IMF-fixdate. The obsolete RFC 850 and asctime forms are not
+// accepted, callers treat them like an absent header.
+inline std::optional<std::chrono::system_clock::time_point>
+parse_http_date(std::string_view text) {
+  // "Sun, 06 Nov 1994 08:49:37 GMT"
+  if (text.size() != 29 || text.substr(3, 2) != ", " || text[7] != ' ' ||
+      text[11] != ' ' || text[16] != ' ' || text[19] != ':' ||
+      text[22] != ':' || text.substr(25) != " GMT") {
+    return std::nullopt;
+  }
+  unsigned day = 0;
+  unsigned year = 0;
+  unsigned hour = 0;
+  unsigned minute = 0;
+  unsigned second = 0;
+  if (!detail::parse_digits(text, 5, 2, day) ||
+      !detail::parse_digits(text, 12, 4, year) ||
+      !detail::parse_digits(text, 17, 2, hour) ||
+      !detail::parse_digits(text, 20, 2, minute) ||
+      !detail::parse_digits(text, 23, 2, second)) {
+    return std::nullopt;
+  }
+  unsigned month = 0;
+  while (month < 12 && detail::http_date_months[month] != text.substr(8, 3)) {
+    ++month;
+  }
+  if (month == 12 || day < 1 || day > 31 || hour > 23 || minute > 59 ||
+      second > 60) {
+    return std::nullopt;
+  }
+  const auto days = detail::days_from_civil(year, month + 1, day);
+  return std::chrono::system_clock::time_point{std::chrono::seconds{
+      days * 86400 + hour * 3600 + minute * 60 + second}};
+}
+} // namespace cpp_http
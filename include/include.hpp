@@ -1,4 +1,6 @@
 #pragma once
+#include "client/batch.hpp"
 #include "client/client.hpp"
+#include "client/request_template.hpp"
 #include "server/server.hpp"
 #include "message.hpp"
\ No newline at end of file
@@ -0,0 +1,130 @@
+#pragma once
+#include <array>
+#include <boost/asio/buffer.hpp>
+#include <boost/beast/core/error.hpp>
+#include <boost/beast/http/message.hpp>
+#include <boost/json/monotonic_resource.hpp>
+#include <boost/json/serializer.hpp>
+#include <boost/json/storage_ptr.hpp>
+#include <boost/json/stream_parser.hpp>
+#include <boost/json/value.hpp>
+#include <boost/optional.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+
+namespace cpp_http {
+// A storage for one message's JSON value, every allocation of the value comes
+// from a single arena that is released with the last copy of the value
+inline boost::json::storage_ptr make_json_storage() {
+  return boost::json::make_shared_resource<boost::json::monotonic_resource>();
+}
+
+// application/json and structured syntax suffixes like
+// application/problem+json, parameters are ignored
+inline bool is_json_content_type(std::string_view content_type) {
+  auto media_type = content_type.substr(0, content_type.find(';'));
+  while (!media_type.empty() &&
+         (media_type.back() == ' ' || media_type.back() == '\t')) {
+    media_type.remove_suffix(1);
+  }
+  auto ends_with = [media_type](std::string_view suffix) {
+    if (media_type.size() < suffix.size()) {
+      return false;
+    }
+    const auto tail = media_type.substr(media_type.size() - suffix.size());
+    for (std::size_t i = 0; i < suffix.size(); ++i) {
+      const char c = tail[i];
+      if ((c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c) !=
+          suffix[i]) {
+        return false;
+      }
+    }
+    return true;
+  };
+  return ends_with("application/json") || ends_with("+json");
+}
+
+/**
+ * Beast Body holding a boost::json::value.
+ *
+ * The reader feeds bytes to a boost::json::stream_parser as they arrive, so
+ * the raw text is never buffered, and the parsed value lives in a per-message
+ * monotonic arena. The writer serializes the value in fixed-size pieces
+ * straight into the buffers beast hands to the socket, the body size is
+ * unknown up front so HTTP/1.1 messages go out chunked.
+ */
+struct json_body {
+  using value_type = boost::json::value;
+
+  class reader {
+    value_type &body_;
+    boost::json::stream_parser parser_;
+
+  public:
+    template <bool isRequest, class Fields>
+    explicit reader(boost::beast::http::header<isRequest, Fields> &,
+                    value_type &body)
+        : body_(body) {}
+
+    void init(const boost::optional<std::uint64_t> &,
+              boost::beast::error_code &ec) {
+      parser_.reset(make_json_storage());
+      ec = {};
+    }
+
+    template <class ConstBufferSequence>
+    std::size_t put(const ConstBufferSequence &buffers,
+                    boost::beast::error_code &ec) {
+      std::size_t consumed = 0;
+      for (auto it = boost::asio::buffer_sequence_begin(buffers);
+           it != boost::asio::buffer_sequence_end(buffers); ++it) {
+        const boost::asio::const_buffer buffer = *it;
+        consumed += parser_.write(static_cast<const char *>(buffer.data()),
+                                  buffer.size(), ec);
+        if (ec) {
+          break;
+        }
+      }
+      return consumed;
+    }
+
+    void finish(boost::beast::error_code &ec) {
+      parser_.finish(ec);
+      if (ec) {
+        return;
+      }
+      body_ = parser_.release();
+    }
+  };
+
+  class writer {
+    static constexpr std::size_t chunk_size = 4096;
+    boost::json::serializer serializer_;
+    std::array<char, chunk_size> chunk_{};
+
+  public:
+    using const_buffers_type = boost::asio::const_buffer;
+
+    template <bool isRequest, class Fields>
+    explicit writer(const boost::beast::http::header<isRequest, Fields> &,
+                    const value_type &body) {
+      serializer_.reset(&body);
+    }
+
+    void init(boost::beast::error_code &ec) { ec = {}; }
+
+    boost::optional<std::pair<const_buffers_type, bool>>
+    get(boost::beast::error_code &ec) {
+      ec = {};
+      if (serializer_.done()) {
+        return boost::none;
+      }
+      const auto piece = serializer_.read(chunk_.data(), chunk_.size());
+      return std::make_pair(const_buffers_type{piece.data(), piece.size()},
+                            !serializer_.done());
+    }
+  };
+};
+} // namespace cpp_http
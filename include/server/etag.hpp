@@ -0,0 +1,242 @@
+#pragma once
+#include "hash.hpp"
+#include "http_date.hpp"
+#include "server/errors.hpp"
+#include "server/middleware.hpp"
+#include "server/request.hpp"
+#include "server/response.hpp"
+#include "server/service.hpp"
+#include "server/util.hpp"
+#include <array>
+#include <boost/beast/http/empty_body.hpp>
+#include <boost/beast/http/field.hpp>
+#include <boost/beast/http/status.hpp>
+#include <boost/beast/http/verb.hpp>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace cpp_http::server {
+// Validators a service can produce without building the body
+struct resource_version {
+  // Quoted entity-tag, e.g. "\"v42\"" or "W/\"v42\""
+  std::string etag;
+  std::optional<std::chrono::system_clock::time_point> last_modified;
+};
+
+struct etag_options {
+  // Looked up before the wrapped service runs. When it returns a version the
+  // request is answered with 304 right away if it matches, otherwise the
+  // version is attached to the response and the body is not hashed.
+  std::function<std::optional<resource_version>(const request &)> version;
+};
+
+// Strong entity-tag over the body bytes
+inline std::string make_etag(std::string_view body) {
+  constexpr std::string_view hex = "0123456789abcdef";
+  auto value = hash64(body);
+  std::string etag(18, '"');
+  for (std::size_t i = 16; i > 0; --i, value >>= 4) {
+    etag[i] = hex[value & 0xF];
+  }
+  return etag;
+}
+
+// If-None-Match uses the weak comparison, W/ prefixes are ignored
+inline bool etag_list_matches(std::string_view if_none_match,
+                              std::string_view etag) {
+  const auto opaque = [](std::string_view tag) {
+    if (tag.size() > 2 && tag[0] == 'W' && tag[1] == '/') {
+      tag.remove_prefix(2);
+    }
+    return tag;
+  };
+  const auto target = opaque(etag);
+  std::size_t pos = 0;
+  while (pos < if_none_match.size()) {
+    const auto comma = if_none_match.find(',', pos);
+    auto candidate = if_none_match.substr(
+        pos, comma == std::string_view::npos ? std::string_view::npos
+                                             : comma - pos);
+    while (!candidate.empty() &&
+           (candidate.front() == ' ' || candidate.front() == '\t')) {
+      candidate.remove_prefix(1);
+    }
+    while (!candidate.empty() &&
+           (candidate.back() == ' ' || candidate.back() == '\t')) {
+      candidate.remove_suffix(1);
+    }
+    if (candidate == "*" || (!target.empty() && opaque(candidate) == target)) {
+      return true;
+    }
+    if (comma == std::string_view::npos) {
+      break;
+    }
+    pos = comma + 1;
+  }
+  return false;
+}
+
+// RFC 9110 13.2.2: If-None-Match wins over If-Modified-Since, which is only
+// looked at when the former is absent
+template <class Body, class Fields>
+inline bool
+is_not_modified(const boost::beast::http::request<Body, Fields> &req,
+                std::string_view etag,
+                std::optional<std::chrono::system_clock::time_point>
+                    last_modified) {
+  const auto if_none_match = req[boost::beast::http::field::if_none_match];
+  if (!if_none_match.empty()) {
+    return etag_list_matches(if_none_match, etag);
+  }
+  const auto if_modified_since =
+      req[boost::beast::http::field::if_modified_since];
+  if (if_modified_since.empty() || !last_modified.has_value()) {
+    return false;
+  }
+  const auto since = parse_http_date(if_modified_since);
+  return since.has_value() &&
+         std::chrono::floor<std::chrono::seconds>(*last_modified) <= *since;
+}
+
+// 304 carrying the fields RFC 9110 15.4.5 asks to repeat from the 200, and
+// its Connection field so the connection is kept or closed the same way
+template <class Body, class Fields>
+inline empty_response
+not_modified(const boost::beast::http::request<Body, Fields> &req,
+             const boost::beast::http::response_header<> &source) {
+  constexpr std::array<boost::beast::http::field, 8> kept = {
+      boost::beast::http::field::cache_control,
+      boost::beast::http::field::connection,
+      boost::beast::http::field::content_location,
+      boost::beast::http::field::date,
+      boost::beast::http::field::etag,
+      boost::beast::http::field::expires,
+      boost::beast::http::field::last_modified,
+      boost::beast::http::field::vary,
+  };
+  empty_response res{boost::beast::http::status::not_modified, req.version()};
+  res.set(boost::beast::http::field::server, server_agent());
+  for (const auto field : kept) {
+    const auto value = source[field];
+    if (!value.empty()) {
+      res.set(field, value);
+    }
+  }
+  return res;
+}
+
+/**
+ * Adds a strong ETag to successful GET and HEAD responses and answers
+ * matching If-None-Match / If-Modified-Since requests with a bodyless 304.
+ *
+ * In-memory bodies are serialized once into a response::shared_response
+ * and hashed, the same bytes are then written to the client. File and
+ * other streamed bodies pass through without an ETag. Services that know
+ * their version up front can skip building and hashing the body entirely
+ * through etag_options::version.
+ */
+class etag_service : public service {
+  etag_options options_;
+  std::unique_ptr<service> inner_;
+
+  static void set_validators(boost::beast::http::response_header<> &header,
+                             const resource_version &version) {
+    header.set(boost::beast::http::field::etag, version.etag);
+    if (version.last_modified.has_value()) {
+      header.set(boost::beast::http::field::last_modified,
+                 format_http_date(*version.last_modified));
+    }
+  }
+
+public:
+  explicit etag_service(etag_options options, std::unique_ptr<service> inner)
+      : options_(std::move(options)), inner_(std::move(inner)) {}
+  ~etag_service() override = default;
+
+  result<response>
+  handle_request(request &&request, boost::asio::yield_context yield) override {
+    const auto method = request.request_cref().method();
+    if (method != boost::beast::http::verb::get &&
+        method != boost::beast::http::verb::head) {
+      return inner_->handle_request(std::move(request), yield);
+    }
+
+    std::optional<resource_version> version;
+    if (options_.version) {
+      version = options_.version(request);
+    }
+    if (version.has_value() &&
+        is_not_modified(request.request_cref(), version->etag,
+                        version->last_modified)) {
+      boost::beast::http::response_header<> header;
+      set_validators(header, *version);
+      header.set(boost::beast::http::field::connection,
+                 request.request_cref().keep_alive() ? "keep-alive" : "close");
+      return response{not_modified(request.request_cref(), header)};
+    }
+
+    // The request is moved into the service, keep what the 304 needs
+    auto conditions =
+        boost::beast::http::request<boost::beast::http::empty_body>{
+            method, request.request_cref().target(),
+            request.request_cref().version()};
+    for (const auto field : {boost::beast::http::field::if_none_match,
+                             boost::beast::http::field::if_modified_since}) {
+      const auto value = request.request_cref()[field];
+      if (!value.empty()) {
+        conditions.set(field, value);
+      }
+    }
+
+    auto res = inner_->handle_request(std::move(request), yield);
+    if (res.has_error() ||
+        res.value().header_cref().result() != boost::beast::http::status::ok) {
+      return res;
+    }
+    if (version.has_value()) {
+      set_validators(res.value().header_ref(), *version);
+      return res;
+    }
+    if (!res.value().has_in_memory_body()) {
+      return res;
+    }
+
+    auto shared = std::move(res).value().share(
+        method == boost::beast::http::verb::head);
+    if (shared.has_error()) {
+      return shared.error();
+    }
+    auto &header = shared.value().header_ref();
+    if (header[boost::beast::http::field::etag].empty()) {
+      header.set(boost::beast::http::field::etag,
+                 make_etag(*shared.value().body_));
+    }
+    const auto last_modified =
+        parse_http_date(header[boost::beast::http::field::last_modified]);
+    if (is_not_modified(conditions, header[boost::beast::http::field::etag],
+                        last_modified)) {
+      return response{not_modified(conditions, header)};
+    }
+    return response{std::move(shared).value()};
+  }
+};
+
+class etag_middleware : public middleware {
+  etag_options options_;
+
+public:
+  explicit etag_middleware(etag_options options = {})
+      : options_(std::move(options)) {}
+  ~etag_middleware() override = default;
+
+  std::unique_ptr<service> layer(std::unique_ptr<service> service) override {
+    return std::make_unique<etag_service>(options_, std::move(service));
+  }
+};
+} // namespace cpp_http::server
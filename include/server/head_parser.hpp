@@ -0,0 +1,466 @@
+#pragma once
+#include "simd.hpp"
+#include <array>
+#include <boost/asio/error.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/beast/core/error.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/core/read_size.hpp>
+#include <boost/beast/http/error.hpp>
+#include <boost/beast/http/field.hpp>
+#include <boost/beast/http/message.hpp>
+#include <boost/beast/http/read.hpp>
+#include <boost/beast/http/string_body.hpp>
+#include <boost/beast/http/verb.hpp>
+#include <boost/outcome/result.hpp>
+#include <boost/outcome/success_failure.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+namespace cpp_http::server {
+// Selects how a server reads request heads off the wire
+enum class request_parser {
+  // boost::beast::http::async_read
+  beast,
+  // parse_request_head, handing anything it does not fully understand to
+  // beast so limits and errors stay identical
+  simd,
+};
+
+// Limits applied by both request parsers, defaults match
+// boost::beast::http::request_parser
+struct request_limits {
+  std::size_t header_limit{8 * 1024};
+  std::uint64_t body_limit{1024 * 1024};
+};
+
+namespace detail {
+constexpr std::array<bool, 256> make_tchar_table() {
+  std::array<bool, 256> table{};
+  for (int c = '0'; c <= '9'; ++c) {
+    table[c] = true;
+  }
+  for (int c = 'a'; c <= 'z'; ++c) {
+    table[c] = true;
+    table[c - 'a' + 'A'] = true;
+  }
+  for (const char c : std::string_view{"!#$%&'*+-.^_`|~"}) {
+    table[static_cast<unsigned char>(c)] = true;
+  }
+  return table;
+}
+inline constexpr std::array<bool, 256> tchar_table = make_tchar_table();
+
+inline constexpr bool is_tchar(char c) {
+  return tchar_table[static_cast<unsigned char>(c)];
+}
+
+struct known_field {
+  std::string_view name;
+  boost::beast::http::field field;
+};
+
+// Lower-cases letters, the only other byte in a known name is '-'
+constexpr unsigned fold(char c) {
+  return static_cast<unsigned>(static_cast<unsigned char>(c) | 0x20U);
+}
+
+constexpr std::size_t known_field_slots = 64;
+
+// Perfect hash over known_fields below, make_known_field_table fails to
+// compile if an edit to the list introduces a collision
+constexpr std::size_t known_field_hash(std::string_view name) {
+  const auto size = name.size();
+  return (size * 11 + fold(name[0]) * 47 + fold(name[size - 1]) * 40 +
+          fold(name[size / 2])) &
+         (known_field_slots - 1);
+}
+
+inline constexpr std::array<known_field, 34> known_fields{{
+    {"host", boost::beast::http::field::host},
+    {"user-agent", boost::beast::http::field::user_agent},
+    {"accept", boost::beast::http::field::accept},
+    {"accept-encoding", boost::beast::http::field::accept_encoding},
+    {"accept-language", boost::beast::http::field::accept_language},
+    {"accept-charset", boost::beast::http::field::accept_charset},
+    {"connection", boost::beast::http::field::connection},
+    {"content-length", boost::beast::http::field::content_length},
+    {"content-type", boost::beast::http::field::content_type},
+    {"content-encoding", boost::beast::http::field::content_encoding},
+    {"cookie", boost::beast::http::field::cookie},
+    {"authorization", boost::beast::http::field::authorization},
+    {"cache-control", boost::beast::http::field::cache_control},
+    {"if-none-match", boost::beast::http::field::if_none_match},
+    {"if-modified-since", boost::beast::http::field::if_modified_since},
+    {"if-match", boost::beast::http::field::if_match},
+    {"if-unmodified-since", boost::beast::http::field::if_unmodified_since},
+    {"if-range", boost::beast::http::field::if_range},
+    {"origin", boost::beast::http::field::origin},
+    {"referer", boost::beast::http::field::referer},
+    {"upgrade", boost::beast::http::field::upgrade},
+    {"sec-websocket-key", boost::beast::http::field::sec_websocket_key},
+    {"sec-websocket-version", boost::beast::http::field::sec_websocket_version},
+    {"sec-websocket-extensions",
+     boost::beast::http::field::sec_websocket_extensions},
+    {"sec-websocket-protocol",
+     boost::beast::http::field::sec_websocket_protocol},
+    {"transfer-encoding", boost::beast::http::field::transfer_encoding},
+    {"te", boost::beast::http::field::te},
+    {"pragma", boost::beast::http::field::pragma},
+    {"range", boost::beast::http::field::range},
+    {"expect", boost::beast::http::field::expect},
+    {"keep-alive", boost::beast::http::field::keep_alive},
+    {"forwarded", boost::beast::http::field::forwarded},
+    {"date", boost::beast::http::field::date},
+    {"via", boost::beast::http::field::via},
+}};
+
+constexpr std::array<known_field, known_field_slots> make_known_field_table() {
+  std::array<known_field, known_field_slots> table{};
+  for (const auto &known : known_fields) {
+    auto &slot = table[known_field_hash(known.name)];
+    if (!slot.name.empty()) {
+      throw "known_field_hash is not perfect for known_fields";
+    }
+    slot = known;
+  }
+  return table;
+}
+inline constexpr std::array<known_field, known_field_slots> known_field_table =
+    make_known_field_table();
+
+inline bool iequals_ascii(std::string_view lhs, std::string_view lower) {
+  if (lhs.size() != lower.size()) {
+    return false;
+  }
+  for (std::size_t i = 0; i < lhs.size(); ++i) {
+    if (fold(lhs[i]) != static_cast<unsigned char>(lower[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+} // namespace detail
+
+// Maps a header name to its beast field, the table of well known names is
+// probed first and boost::beast::http::string_to_field handles the rest
+inline boost::beast::http::field lookup_field(std::string_view name) {
+  // known_field_hash reads the first and last character
+  if (name.empty()) {
+    return boost::beast::http::field::unknown;
+  }
+  const auto &slot = detail::known_field_table[detail::known_field_hash(name)];
+  if (!slot.name.empty() && detail::iequals_ascii(name, slot.name)) {
+    return slot.field;
+  }
+  return boost::beast::http::string_to_field(name);
+}
+
+struct header_view {
+  boost::beast::http::field name;
+  std::string_view name_string;
+  std::string_view value;
+};
+
+// Views into the buffer a request head was parsed from
+struct request_head {
+  // Heads with more fields are left to beast
+  static constexpr std::size_t max_fields = 64;
+
+  std::string_view method;
+  std::string_view target;
+  unsigned version{11};
+  std::array<header_view, max_fields> fields;
+  std::size_t field_count{0};
+  std::optional<std::uint64_t> content_length;
+};
+
+enum class head_parse_status {
+  complete,
+  need_more,
+  // Input is malformed or uses a feature this parser does not implement
+  // (transfer codings, obs-fold, bare LF, CONNECT, ...)
+  fallback,
+};
+
+namespace detail {
+// Finds the end of the head: one past the CRLF CRLF. Any bare LF makes the
+// whole head a fallback, beast decides whether it is acceptable.
+inline head_parse_status find_head_end(std::string_view data,
+                                       std::size_t &head_size) {
+  std::size_t pos = 0;
+  while (true) {
+    pos = simd::find_any<'\n'>(data, pos);
+    if (pos == std::string_view::npos) {
+      return head_parse_status::need_more;
+    }
+    if (pos == 0 || data[pos - 1] != '\r') {
+      return head_parse_status::fallback;
+    }
+    if (pos + 2 >= data.size()) {
+      return head_parse_status::need_more;
+    }
+    if (data[pos + 1] == '\r' && data[pos + 2] == '\n') {
+      head_size = pos + 3;
+      return head_parse_status::complete;
+    }
+    ++pos;
+  }
+}
+
+// Strict form of the #token lists beast validates in Connection and
+// Proxy-Connection, empty elements are left to beast
+inline bool is_token_list(std::string_view value) {
+  std::size_t pos = 0;
+  while (true) {
+    const auto token_start = pos;
+    while (pos < value.size() && is_tchar(value[pos])) {
+      ++pos;
+    }
+    if (pos == token_start) {
+      return false;
+    }
+    while (pos < value.size() && (value[pos] == ' ' || value[pos] == '\t')) {
+      ++pos;
+    }
+    if (pos == value.size()) {
+      return true;
+    }
+    if (value[pos] != ',') {
+      return false;
+    }
+    ++pos;
+    while (pos < value.size() && (value[pos] == ' ' || value[pos] == '\t')) {
+      ++pos;
+    }
+  }
+}
+
+inline bool parse_content_length(std::string_view value,
+                                 std::uint64_t &length) {
+  // 19 digits always fit in uint64_t, longer values are left to beast
+  if (value.empty() || value.size() > 19) {
+    return false;
+  }
+  length = 0;
+  for (const char c : value) {
+    if (c < '0' || c > '9') {
+      return false;
+    }
+    length = length * 10 + static_cast<std::uint64_t>(c - '0');
+  }
+  return true;
+}
+} // namespace detail
+
+/**
+ * Parses an HTTP/1.x request head from the start of `data`.
+ *
+ * Accepts a strict subset of what beast accepts: tokens are validated against
+ * the tchar table, field values may only hold visible ASCII, SP and HTAB, and
+ * line endings must be CRLF. Everything outside that subset yields
+ * head_parse_status::fallback so the caller can let beast produce the exact
+ * same message or error. `head` holds views into `data` and does not
+ * allocate.
+ */
+inline head_parse_status parse_request_head(std::string_view data,
+                                            request_head &head,
+                                            std::size_t &head_size) {
+  const auto end_status = detail::find_head_end(data, head_size);
+  if (end_status != head_parse_status::complete) {
+    return end_status;
+  }
+  const auto head_data = data.substr(0, head_size);
+  head.field_count = 0;
+  head.content_length.reset();
+
+  // request-line = method SP request-target SP HTTP-version CRLF
+  std::size_t pos = 0;
+  while (pos < head_data.size() && detail::is_tchar(head_data[pos])) {
+    ++pos;
+  }
+  if (pos == 0 || head_data[pos] != ' ') {
+    return head_parse_status::fallback;
+  }
+  head.method = head_data.substr(0, pos);
+  if (head.method == "CONNECT") {
+    return head_parse_status::fallback;
+  }
+
+  const auto target_start = pos + 1;
+  const auto target_end = simd::find_any<' '>(head_data, target_start);
+  if (target_end == std::string_view::npos || target_end == target_start) {
+    return head_parse_status::fallback;
+  }
+  head.target = head_data.substr(target_start, target_end - target_start);
+  if (simd::find_control(head.target) != std::string_view::npos) {
+    return head_parse_status::fallback;
+  }
+
+  const auto version = head_data.substr(target_end + 1, 10);
+  if (version == "HTTP/1.1\r\n") {
+    head.version = 11;
+  } else if (version == "HTTP/1.0\r\n") {
+    head.version = 10;
+  } else {
+    return head_parse_status::fallback;
+  }
+  pos = target_end + 1 + version.size();
+
+  // field-line = field-name ":" OWS field-value OWS CRLF
+  while (head_data[pos] != '\r') {
+    const auto name_start = pos;
+    while (detail::is_tchar(head_data[pos])) {
+      ++pos;
+    }
+    if (pos == name_start || head_data[pos] != ':') {
+      return head_parse_status::fallback;
+    }
+    const auto name = head_data.substr(name_start, pos - name_start);
+    ++pos;
+    while (head_data[pos] == ' ' || head_data[pos] == '\t') {
+      ++pos;
+    }
+    const auto value_start = pos;
+    while (true) {
+      pos = simd::find_control(head_data, pos);
+      if (head_data[pos] != '\t') {
+        break;
+      }
+      ++pos;
+    }
+    if (head_data[pos] != '\r' || head_data[pos + 1] != '\n') {
+      return head_parse_status::fallback;
+    }
+    auto value_end = pos;
+    while (value_end > value_start && (head_data[value_end - 1] == ' ' ||
+                                       head_data[value_end - 1] == '\t')) {
+      --value_end;
+    }
+    pos += 2;
+
+    if (head.field_count == request_head::max_fields) {
+      return head_parse_status::fallback;
+    }
+    auto &field = head.fields[head.field_count++];
+    field.name = lookup_field(name);
+    field.name_string = name;
+    field.value = head_data.substr(value_start, value_end - value_start);
+
+    if (field.name == boost::beast::http::field::transfer_encoding) {
+      return head_parse_status::fallback;
+    }
+    if ((field.name == boost::beast::http::field::connection ||
+         field.name == boost::beast::http::field::proxy_connection) &&
+        !detail::is_token_list(field.value)) {
+      return head_parse_status::fallback;
+    }
+    if (field.name == boost::beast::http::field::content_length) {
+      std::uint64_t length{};
+      if (head.content_length.has_value() ||
+          !detail::parse_content_length(field.value, length)) {
+        return head_parse_status::fallback;
+      }
+      head.content_length = length;
+    }
+  }
+  // The '\r' that ended the loop must start the terminating CRLF
+  if (pos + 2 != head_data.size()) {
+    return head_parse_status::fallback;
+  }
+  return head_parse_status::complete;
+}
+
+/**
+ * Reads one request, parsing the head with parse_request_head.
+ *
+ * Bytes are never consumed from `buffer` until a request was fully parsed,
+ * so whenever the fast parser gives up (fallback, header or body limits,
+ * end of stream in the middle of a request)
+ * boost::beast::http::async_read re-reads the same bytes and its result is
+ * returned instead. Unlike beast a malformed line is only noticed once the
+ * head is complete or the header limit is reached. When the body fails,
+ * e.g. over body_limit, `req` holds the head so the error can be answered.
+ */
+template <class AsyncReadStream>
+inline boost::outcome_v2::result<void> read_request(
+    AsyncReadStream &stream, boost::beast::flat_buffer &buffer,
+    boost::beast::http::request<boost::beast::http::string_body> &req,
+    const request_limits &limits, boost::asio::yield_context yield) {
+  constexpr std::size_t max_read_size = 65536;
+  // Heads that reach the limit are left to beast, which owns the exact
+  // boundary behaviour
+  const auto fast_header_limit =
+      limits.header_limit > 0 ? limits.header_limit - 1 : 0;
+  boost::beast::error_code ec;
+  request_head head;
+  while (true) {
+    const std::string_view data{static_cast<const char *>(buffer.data().data()),
+                                buffer.size()};
+    std::size_t head_size = 0;
+    const auto status = parse_request_head(data.substr(0, fast_header_limit),
+                                           head, head_size);
+    if (status == head_parse_status::fallback ||
+        (status == head_parse_status::need_more &&
+         data.size() >= fast_header_limit) ||
+        (status == head_parse_status::complete &&
+         head.content_length.value_or(0) > limits.body_limit)) {
+      break;
+    }
+    if (status == head_parse_status::complete &&
+        data.size() - head_size >= head.content_length.value_or(0)) {
+      const auto body_size =
+          static_cast<std::size_t>(head.content_length.value_or(0));
+      req = {};
+      req.version(head.version);
+      if (const auto verb = boost::beast::http::string_to_verb(head.method);
+          verb != boost::beast::http::verb::unknown) {
+        req.method(verb);
+      } else {
+        req.method_string(head.method);
+      }
+      req.target(head.target);
+      for (std::size_t i = 0; i < head.field_count; ++i) {
+        const auto &field = head.fields[i];
+        req.insert(field.name, field.name_string, field.value);
+      }
+      req.body().assign(data.substr(head_size, body_size));
+      buffer.consume(head_size + body_size);
+      return boost::outcome_v2::success();
+    }
+
+    const auto bytes_read = stream.async_read_some(
+        buffer.prepare(boost::beast::read_size(buffer, max_read_size)),
+        yield[ec]);
+    if (ec == boost::asio::error::eof && buffer.size() == 0) {
+      // Same mapping as beast's parser
+      return boost::beast::http::error::end_of_stream;
+    }
+    if (ec == boost::asio::error::eof) {
+      // Beast validates lines before the head is complete, a truncated head
+      // may fail with a parse error instead of partial_message. It reads
+      // the end of stream again.
+      break;
+    }
+    if (ec) {
+      return ec;
+    }
+    buffer.commit(bytes_read);
+  }
+
+  boost::beast::http::request_parser<boost::beast::http::string_body> parser;
+  parser.header_limit(static_cast<std::uint32_t>(limits.header_limit));
+  parser.body_limit(limits.body_limit);
+  boost::beast::http::async_read(stream, buffer, parser, yield[ec]);
+  if (ec) {
+    if (parser.is_header_done()) {
+      req = parser.release();
+    }
+    return ec;
+  }
+  req = parser.release();
+  return boost::outcome_v2::success();
+}
+} // namespace cpp_http::server
@@ -0,0 +1,313 @@
+#pragma once
+#include "simd.hpp"
+#include <cstddef>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace cpp_http::server {
+inline int hex_digit_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+// Appends the percent-decoded form of `encoded` to `out`.
+// When `plus_as_space` is set '+' decodes to ' ', as it does in query strings
+// and form bodies. Malformed escapes are copied through verbatim.
+inline void percent_decode(std::string_view encoded, std::string &out,
+                           bool plus_as_space) {
+  out.reserve(out.size() + encoded.size());
+  std::size_t pos = 0;
+  while (pos < encoded.size()) {
+    const auto next = plus_as_space ? simd::find_any<'%', '+'>(encoded, pos)
+                                    : simd::find_any<'%'>(encoded, pos);
+    if (next == std::string_view::npos) {
+      out.append(encoded.substr(pos));
+      return;
+    }
+    out.append(encoded.substr(pos, next - pos));
+    if (encoded[next] == '+') {
+      out.push_back(' ');
+      pos = next + 1;
+      continue;
+    }
+    if (next + 2 < encoded.size()) {
+      const auto hi = hex_digit_value(encoded[next + 1]);
+      const auto lo = hex_digit_value(encoded[next + 2]);
+      if (hi >= 0 && lo >= 0) {
+        out.push_back(static_cast<char>((hi << 4) | lo));
+        pos = next + 3;
+        continue;
+      }
+    }
+    out.push_back('%');
+    pos = next + 1;
+  }
+}
+
+enum class params_syntax {
+  // key=value pairs separated by '&', '+' and %XX escapes are decoded
+  query,
+  // application/x-www-form-urlencoded, same grammar as query
+  form,
+  // Cookie header, pairs separated by ';', values are never decoded
+  cookie,
+};
+
+/**
+ * Lazily built index over a key/value parameter source.
+ *
+ * Entries are stored as offsets into the source rather than views so the
+ * index stays valid when the owning request is moved or copied, which may
+ * relocate the underlying bytes.
+ * Only keys or values that actually contain escapes get a decoded copy.
+ */
+class params_index {
+public:
+  static constexpr std::size_t not_decoded = static_cast<std::size_t>(-1);
+  struct entry {
+    std::size_t key_offset;
+    std::size_t key_size;
+    std::size_t value_offset;
+    std::size_t value_size;
+    std::size_t decoded_key;
+    std::size_t decoded_value;
+  };
+
+  [[nodiscard]] bool parsed() const { return parsed_; }
+  [[nodiscard]] const std::vector<entry> &entries() const { return entries_; }
+
+  void parse(std::string_view source, params_syntax syntax) {
+    entries_.clear();
+    decoded_.clear();
+    parsed_ = true;
+    if (syntax == params_syntax::cookie) {
+      parse_cookies(source);
+      return;
+    }
+    std::size_t start = 0;
+    std::size_t eq = std::string_view::npos;
+    bool key_escaped = false;
+    bool value_escaped = false;
+    std::size_t pos = 0;
+    while (true) {
+      pos = simd::find_any<'&', '=', '%', '+'>(source, pos);
+      if (pos == std::string_view::npos || source[pos] == '&') {
+        const auto end = pos == std::string_view::npos ? source.size() : pos;
+        add_entry(source, start, eq, end, key_escaped, value_escaped);
+        if (pos == std::string_view::npos) {
+          break;
+        }
+        start = pos + 1;
+        eq = std::string_view::npos;
+        key_escaped = false;
+        value_escaped = false;
+      } else if (source[pos] == '=') {
+        // Only the first '=' separates, later ones belong to the value
+        if (eq == std::string_view::npos) {
+          eq = pos;
+        }
+      } else if (eq == std::string_view::npos) {
+        key_escaped = true;
+      } else {
+        value_escaped = true;
+      }
+      ++pos;
+    }
+  }
+
+  [[nodiscard]] std::string_view key(std::string_view source,
+                                     const entry &e) const {
+    if (e.decoded_key != not_decoded) {
+      return decoded_[e.decoded_key];
+    }
+    return source.substr(e.key_offset, e.key_size);
+  }
+
+  [[nodiscard]] std::string_view value(std::string_view source,
+                                       const entry &e) const {
+    if (e.decoded_value != not_decoded) {
+      return decoded_[e.decoded_value];
+    }
+    return source.substr(e.value_offset, e.value_size);
+  }
+
+private:
+  std::size_t decode(std::string_view encoded) {
+    std::string out;
+    percent_decode(encoded, out, true);
+    decoded_.push_back(std::move(out));
+    return decoded_.size() - 1;
+  }
+
+  void add_entry(std::string_view source, std::size_t start, std::size_t eq,
+                 std::size_t end, bool key_escaped, bool value_escaped) {
+    if (start == end) {
+      return;
+    }
+    const auto key_end = eq == std::string_view::npos ? end : eq;
+    const auto value_start = eq == std::string_view::npos ? end : eq + 1;
+    entry e{start,
+            key_end - start,
+            value_start,
+            end - value_start,
+            not_decoded,
+            not_decoded};
+    if (key_escaped) {
+      e.decoded_key = decode(source.substr(e.key_offset, e.key_size));
+    }
+    if (value_escaped) {
+      e.decoded_value = decode(source.substr(e.value_offset, e.value_size));
+    }
+    entries_.push_back(e);
+  }
+
+  void parse_cookies(std::string_view source) {
+    constexpr std::string_view whitespace = " \t";
+    std::size_t start = 0;
+    while (start < source.size()) {
+      auto end = simd::find_any<';'>(source, start);
+      if (end == std::string_view::npos) {
+        end = source.size();
+      }
+      auto pair = source.substr(start, end - start);
+      start = end + 1;
+
+      const auto first = pair.find_first_not_of(whitespace);
+      if (first == std::string_view::npos) {
+        continue;
+      }
+      pair.remove_prefix(first);
+      pair.remove_suffix(pair.size() - pair.find_last_not_of(whitespace) - 1);
+
+      const auto eq = pair.find('=');
+      if (eq == std::string_view::npos || eq == 0) {
+        // RFC 6265 cookie-pairs always carry a name and a '='
+        continue;
+      }
+      auto name = pair.substr(0, eq);
+      name.remove_suffix(name.size() - name.find_last_not_of(whitespace) - 1);
+      auto value = pair.substr(eq + 1);
+      if (const auto value_start = value.find_first_not_of(whitespace);
+          value_start != std::string_view::npos) {
+        value.remove_prefix(value_start);
+      } else {
+        value = value.substr(value.size());
+      }
+      if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+        value = value.substr(1, value.size() - 2);
+      }
+      entries_.push_back(
+          entry{static_cast<std::size_t>(name.data() - source.data()),
+                name.size(),
+                static_cast<std::size_t>(value.data() - source.data()),
+                value.size(), not_decoded, not_decoded});
+    }
+  }
+
+  std::vector<entry> entries_;
+  std::vector<std::string> decoded_;
+  bool parsed_{false};
+};
+
+// Read-only view over a parsed params_index.
+// Returned keys and values point into the request or into the index's decoded
+// copies, they stay valid until the owning request is modified or destroyed.
+class params_view {
+public:
+  using value_type = std::pair<std::string_view, std::string_view>;
+
+  class iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = params_view::value_type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = value_type;
+
+    iterator() = default;
+    iterator(const params_view *view, std::size_t pos)
+        : view_(view), pos_(pos) {}
+
+    value_type operator*() const { return view_->at(pos_); }
+    iterator &operator++() {
+      ++pos_;
+      return *this;
+    }
+    iterator operator++(int) {
+      auto copy = *this;
+      ++pos_;
+      return copy;
+    }
+    bool operator==(const iterator &other) const { return pos_ == other.pos_; }
+    bool operator!=(const iterator &other) const { return pos_ != other.pos_; }
+
+  private:
+    const params_view *view_{nullptr};
+    std::size_t pos_{0};
+  };
+
+  params_view(const params_index &index, std::string_view source)
+      : index_(&index), source_(source) {}
+
+  [[nodiscard]] std::size_t size() const { return index_->entries().size(); }
+  [[nodiscard]] bool empty() const { return size() == 0; }
+  [[nodiscard]] iterator begin() const { return iterator{this, 0}; }
+  [[nodiscard]] iterator end() const { return iterator{this, size()}; }
+
+  [[nodiscard]] value_type at(std::size_t pos) const {
+    const auto &e = index_->entries()[pos];
+    return {index_->key(source_, e), index_->value(source_, e)};
+  }
+
+  // Value of the first parameter named `key`
+  [[nodiscard]] std::optional<std::string_view>
+  find(std::string_view key) const {
+    for (const auto &e : index_->entries()) {
+      if (index_->key(source_, e) == key) {
+        return index_->value(source_, e);
+      }
+    }
+    return std::nullopt;
+  }
+
+  [[nodiscard]] bool contains(std::string_view key) const {
+    return find(key).has_value();
+  }
+
+  [[nodiscard]] std::size_t count(std::string_view key) const {
+    std::size_t n = 0;
+    for (const auto &e : index_->entries()) {
+      n += index_->key(source_, e) == key ? 1 : 0;
+    }
+    return n;
+  }
+
+  // Values of every parameter named `key`, in source order
+  [[nodiscard]] std::vector<std::string_view>
+  find_all(std::string_view key) const {
+    std::vector<std::string_view> values;
+    for (const auto &e : index_->entries()) {
+      if (index_->key(source_, e) == key) {
+        values.push_back(index_->value(source_, e));
+      }
+    }
+    return values;
+  }
+
+private:
+  const params_index *index_;
+  std::string_view source_;
+};
+} // namespace cpp_http::server
@@ -0,0 +1,230 @@
+#pragma once
+#include "server/middleware.hpp"
+#include "server/request.hpp"
+#include "server/response.hpp"
+#include "server/service.hpp"
+#include "server/util.hpp"
+#include <algorithm>
+#include <atomic>
+#include <boost/asio/ip/address.hpp>
+#include <boost/beast/http/field.hpp>
+#include <boost/beast/http/status.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace cpp_http::server {
+enum class rate_limit_key {
+  // Remote address of the connection
+  client_ip,
+  // Value of rate_limit_options::header, requests without it share a bucket
+  header,
+  // One bucket per service the middleware layers, i.e. per route
+  route,
+};
+
+struct rate_limit_options {
+  double requests_per_second{100};
+  // Requests admitted back to back after an idle period
+  double burst{20};
+  rate_limit_key key{rate_limit_key::client_ip};
+  std::string header;
+  // Slots per row of the bucket table, rounded up to a power of two.
+  // Memory is 2 * slots * 8 bytes no matter how many distinct keys show up.
+  std::size_t slots{1 << 15};
+};
+
+/**
+ * Token bucket limiter, implemented as GCRA so each bucket is a single
+ * atomic "theoretical arrival time" refilled lock-free with a CAS.
+ *
+ * Keys are not stored. Like a count-min sketch each key hashes to one slot
+ * in each of two rows and the smaller arrival time is taken as its estimate,
+ * so colliding keys can only make each other stricter, never looser, and
+ * memory stays fixed for any number of clients.
+ */
+class rate_limiter {
+public:
+  using clock = std::chrono::steady_clock;
+
+  // Throws std::invalid_argument unless requests_per_second is positive
+  rate_limiter(double requests_per_second, double burst, std::size_t slots)
+      : interval_(checked_interval(requests_per_second)),
+        tolerance_(static_cast<std::int64_t>(
+            static_cast<double>(interval_) * std::max(burst - 1.0, 0.0))),
+        mask_(round_up_pow2(slots) - 1),
+        rows_(std::make_unique<std::atomic<std::int64_t>[]>(2 * (mask_ + 1))),
+        epoch_(clock::now()) {}
+
+  // Admits one request for `key_hash`, or returns how long the caller has to
+  // wait before the next one would be admitted
+  std::chrono::nanoseconds acquire(std::uint64_t key_hash,
+                                   clock::time_point at = clock::now()) {
+    const auto now =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(at - epoch_)
+            .count();
+    auto &first = rows_[key_hash & mask_];
+    auto &second = rows_[(mask_ + 1) + (mix(key_hash) & mask_)];
+    while (true) {
+      const auto first_tat = first.load(std::memory_order_relaxed);
+      const auto second_tat = second.load(std::memory_order_relaxed);
+      const bool first_is_min = first_tat <= second_tat;
+      auto &estimate = first_is_min ? first : second;
+      auto &other = first_is_min ? second : first;
+      auto tat = first_is_min ? first_tat : second_tat;
+      const auto base = std::max(tat, now);
+      if (base - tolerance_ > now) {
+        return std::chrono::nanoseconds{base - tolerance_ - now};
+      }
+      // Callers that saw the same arrival time race for one interval, the
+      // losers decide again on the advanced value
+      if (estimate.compare_exchange_weak(tat, base + interval_,
+                                         std::memory_order_relaxed)) {
+        // Conservative update: the other row only follows when it is
+        // behind the new estimate
+        raise(other, base + interval_);
+        return std::chrono::nanoseconds{0};
+      }
+    }
+  }
+
+  static std::uint64_t mix(std::uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+  }
+
+private:
+  static std::int64_t checked_interval(double requests_per_second) {
+    if (!(requests_per_second > 0)) {
+      throw std::invalid_argument(
+          "rate_limiter: requests_per_second must be positive");
+    }
+    return std::max<std::int64_t>(
+        static_cast<std::int64_t>(1e9 / requests_per_second), 1);
+  }
+
+  static std::size_t round_up_pow2(std::size_t n) {
+    std::size_t pow2 = 1;
+    while (pow2 < n) {
+      pow2 <<= 1;
+    }
+    return pow2;
+  }
+
+  static void raise(std::atomic<std::int64_t> &slot, std::int64_t value) {
+    auto current = slot.load(std::memory_order_relaxed);
+    while (current < value &&
+           !slot.compare_exchange_weak(current, value,
+                                       std::memory_order_relaxed)) {
+    }
+  }
+
+  std::int64_t interval_;
+  std::int64_t tolerance_;
+  std::size_t mask_;
+  std::unique_ptr<std::atomic<std::int64_t>[]> rows_;
+  clock::time_point epoch_;
+};
+
+class rate_limit_service : public service {
+  std::shared_ptr<rate_limiter> limiter_;
+  rate_limit_options options_;
+  // 429 serialized once, a rejection copies the header and shares the body
+  response::shared_response too_many_requests_;
+  std::uint64_t route_hash_;
+  std::unique_ptr<service> inner_;
+
+  std::uint64_t key_hash(const request &request) const {
+    switch (options_.key) {
+    case rate_limit_key::client_ip: {
+      const auto address = request.remote_endpoint_cref().address();
+      if (address.is_v4()) {
+        return rate_limiter::mix(address.to_v4().to_uint());
+      }
+      const auto bytes = address.to_v6().to_bytes();
+      std::uint64_t hash = 0;
+      for (const auto byte : bytes) {
+        hash = rate_limiter::mix(hash ^ byte);
+      }
+      return hash;
+    }
+    case rate_limit_key::header:
+      return rate_limiter::mix(std::hash<std::string_view>{}(
+          request.request_cref()[options_.header]));
+    case rate_limit_key::route:
+      return route_hash_;
+    }
+    return 0;
+  }
+
+public:
+  rate_limit_service(
+      std::shared_ptr<rate_limiter> limiter, rate_limit_options options,
+      response::shared_response too_many_requests,
+      std::uint64_t route_hash, std::unique_ptr<service> inner)
+      : limiter_(std::move(limiter)), options_(std::move(options)),
+        too_many_requests_(std::move(too_many_requests)),
+        route_hash_(route_hash), inner_(std::move(inner)) {}
+  ~rate_limit_service() override = default;
+
+  result<response>
+  handle_request(request &&request, boost::asio::yield_context yield) override {
+    const auto wait = limiter_->acquire(key_hash(request));
+    if (wait.count() == 0) {
+      return inner_->handle_request(std::move(request), yield);
+    }
+    const auto retry_after =
+        std::chrono::ceil<std::chrono::seconds>(wait).count();
+    auto res = too_many_requests_;
+    auto &header = res.header_ref();
+    header.version(request.request_cref().version());
+    header.set(boost::beast::http::field::connection,
+               request.request_cref().keep_alive() ? "keep-alive" : "close");
+    header.set(boost::beast::http::field::retry_after,
+               std::to_string(std::max<std::int64_t>(retry_after, 1)));
+    return response{std::move(res)};
+  }
+};
+
+// Rejects requests over the configured rate with 429 Too Many Requests
+// before the wrapped service runs
+class rate_limit_middleware : public middleware {
+  std::shared_ptr<rate_limiter> limiter_;
+  rate_limit_options options_;
+  response::shared_response too_many_requests_;
+  std::uint64_t layered_{0};
+
+  static response::shared_response make_too_many_requests() {
+    boost::beast::http::response_header<> header;
+    header.result(boost::beast::http::status::too_many_requests);
+    header.set(boost::beast::http::field::server, server_agent());
+    header.set(boost::beast::http::field::content_type, "text/plain");
+    return response::shared_response{
+        std::move(header),
+        std::make_shared<const std::string>("Too Many Requests")};
+  }
+
+public:
+  // Throws std::invalid_argument unless requests_per_second is positive
+  explicit rate_limit_middleware(rate_limit_options options)
+      : limiter_(std::make_shared<rate_limiter>(options.requests_per_second,
+                                                options.burst, options.slots)),
+        options_(std::move(options)),
+        too_many_requests_(make_too_many_requests()) {}
+  ~rate_limit_middleware() override = default;
+
+  std::unique_ptr<service> layer(std::unique_ptr<service> service) override {
+    return std::make_unique<rate_limit_service>(
+        limiter_, options_, too_many_requests_, rate_limiter::mix(++layered_),
+        std::move(service));
+  }
+};
+} // namespace cpp_http::server
@@ -1,17 +1,142 @@
 #pragma once
+#include "json_body.hpp"
+#include "server/errors.hpp"
+#include "server/params.hpp"
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/beast/core/string.hpp>
 #include <boost/beast/http.hpp>
+#include <boost/json/stream_parser.hpp>
+#include <boost/json/value.hpp>
+#include <boost/json/value_to.hpp>
 #include <boost/url.hpp>
+#include <atomic>
+#include <cstdint>
+#include <optional>
 #include <regex>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
+#include <utility>
 
 namespace cpp_http::server {
+// A value built on first access, guarded like a std::once_flag but without
+// a mutex: the first thread builds, threads racing with it yield until the
+// value is there, later accesses only load the state. Copies and moves take
+// the value along once it was built.
+template <typename T> class lazy_value {
+  enum : std::uint8_t { empty, building, ready };
+
+  std::optional<T> value_;
+  std::atomic<std::uint8_t> state_{empty};
+
+public:
+  lazy_value() = default;
+  explicit lazy_value(T value) : value_(std::move(value)), state_(ready) {}
+  lazy_value(const lazy_value &other)
+      : value_(other.is_ready() ? other.value_ : std::nullopt),
+        state_(value_.has_value() ? ready : empty) {}
+  lazy_value(lazy_value &&other) noexcept
+      : value_(other.is_ready() ? std::move(other.value_) : std::nullopt),
+        state_(value_.has_value() ? ready : empty) {}
+  lazy_value &operator=(const lazy_value &other) {
+    if (this != &other) {
+      value_ = other.is_ready() ? other.value_ : std::nullopt;
+      state_.store(value_.has_value() ? ready : empty,
+                   std::memory_order_release);
+    }
+    return *this;
+  }
+  lazy_value &operator=(lazy_value &&other) noexcept {
+    if (this != &other) {
+      value_ = other.is_ready() ? std::move(other.value_) : std::nullopt;
+      state_.store(value_.has_value() ? ready : empty,
+                   std::memory_order_release);
+    }
+    return *this;
+  }
+  ~lazy_value() = default;
+
+  [[nodiscard]] bool is_ready() const {
+    return state_.load(std::memory_order_acquire) == ready;
+  }
+
+  template <typename Build> const T &get(Build &&build) {
+    auto state = state_.load(std::memory_order_acquire);
+    while (state != ready) {
+      if (state == empty &&
+          state_.compare_exchange_weak(state, building,
+                                       std::memory_order_acquire)) {
+        try {
+          value_.emplace(build());
+        } catch (...) {
+          state_.store(empty, std::memory_order_release);
+          throw;
+        }
+        state_.store(ready, std::memory_order_release);
+        break;
+      }
+      if (state == building) {
+        std::this_thread::yield();
+        state = state_.load(std::memory_order_acquire);
+      }
+    }
+    return *value_;
+  }
+};
+
 class request {
   boost::beast::http::request<boost::beast::http::string_body> inner;
   std::string path;
   std::unordered_map<std::string, std::string> path_params;
   std::smatch matches;
-  std::unordered_multimap<std::string, std::string> query_params;
+  boost::asio::ip::tcp::endpoint remote_endpoint;
+  // Parsed on first access, most handlers never look at these. The const
+  // accessors may be called from several threads at once.
+  mutable lazy_value<params_index> query_params_;
+  mutable lazy_value<params_index> cookies_;
+  mutable lazy_value<params_index> form_params_;
+  mutable lazy_value<std::unordered_multimap<std::string, std::string>>
+      query_params_map_;
+  // Either parsed while the body was read or on the first json() call
+  mutable lazy_value<result<boost::json::value>> json_;
+
+  [[nodiscard]] std::string_view query_source() const {
+    const std::string_view target = inner.target();
+    const auto query_start = target.find('?');
+    if (query_start == std::string_view::npos) {
+      return {};
+    }
+    const auto query = target.substr(query_start + 1);
+    return query.substr(0, query.find('#'));
+  }
+
+  [[nodiscard]] std::string_view form_source() const {
+    constexpr std::string_view form_type = "application/x-www-form-urlencoded";
+    const std::string_view content_type =
+        inner[boost::beast::http::field::content_type];
+    // The media type has to match as a whole, parameters are ignored
+    auto media_type = content_type.substr(0, content_type.find(';'));
+    while (!media_type.empty() &&
+           (media_type.back() == ' ' || media_type.back() == '\t')) {
+      media_type.remove_suffix(1);
+    }
+    if (!boost::beast::iequals(media_type, form_type)) {
+      return {};
+    }
+    return inner.body();
+  }
+
+  static params_view lazy_view(lazy_value<params_index> &index,
+                               std::string_view source,
+                               params_syntax syntax) {
+    return params_view{index.get([source, syntax] {
+                         params_index parsed;
+                         parsed.parse(source, syntax);
+                         return parsed;
+                       }),
+                       source};
+  }
 
 public:
   explicit request(
@@ -19,9 +144,14 @@ public:
       : inner(std::move(req)) {
     const auto url_view = boost::urls::url_view{inner.target()};
     path = std::string(url_view.encoded_path());
-    for (auto param : url_view.params()) {
-      query_params.emplace(param.key, param.value);
-    }
+  }
+  // For bodies the server already parsed with json_body, `req` carries the
+  // header and an empty body
+  explicit request(
+      boost::beast::http::request<boost::beast::http::string_body> &&req,
+      boost::json::value json)
+      : request(std::move(req)) {
+    json_ = lazy_value<result<boost::json::value>>{std::move(json)};
   }
   request(const request &) = default;
   request &operator=(const request &) = default;
@@ -37,8 +167,75 @@ public:
   [[nodiscard]] constexpr auto &path_params_ref() { return path_params; }
   [[nodiscard]] constexpr const auto &matches_cref() const { return matches; }
   [[nodiscard]] constexpr auto &matches_ref() { return matches; }
-  [[nodiscard]] constexpr const auto &query_params_cref() const {
-    return query_params;
+  [[nodiscard]] const auto &remote_endpoint_cref() const {
+    return remote_endpoint;
+  }
+  [[nodiscard]] auto &remote_endpoint_ref() { return remote_endpoint; }
+
+  // Decoded query string parameters, parsed on first call
+  [[nodiscard]] params_view query_params() const {
+    return lazy_view(query_params_, query_source(), params_syntax::query);
+  }
+
+  // Query parameters as owned, decoded strings, built on first call. Kept
+  // for existing callers, query_params() does not copy.
+  [[nodiscard]] const std::unordered_multimap<std::string, std::string> &
+  query_params_cref() const {
+    return query_params_map_.get([this] {
+      std::unordered_multimap<std::string, std::string> params;
+      for (const auto &[key, value] : query_params()) {
+        params.emplace(key, value);
+      }
+      return params;
+    });
+  }
+
+  // Pairs from the Cookie header, parsed on first call
+  [[nodiscard]] params_view cookies() const {
+    return lazy_view(cookies_, inner[boost::beast::http::field::cookie],
+                     params_syntax::cookie);
+  }
+
+  // Decoded application/x-www-form-urlencoded body fields, parsed on first
+  // call. Empty for any other content type.
+  [[nodiscard]] params_view form_params() const {
+    return lazy_view(form_params_, form_source(), params_syntax::form);
+  }
+
+  // The body as JSON, parsed into a per-request arena on first call unless
+  // the server already parsed it while reading
+  [[nodiscard]] result<const boost::json::value *> json() const {
+    const auto &parsed =
+        json_.get([this]() -> result<boost::json::value> {
+          boost::json::stream_parser parser;
+          parser.reset(make_json_storage());
+          boost::system::error_code ec;
+          parser.write(inner.body().data(), inner.body().size(), ec);
+          if (!ec) {
+            parser.finish(ec);
+          }
+          if (ec) {
+            return ec;
+          }
+          return parser.release();
+        });
+    if (parsed.has_error()) {
+      return parsed.error();
+    }
+    return &parsed.value();
+  }
+
+  // The body converted to T through boost::json::value_to
+  template <typename T> [[nodiscard]] result<T> json_as() const {
+    auto value = json();
+    if (value.has_error()) {
+      return value.error();
+    }
+    auto converted = boost::json::try_value_to<T>(*value.value());
+    if (converted.has_error()) {
+      return converted.error();
+    }
+    return std::move(converted).value();
   }
 };
-} // namespace cpp_http::server
\ No newline at end of file
+} // namespace cpp_http::server
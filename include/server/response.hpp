@@ -1,12 +1,16 @@
 #pragma once
+#include "json_body.hpp"
 #include "message.hpp"
+#include "server/errors.hpp"
 #include "server/util.hpp"
 #include <algorithm>
 #include <boost/asio/buffer.hpp>
 #include <boost/asio/experimental/channel.hpp>
 #include <boost/asio/spawn.hpp>
 #include <boost/asio/write.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
 #include <boost/beast/core/tcp_stream.hpp>
+#include <boost/beast/http/buffer_body.hpp>
 #include <boost/beast/http/chunk_encode.hpp>
 #include <boost/beast/http/empty_body.hpp>
 #include <boost/beast/http/field.hpp>
@@ -17,19 +21,44 @@
 #include <boost/beast/http/message_generator.hpp>
 #include <boost/beast/http/status.hpp>
 #include <boost/beast/http/string_body_fwd.hpp>
+#include <boost/beast/http/vector_body_fwd.hpp>
 #include <boost/beast/http/write.hpp>
+#include <boost/json/value_from.hpp>
 #include <boost/smart_ptr/local_shared_ptr.hpp>
 #include <boost/system/detail/error_code.hpp>
+#include <functional>
+#include <memory>
+#include <string>
 #include <string_view>
+#include <type_traits>
 #include <utility>
 #include <variant>
 
 namespace cpp_http::server {
+// Bodies whose bytes already sit in memory, serializing them costs a copy
+// but no I/O
+template <class Body> struct is_in_memory_body : std::false_type {};
+template <class CharT, class Traits, class Allocator>
+struct is_in_memory_body<
+    boost::beast::http::basic_string_body<CharT, Traits, Allocator>>
+    : std::true_type {};
+template <class T, class Allocator>
+struct is_in_memory_body<boost::beast::http::vector_body<T, Allocator>>
+    : std::true_type {};
+template <>
+struct is_in_memory_body<boost::beast::http::empty_body> : std::true_type {};
+template <> struct is_in_memory_body<json_body> : std::true_type {};
+
 struct abstract_response {
   virtual ~abstract_response() = default;
   virtual boost::beast::http::response_header<> &header_ref() = 0;
   virtual const boost::beast::http::response_header<> &header_cref() const = 0;
   virtual boost::beast::http::message_generator to_generator() && = 0;
+  [[nodiscard]] virtual bool is_in_memory() const = 0;
+  // Runs the body through its writer like the serializer would and passes
+  // each piece to `sink`, without transfer coding
+  virtual boost::beast::error_code for_each_body_buffer(
+      const std::function<void(boost::asio::const_buffer)> &sink) = 0;
 };
 
 template <class Body> class response_impl : public abstract_response {
@@ -50,6 +79,31 @@ public:
     msg_.prepare_payload();
     return std::move(msg_);
   }
+
+  [[nodiscard]] bool is_in_memory() const override {
+    return is_in_memory_body<Body>::value;
+  }
+
+  boost::beast::error_code for_each_body_buffer(
+      const std::function<void(boost::asio::const_buffer)> &sink) override {
+    boost::beast::error_code ec;
+    typename Body::writer writer{msg_.base(), msg_.body()};
+    writer.init(ec);
+    while (!ec) {
+      auto piece = writer.get(ec);
+      if (ec || !piece) {
+        break;
+      }
+      for (auto it = boost::asio::buffer_sequence_begin(piece->first);
+           it != boost::asio::buffer_sequence_end(piece->first); ++it) {
+        sink(*it);
+      }
+      if (!piece->second) {
+        break;
+      }
+    }
+    return ec;
+  }
 };
 
 class mutable_response {
@@ -75,6 +129,22 @@ public:
   boost::beast::http::message_generator to_generator() && {
     return std::move(*impl_).to_generator();
   }
+
+  [[nodiscard]] bool is_in_memory() const { return impl_->is_in_memory(); }
+
+  // The body as it would go on the wire, minus any chunked framing
+  result<std::string> body_bytes() {
+    std::string bytes;
+    const auto ec = impl_->for_each_body_buffer(
+        [&bytes](boost::asio::const_buffer buffer) {
+          bytes.append(static_cast<const char *>(buffer.data()),
+                       buffer.size());
+        });
+    if (ec) {
+      return ec;
+    }
+    return bytes;
+  }
 };
 
 using streaming_channel = boost::asio::experimental::channel<void(
@@ -102,12 +172,60 @@ public:
     };
   };
 
+  // Hands the connection over to another protocol, see websocket_service.
+  // The handler gets the header as middleware left it, the stream and the
+  // bytes the session already read past the upgrade request.
+  struct upgrade_response {
+    using handler_t = std::function<void(
+        const boost::beast::http::response_header<> &,
+        boost::beast::tcp_stream &&, boost::beast::flat_buffer &&,
+        boost::asio::yield_context)>;
+    empty_response header_;
+    handler_t handler_;
+    explicit upgrade_response(empty_response header, handler_t handler)
+        : header_(std::move(header)), handler_(std::move(handler)) {}
+    boost::beast::http::response_header<> &header_ref() {
+      return header_.base();
+    }
+    const boost::beast::http::response_header<> &header_cref() const {
+      return header_.base();
+    };
+  };
+
+  // Header plus an immutable, already serialized body. Copies share the body
+  // bytes, so one result can be written to any number of connections, see
+  // singleflight_middleware.
+  struct shared_response {
+    boost::beast::http::response_header<> header_;
+    std::shared_ptr<const std::string> body_;
+    // The body is framed by its length. Answers to HEAD and 1xx, 204 and
+    // 304 answers have no body and keep the framing they came with.
+    explicit shared_response(boost::beast::http::response_header<> header,
+                             std::shared_ptr<const std::string> body,
+                             bool head_request = false)
+        : header_(std::move(header)), body_(std::move(body)) {
+      const auto status = header_.result_int();
+      if (!head_request && status >= 200 && status != 204 && status != 304) {
+        header_.chunked(false);
+        header_.content_length(body_->size());
+      }
+    }
+    boost::beast::http::response_header<> &header_ref() { return header_; }
+    const boost::beast::http::response_header<> &header_cref() const {
+      return header_;
+    };
+  };
+
 private:
-  std::variant<mutable_response, streaming_response> inner_;
+  std::variant<mutable_response, streaming_response, upgrade_response,
+               shared_response>
+      inner_;
 
 public:
   explicit response(mutable_response &&res) : inner_(std::move(res)) {}
   explicit response(streaming_response &&res) : inner_(std::move(res)) {}
+  explicit response(upgrade_response &&res) : inner_(std::move(res)) {}
+  explicit response(shared_response res) : inner_(std::move(res)) {}
   template <typename Response>
   explicit response(Response res)
       : response(mutable_response{std::move(res)}) {}
@@ -129,6 +247,14 @@ public:
                  [](const streaming_response &res)
                      -> boost::beast::http::response_header<> const & {
                    return res.header_cref();
+                 },
+                 [](const upgrade_response &res)
+                     -> boost::beast::http::response_header<> const & {
+                   return res.header_cref();
+                 },
+                 [](const shared_response &res)
+                     -> boost::beast::http::response_header<> const & {
+                   return res.header_cref();
                  }},
         inner_);
   }
@@ -141,6 +267,14 @@ public:
                                [](streaming_response &res)
                                    -> boost::beast::http::response_header<> & {
                                  return res.header_ref();
+                               },
+                               [](upgrade_response &res)
+                                   -> boost::beast::http::response_header<> & {
+                                 return res.header_ref();
+                               },
+                               [](shared_response &res)
+                                   -> boost::beast::http::response_header<> & {
+                                 return res.header_ref();
                                }},
                       inner_);
   }
@@ -153,7 +287,40 @@ public:
     std::visit(std::forward<F>(f), inner_);
   }
 
+  // Streaming and upgrade responses cannot be replayed
+  [[nodiscard]] bool is_shareable() const {
+    return std::holds_alternative<mutable_response>(inner_) ||
+           std::holds_alternative<shared_response>(inner_);
+  }
+
+  // Shareable without reading a file or other source, share() only copies
+  [[nodiscard]] bool has_in_memory_body() const {
+    if (const auto *res = std::get_if<mutable_response>(&inner_)) {
+      return res->is_in_memory();
+    }
+    return std::holds_alternative<shared_response>(inner_);
+  }
+
+  // Serializes the body once into a shared_response, is_shareable() must be
+  // true. `head_request` keeps the framing of a HEAD answer.
+  result<shared_response> share(bool head_request = false) && {
+    if (auto *shared = std::get_if<shared_response>(&inner_)) {
+      return std::move(*shared);
+    }
+    auto &res = std::get<mutable_response>(inner_);
+    auto body = res.body_bytes();
+    if (body.has_error()) {
+      return body.error();
+    }
+    return shared_response{
+        res.header_cref(),
+        std::make_shared<const std::string>(std::move(body).value()),
+        head_request};
+  }
+
+  // `buffer` holds what the session read ahead, an upgrade takes it over
   void async_write(boost::beast::tcp_stream &stream,
+                   boost::beast::flat_buffer &buffer,
                    boost::asio::yield_context yield) && {
     const auto async_write_basic_response =
         [&stream, yield](mutable_response &&response) {
@@ -177,10 +344,28 @@ public:
       boost::asio::async_write(stream, boost::beast::http::make_chunk_last(),
                                yield);
     };
+    // The handler takes the stream over, the session ends after it returns
+    const auto run_upgrade_response = [&stream, &buffer,
+                                       yield](upgrade_response response) {
+      response.handler_(response.header_cref(), std::move(stream),
+                        std::move(buffer), yield);
+    };
+    // Header and body go out in a single gather write, the body is only read
+    const auto async_write_shared_response = [&stream,
+                                              yield](shared_response response) {
+      boost::beast::http::response<boost::beast::http::buffer_body> res{
+          std::move(response.header_)};
+      res.body().data = const_cast<char *>(response.body_->data());
+      res.body().size = response.body_->size();
+      res.body().more = false;
+      boost::beast::http::async_write(stream, res, yield);
+    };
     std::visit(
         overload{
             async_write_basic_response,
             async_write_streaming_response,
+            run_upgrade_response,
+            async_write_shared_response,
         },
         std::move(inner_));
   }
@@ -248,6 +433,15 @@ public:
     return response{std::move(res)};
   }
 
+  // Serializes `value` with boost::json::value_from into a json_body, no
+  // intermediate string is produced
+  template <typename T> response json(const T &value) && {
+    header_.set(boost::beast::http::field::content_type, "application/json");
+    boost::beast::http::response<json_body> res{std::move(header_).base()};
+    res.body() = boost::json::value_from(value, make_json_storage());
+    return response{std::move(res)};
+  }
+
   empty_response empty() && { return std::move(header_); }
 
   response streaming(boost::local_shared_ptr<streaming_channel> rx) && {
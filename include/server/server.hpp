@@ -1,6 +1,9 @@
 #pragma once
+#include "json_body.hpp"
+#include "server/head_parser.hpp"
 #include "server/matcher.hpp"
 #include "server/request.hpp"
+#include "server/errors.hpp"
 #include "server/response.hpp"
 #include "server/service.hpp"
 #include "server/util.hpp"
@@ -22,6 +25,7 @@
 #include <cstdlib>
 #include <iostream>
 #include <memory>
+#include <optional>
 #include <string>
 #include <utility>
 #include <vector>
@@ -46,6 +50,9 @@ class server {
       delete_services_;
   std::vector<std::pair<std::unique_ptr<matcher>, std::unique_ptr<service>>>
       options_services_;
+  request_parser parser_{request_parser::beast};
+  request_limits limits_{};
+  bool parse_json_bodies_{false};
 
   inline response dispatch_request(request &&req,
                                             boost::asio::yield_context yield) {
@@ -85,6 +92,98 @@ class server {
     return response{not_found(request)};
   }
 
+  // Answers a request whose body could not be read with 413 when it is
+  // over body_limit and 400 when it is malformed JSON, the session closes
+  // afterwards. Other errors, e.g. a peer that went away, get no answer.
+  template <class Body>
+  void reject_body(boost::beast::tcp_stream &stream,
+                   const boost::beast::http::request<Body> &req,
+                   boost::beast::error_code ec,
+                   boost::asio::yield_context yield) {
+    const bool too_large = ec == boost::beast::http::error::body_limit;
+    if (!too_large && ec != boost::json::condition::parse_error) {
+      return;
+    }
+    auto res = bad_request(req, too_large ? "Payload Too Large"
+                                          : "Malformed JSON body");
+    if (too_large) {
+      res.result(boost::beast::http::status::payload_too_large);
+    }
+    res.keep_alive(false);
+    res.prepare_payload();
+    boost::beast::error_code write_ec;
+    boost::beast::http::async_write(stream, res, yield[write_ec]);
+  }
+
+  // The simd parser reads whole bodies, with parse_json_bodies on a JSON
+  // body is parsed afterwards into the same arena storage as json_body uses
+  // and taken out of `req`
+  result<std::optional<boost::json::value>> parse_json_body(
+      boost::beast::http::request<boost::beast::http::string_body> &req) {
+    if (!parse_json_bodies_ ||
+        !is_json_content_type(req[boost::beast::http::field::content_type])) {
+      return std::optional<boost::json::value>{};
+    }
+    boost::json::stream_parser parser;
+    parser.reset(make_json_storage());
+    boost::beast::error_code ec;
+    parser.write(req.body().data(), req.body().size(), ec);
+    if (!ec) {
+      parser.finish(ec);
+    }
+    if (ec) {
+      return ec;
+    }
+    req.body().clear();
+    return std::optional<boost::json::value>{parser.release()};
+  }
+
+  // Reads a request with beast. JSON bodies are parsed incrementally into
+  // a json_body when parse_json_bodies is on, the value is returned and
+  // `req` is left with an empty body. A body that cannot be read is
+  // answered by reject_body() before the error is returned.
+  result<std::optional<boost::json::value>> read_request_beast(
+      boost::beast::tcp_stream &stream, boost::beast::flat_buffer &buffer,
+      boost::beast::http::request<boost::beast::http::string_body> &req,
+      boost::asio::yield_context yield) {
+    boost::beast::error_code ec;
+    boost::beast::http::request_parser<boost::beast::http::empty_body>
+        header_parser;
+    header_parser.header_limit(static_cast<std::uint32_t>(limits_.header_limit));
+    header_parser.body_limit(limits_.body_limit);
+    boost::beast::http::async_read_header(stream, buffer, header_parser,
+                                          yield[ec]);
+    if (ec) {
+      return ec;
+    }
+    if (parse_json_bodies_ &&
+        is_json_content_type(
+            header_parser.get()[boost::beast::http::field::content_type])) {
+      boost::beast::http::request_parser<json_body> json_parser{
+          std::move(header_parser)};
+      json_parser.body_limit(limits_.body_limit);
+      boost::beast::http::async_read(stream, buffer, json_parser, yield[ec]);
+      if (ec) {
+        reject_body(stream, json_parser.get(), ec, yield);
+        return ec;
+      }
+      auto message = json_parser.release();
+      req = boost::beast::http::request<boost::beast::http::string_body>{
+          std::move(message.base())};
+      return std::optional<boost::json::value>{std::move(message.body())};
+    }
+    boost::beast::http::request_parser<boost::beast::http::string_body>
+        body_parser{std::move(header_parser)};
+    body_parser.body_limit(limits_.body_limit);
+    boost::beast::http::async_read(stream, buffer, body_parser, yield[ec]);
+    if (ec) {
+      reject_body(stream, body_parser.get(), ec, yield);
+      return ec;
+    }
+    req = body_parser.release();
+    return std::optional<boost::json::value>{};
+  }
+
   boost::outcome_v2::result<void>
   do_session(boost::asio::ip::tcp::socket socket,
              boost::asio::yield_context yield) {
@@ -93,6 +192,8 @@ class server {
 
     // This buffer is required to persist across reads
     boost::beast::flat_buffer buffer;
+    // Left unspecified if the peer is already gone, the first read fails then
+    const auto remote_endpoint = stream.socket().remote_endpoint(ec);
 
     // This lambda is used to send messages
     for (;;) {
@@ -101,13 +202,37 @@ class server {
 
       // Read a request
       boost::beast::http::request<boost::beast::http::string_body> req;
-      boost::beast::http::async_read(stream, buffer, req, yield[ec]);
+      std::optional<boost::json::value> json;
+      if (parser_ == request_parser::simd) {
+        auto read = read_request(stream, buffer, req, limits_, yield);
+        ec = read.has_error() ? read.error() : boost::beast::error_code{};
+        if (!ec) {
+          auto parsed = parse_json_body(req);
+          if (parsed.has_error()) {
+            ec = parsed.error();
+          } else {
+            json = std::move(parsed).value();
+          }
+        }
+        if (ec) {
+          reject_body(stream, req, ec, yield);
+        }
+      } else {
+        auto read = read_request_beast(stream, buffer, req, yield);
+        ec = read.has_error() ? read.error() : boost::beast::error_code{};
+        if (read.has_value()) {
+          json = std::move(read).value();
+        }
+      }
       stream.expires_never();
       if (ec) {
         break;
       }
 
-      auto request_wrapper = request(std::move(req));
+      auto request_wrapper = json.has_value()
+                                 ? request(std::move(req), std::move(*json))
+                                 : request(std::move(req));
+      request_wrapper.remote_endpoint_ref() = remote_endpoint;
       auto response = dispatch_request(std::move(request_wrapper), yield[ec]);
       if (ec) {
         break;
@@ -116,7 +241,7 @@ class server {
       bool keep_alive =
           response.header_cref()[boost::beast::http::field::connection] ==
           "keep-alive";
-      std::move(response).async_write(stream, yield[ec]);
+      std::move(response).async_write(stream, buffer, yield[ec]);
       if (ec) {
         std::cout << "exit with error: " << ec.message() << "\n";
         break;
@@ -194,6 +319,19 @@ public:
     do_listen(endpoint_, yield);
   }
 
+  // Picks the request head parser. Sessions read the setting for every
+  // request without synchronization, so call it before run().
+  inline void use_request_parser(request_parser parser) { parser_ = parser; }
+
+  inline void set_request_limits(request_limits limits) { limits_ = limits; }
+
+  // When enabled, application/json bodies read by the beast parser are fed
+  // to a boost::json::stream_parser as they arrive instead of being buffered,
+  // request::json() returns the value and request_cref().body() stays empty.
+  // The simd parser buffers the body and parses it once read, with the same
+  // result. Malformed JSON is answered with 400 either way.
+  inline void parse_json_bodies(bool enable) { parse_json_bodies_ = enable; }
+
   inline void register_service(boost::beast::http::verb method,
                                std::unique_ptr<matcher> matcher,
                                std::unique_ptr<service> service) {
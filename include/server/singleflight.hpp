@@ -0,0 +1,187 @@
+#pragma once
+#include "server/errors.hpp"
+#include "server/middleware.hpp"
+#include "server/request.hpp"
+#include "server/response.hpp"
+#include "server/service.hpp"
+#include <boost/asio/experimental/concurrent_channel.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/beast/http/verb.hpp>
+#include <boost/system/detail/error_code.hpp>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace cpp_http::server {
+struct singleflight_options {
+  // Request headers that must match besides method and target, e.g. Accept
+  // or Authorization when the response depends on them
+  std::vector<std::string> headers;
+};
+
+/**
+ * Coalesces identical in-flight GET and HEAD requests. The first request for
+ * a key runs the wrapped service, every request arriving before it finishes
+ * waits and gets a copy of the same response.
+ *
+ * The response is serialized once into a response::shared_response, so all
+ * waiters write the same body bytes. Waiters are resumed on their own
+ * executors, whichever thread the leader finished on. When the response
+ * cannot be shared (streaming, upgrades) or the leader went away without
+ * one, each waiter runs the service itself.
+ */
+class singleflight_service : public service {
+  using wakeup_channel = boost::asio::experimental::concurrent_channel<void(
+      boost::system::error_code)>;
+
+  struct flight {
+    // Set before the waiters are woken, empty means run the service yourself
+    std::optional<result<response::shared_response>> outcome;
+    std::vector<std::shared_ptr<wakeup_channel>> waiters;
+  };
+
+  // Publishes the leader's outcome even if the handler throws
+  class landing {
+    singleflight_service &owner_;
+    const std::string &key_;
+    std::shared_ptr<flight> flight_;
+    std::optional<result<response::shared_response>> outcome_;
+
+  public:
+    landing(singleflight_service &owner, const std::string &key,
+            std::shared_ptr<flight> flight)
+        : owner_(owner), key_(key), flight_(std::move(flight)) {}
+    landing(const landing &) = delete;
+    landing &operator=(const landing &) = delete;
+    ~landing() { owner_.land(key_, *flight_, std::move(outcome_)); }
+
+    void set(result<response::shared_response> outcome) {
+      outcome_ = std::move(outcome);
+    }
+  };
+
+  singleflight_options options_;
+  std::unique_ptr<service> inner_;
+  std::mutex mutex_;
+  std::unordered_map<std::string, std::shared_ptr<flight>> flights_;
+
+  std::string make_key(const request &request) const {
+    const auto &req = request.request_cref();
+    const std::string_view method = req.method_string();
+    const std::string_view target = req.target();
+    std::string key;
+    key.reserve(method.size() + target.size() + 1);
+    key.append(method).append(1, ' ').append(target);
+    for (const auto &name : options_.headers) {
+      const std::string_view value = req[name];
+      key.append(1, '\n').append(value);
+    }
+    return key;
+  }
+
+  void land(const std::string &key, flight &flight,
+            std::optional<result<response::shared_response>> outcome) {
+    std::vector<std::shared_ptr<wakeup_channel>> waiters;
+    {
+      std::lock_guard lock{mutex_};
+      flights_.erase(key);
+      flight.outcome = std::move(outcome);
+      waiters = std::move(flight.waiters);
+    }
+    for (const auto &waiter : waiters) {
+      // Buffered, the waiter may not have started waiting yet
+      waiter->try_send(boost::system::error_code{});
+    }
+  }
+
+  static response replay(const response::shared_response &shared,
+                         const request &request) {
+    auto copy = shared;
+    const auto &req = request.request_cref();
+    copy.header_ref().version(req.version());
+    // The leader's Connection answered the leader's request
+    copy.header_ref().set(boost::beast::http::field::connection,
+                          req.keep_alive() ? "keep-alive" : "close");
+    return response{std::move(copy)};
+  }
+
+public:
+  explicit singleflight_service(singleflight_options options,
+                                std::unique_ptr<service> inner)
+      : options_(std::move(options)), inner_(std::move(inner)) {}
+  ~singleflight_service() override = default;
+
+  result<response>
+  handle_request(request &&request, boost::asio::yield_context yield) override {
+    const auto method = request.request_cref().method();
+    if (method != boost::beast::http::verb::get &&
+        method != boost::beast::http::verb::head) {
+      return inner_->handle_request(std::move(request), yield);
+    }
+
+    auto key = make_key(request);
+    std::shared_ptr<flight> current;
+    std::shared_ptr<wakeup_channel> wakeup;
+    {
+      std::lock_guard lock{mutex_};
+      auto &slot = flights_[key];
+      if (slot) {
+        current = slot;
+        wakeup = std::make_shared<wakeup_channel>(yield.get_executor(), 1);
+        current->waiters.push_back(wakeup);
+      } else {
+        slot = std::make_shared<flight>();
+        current = slot;
+      }
+    }
+
+    if (wakeup) {
+      boost::system::error_code ec;
+      wakeup->async_receive(yield[ec]);
+      if (!ec && current->outcome.has_value()) {
+        const auto &outcome = current->outcome.value();
+        if (outcome.has_error()) {
+          return outcome.error();
+        }
+        return replay(outcome.value(), request);
+      }
+      return inner_->handle_request(std::move(request), yield);
+    }
+
+    landing landing{*this, key, current};
+    auto res = inner_->handle_request(std::move(request), yield);
+    if (res.has_error()) {
+      landing.set(res.error());
+      return res;
+    }
+    if (!res.value().is_shareable()) {
+      return res;
+    }
+    auto shared = std::move(res).value().share(
+        method == boost::beast::http::verb::head);
+    landing.set(shared);
+    if (shared.has_error()) {
+      return shared.error();
+    }
+    return response{std::move(shared).value()};
+  }
+};
+
+class singleflight_middleware : public middleware {
+  singleflight_options options_;
+
+public:
+  explicit singleflight_middleware(singleflight_options options = {})
+      : options_(std::move(options)) {}
+  ~singleflight_middleware() override = default;
+
+  std::unique_ptr<service> layer(std::unique_ptr<service> service) override {
+    return std::make_unique<singleflight_service>(options_, std::move(service));
+  }
+};
+} // namespace cpp_http::server
@@ -0,0 +1,432 @@
+#pragma once
+#include "server/errors.hpp"
+#include "server/request.hpp"
+#include "server/response.hpp"
+#include "server/service.hpp"
+#include "server/util.hpp"
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/append.hpp>
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/core/role.hpp>
+#include <boost/beast/core/tcp_stream.hpp>
+#include <boost/beast/http/field.hpp>
+#include <boost/beast/http/message.hpp>
+#include <boost/beast/http/status.hpp>
+#include <boost/beast/websocket.hpp>
+#include <boost/outcome/success_failure.hpp>
+#include <boost/smart_ptr/local_shared_ptr.hpp>
+#include <boost/smart_ptr/make_local_shared.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace cpp_http::server {
+struct websocket_options {
+  // Negotiate permessage-deflate (RFC 7692) when the client offers it
+  bool permessage_deflate{false};
+  // Keep the LZ77 window between messages. Better ratios for similar
+  // messages, at the cost of a live deflate stream per connection.
+  bool context_takeover{true};
+  // Window size, 2^window_bits bytes of history, 9 - 15
+  int window_bits{15};
+  // zlib compression level 0 - 9 and memory level 1 - 9
+  int compression_level{8};
+  int memory_level{4};
+  // Messages smaller than this are sent uncompressed
+  std::size_t compression_threshold{64};
+  // Largest message accepted from the peer
+  std::uint64_t max_message_size{16 * 1024 * 1024};
+  // Cap on bytes queued by send() and not yet written
+  std::size_t max_queued_bytes{4 * 1024 * 1024};
+};
+
+/**
+ * The connection after an upgrade. Reads return the bytes the HTTP session
+ * had read past the upgrade request first, e.g. a frame the client sent
+ * right behind its handshake, then go to the socket.
+ *
+ * Between cork() and uncork() writes complete right away and only collect
+ * their bytes, uncork() sends them in one socket write. The executor is a
+ * strand over the socket's, everything on the connection runs on it.
+ */
+class upgraded_stream {
+public:
+  using next_layer_type = boost::beast::tcp_stream;
+  using executor_type = boost::asio::any_io_executor;
+
+  upgraded_stream(next_layer_type &&stream, boost::beast::flat_buffer &&buffer)
+      : stream_(std::move(stream)),
+        strand_(boost::asio::make_strand(stream_.get_executor())),
+        buffer_(std::move(buffer)) {}
+
+  executor_type get_executor() { return strand_; }
+  next_layer_type &next_layer() { return stream_; }
+  const next_layer_type &next_layer() const { return stream_; }
+
+  template <class MutableBufferSequence, class ReadToken>
+  auto async_read_some(const MutableBufferSequence &buffers,
+                       ReadToken &&token) {
+    return boost::asio::async_initiate<ReadToken,
+                                       void(boost::beast::error_code,
+                                            std::size_t)>(
+        [this](auto handler, const MutableBufferSequence &buffers) {
+          if (buffer_.size() == 0) {
+            stream_.async_read_some(buffers, std::move(handler));
+            return;
+          }
+          const auto copied = boost::asio::buffer_copy(buffers, buffer_.data());
+          buffer_.consume(copied);
+          boost::asio::post(strand_,
+                            boost::asio::append(std::move(handler),
+                                                boost::beast::error_code{},
+                                                copied));
+        },
+        token, buffers);
+  }
+
+  template <class ConstBufferSequence, class WriteToken>
+  auto async_write_some(const ConstBufferSequence &buffers,
+                        WriteToken &&token) {
+    return boost::asio::async_initiate<WriteToken,
+                                       void(boost::beast::error_code,
+                                            std::size_t)>(
+        [this](auto handler, const ConstBufferSequence &buffers) {
+          if (!corked_) {
+            stream_.async_write_some(buffers, std::move(handler));
+            return;
+          }
+          const auto size = boost::asio::buffer_size(buffers);
+          const auto offset = corked_bytes_.size();
+          corked_bytes_.resize(offset + size);
+          boost::asio::buffer_copy(
+              boost::asio::buffer(corked_bytes_.data() + offset, size),
+              buffers);
+          boost::asio::post(strand_,
+                            boost::asio::append(std::move(handler),
+                                                boost::beast::error_code{},
+                                                size));
+        },
+        token, buffers);
+  }
+
+  void cork() { corked_ = true; }
+
+  // Writes what was collected since cork(). Writes made meanwhile, e.g. a
+  // pong, are collected too and go out in the next round.
+  boost::beast::error_code uncork(boost::asio::yield_context yield) {
+    boost::beast::error_code ec;
+    while (!corked_bytes_.empty() && !ec) {
+      writing_.swap(corked_bytes_);
+      boost::asio::async_write(stream_, boost::asio::buffer(writing_),
+                               yield[ec]);
+      writing_.clear();
+    }
+    corked_bytes_.clear();
+    corked_ = false;
+    return ec;
+  }
+
+private:
+  next_layer_type stream_;
+  executor_type strand_;
+  boost::beast::flat_buffer buffer_;
+  bool corked_{false};
+  std::string corked_bytes_;
+  std::string writing_;
+};
+
+// Closing the WebSocket tears down the TCP connection underneath
+inline void teardown(boost::beast::role_type role, upgraded_stream &stream,
+                     boost::beast::error_code &ec) {
+  using boost::beast::websocket::teardown;
+  teardown(role, stream.next_layer(), ec);
+}
+
+template <class TeardownHandler>
+void async_teardown(boost::beast::role_type role, upgraded_stream &stream,
+                    TeardownHandler &&handler) {
+  using boost::beast::websocket::async_teardown;
+  async_teardown(role, stream.next_layer(),
+                 std::forward<TeardownHandler>(handler));
+}
+
+/**
+ * One upgraded connection.
+ *
+ * send() only queues, a writer coroutine owned by the session drains the
+ * queue. Each message is its own frame, the frames of everything queued go
+ * out corked in one socket write.
+ *
+ * The session lives on the strand of its stream, see get_executor(). The
+ * reader and writer run there, send() and close() have to be called there
+ * too, e.g. through boost::asio::dispatch from other connections.
+ */
+class websocket_session {
+public:
+  using stream_type = boost::beast::websocket::stream<upgraded_stream>;
+
+  explicit websocket_session(upgraded_stream &&stream,
+                             const websocket_options &options)
+      : ws_(std::move(stream)), wakeup_(ws_.get_executor()),
+        max_queued_bytes_(options.max_queued_bytes) {
+    wakeup_.expires_at(boost::asio::steady_timer::time_point::max());
+  }
+  websocket_session(const websocket_session &) = delete;
+  websocket_session &operator=(const websocket_session &) = delete;
+  websocket_session(websocket_session &&) = delete;
+  websocket_session &operator=(websocket_session &&) = delete;
+  ~websocket_session() = default;
+
+  // Queues a message. Fails once the connection is closing or when the
+  // queue would grow past websocket_options::max_queued_bytes.
+  result<void> send(std::string message, bool binary = false) {
+    if (!open_ || close_requested_) {
+      return boost::beast::websocket::error::closed;
+    }
+    if (queued_bytes_ + message.size() > max_queued_bytes_) {
+      return boost::asio::error::no_buffer_space;
+    }
+    queued_bytes_ += message.size();
+    queue_.push_back(outgoing{std::move(message), binary});
+    wakeup_.cancel();
+    return outcome::success();
+  }
+
+  // Sends a close frame once everything queued so far has been written
+  void close() {
+    close_requested_ = true;
+    wakeup_.cancel();
+  }
+
+  [[nodiscard]] bool is_open() const { return open_ && !close_requested_; }
+  [[nodiscard]] std::size_t queued_bytes() const { return queued_bytes_; }
+  [[nodiscard]] stream_type &stream_ref() { return ws_; }
+  [[nodiscard]] upgraded_stream::executor_type get_executor() {
+    return ws_.get_executor();
+  }
+
+private:
+  friend class websocket_service;
+
+  struct outgoing {
+    std::string payload;
+    bool binary;
+  };
+
+  void run_writer(boost::asio::yield_context yield) {
+    boost::beast::error_code ec;
+    while (true) {
+      if (!queue_.empty() && open_) {
+        ws_.next_layer().cork();
+        while (!queue_.empty() && open_) {
+          auto message = std::move(queue_.front());
+          queue_.pop_front();
+          queued_bytes_ -= message.payload.size();
+          ws_.binary(message.binary);
+          ws_.async_write(boost::asio::buffer(message.payload), yield[ec]);
+          if (ec) {
+            open_ = false;
+          }
+        }
+        if (ws_.next_layer().uncork(yield)) {
+          open_ = false;
+        }
+      }
+      if (!open_ || close_requested_) {
+        break;
+      }
+      wakeup_.async_wait(yield[ec]);
+    }
+    queue_.clear();
+    queued_bytes_ = 0;
+    if (open_ && close_requested_) {
+      ws_.async_close(boost::beast::websocket::close_code::normal, yield[ec]);
+    }
+  }
+
+  // Called by the reader once the peer is gone
+  void stop() {
+    open_ = false;
+    wakeup_.cancel();
+  }
+
+  stream_type ws_;
+  boost::asio::steady_timer wakeup_;
+  std::deque<outgoing> queue_;
+  std::size_t queued_bytes_{0};
+  std::size_t max_queued_bytes_;
+  bool open_{true};
+  bool close_requested_{false};
+};
+
+/**
+ * Accepts WebSocket upgrades on a route registered like any other service,
+ * e.g. server.get("/ws", std::make_unique<my_websocket_service>()).
+ *
+ * After the handshake the connection leaves the HTTP session loop, every
+ * message from the peer goes to on_message() and replies are queued with
+ * websocket_session::send().
+ */
+class websocket_service : public service {
+public:
+  using session_ptr = boost::local_shared_ptr<websocket_session>;
+
+  explicit websocket_service(websocket_options options = {})
+      : options_(options) {}
+  ~websocket_service() override = default;
+
+  // Called after the handshake, an error closes the connection
+  virtual result<void> on_open(const session_ptr &session,
+                               const request &request,
+                               boost::asio::yield_context yield) {
+    return outcome::success();
+  }
+
+  // Called for every complete message, an error closes the connection
+  virtual result<void> on_message(const session_ptr &session,
+                                  std::string_view message, bool binary,
+                                  boost::asio::yield_context yield) = 0;
+
+  // Called once the connection is gone, `ec` is the read error that ended it
+  virtual void on_close(const session_ptr &session,
+                        boost::beast::error_code ec) {}
+
+  result<response>
+  handle_request(request &&request, boost::asio::yield_context yield) final {
+    if (!boost::beast::websocket::is_upgrade(request.request_cref())) {
+      return response{
+          bad_request(request.request_cref(), "Expected a WebSocket upgrade")};
+    }
+    auto header = std::move(response_builder{}
+                                .status(boost::beast::http::status::
+                                            switching_protocols)
+                                .version(request.request_cref().version())
+                                .set(boost::beast::http::field::connection,
+                                     "upgrade"))
+                      .empty();
+    return response{response::upgrade_response{
+        std::move(header),
+        [this, request = std::move(request)](
+            const boost::beast::http::response_header<> &header,
+            boost::beast::tcp_stream &&stream,
+            boost::beast::flat_buffer &&buffer,
+            boost::asio::yield_context yield) {
+          run(header, upgraded_stream{std::move(stream), std::move(buffer)},
+              request, yield);
+        }}};
+  }
+
+private:
+  void run(const boost::beast::http::response_header<> &header,
+           upgraded_stream &&stream, const request &request,
+           boost::asio::yield_context yield) {
+    // The HTTP session waits while the connection is served on its strand.
+    // The session is created there, its reference count is not atomic.
+    const auto strand = stream.get_executor();
+    boost::asio::spawn(
+        strand,
+        [&](boost::asio::yield_context on_strand) {
+          serve(header, std::move(stream), request, on_strand);
+        },
+        yield);
+  }
+
+  void serve(const boost::beast::http::response_header<> &header,
+             upgraded_stream &&stream, const request &request,
+             boost::asio::yield_context yield) {
+    boost::beast::error_code ec;
+    auto session =
+        boost::make_local_shared<websocket_session>(std::move(stream), options_);
+    auto &ws = session->stream_ref();
+    boost::beast::get_lowest_layer(ws).expires_never();
+    ws.set_option(boost::beast::websocket::stream_base::timeout::suggested(
+        boost::beast::role_type::server));
+    // Fields of the upgrade response, including what middleware added, go
+    // out with the handshake. Beast owns the handshake and framing fields.
+    ws.set_option(boost::beast::websocket::stream_base::decorator(
+        [header](boost::beast::websocket::response_type &res) {
+          res.set(boost::beast::http::field::server, server_agent());
+          for (const auto &field : header) {
+            switch (field.name()) {
+            case boost::beast::http::field::connection:
+            case boost::beast::http::field::upgrade:
+            case boost::beast::http::field::sec_websocket_accept:
+            case boost::beast::http::field::sec_websocket_extensions:
+            case boost::beast::http::field::content_length:
+            case boost::beast::http::field::transfer_encoding:
+              break;
+            case boost::beast::http::field::server:
+              res.set(field.name(), field.value());
+              break;
+            default:
+              res.insert(field.name_string(), field.value());
+              break;
+            }
+          }
+        }));
+    if (options_.permessage_deflate) {
+      boost::beast::websocket::permessage_deflate pmd;
+      pmd.server_enable = true;
+      pmd.server_max_window_bits = options_.window_bits;
+      pmd.server_no_context_takeover = !options_.context_takeover;
+      pmd.client_no_context_takeover = !options_.context_takeover;
+      pmd.compLevel = options_.compression_level;
+      pmd.memLevel = options_.memory_level;
+      pmd.msg_size_threshold = options_.compression_threshold;
+      ws.set_option(pmd);
+    }
+    ws.read_message_max(options_.max_message_size);
+    // One frame per message
+    ws.auto_fragment(false);
+
+    ws.async_accept(request.request_cref(), yield[ec]);
+    if (ec) {
+      return;
+    }
+    boost::asio::spawn(
+        ws.get_executor(),
+        [session](boost::asio::yield_context yield) {
+          session->run_writer(yield);
+        },
+        boost::asio::detached);
+
+    if (auto opened = on_open(session, request, yield); opened.has_error()) {
+      session->close();
+      return;
+    }
+
+    boost::beast::flat_buffer buffer;
+    while (true) {
+      ws.async_read(buffer, yield[ec]);
+      if (ec) {
+        break;
+      }
+      const auto data = buffer.cdata();
+      auto handled = on_message(
+          session,
+          std::string_view{static_cast<const char *>(data.data()), data.size()},
+          ws.got_binary(), yield);
+      buffer.consume(buffer.size());
+      if (handled.has_error()) {
+        session->close();
+      }
+    }
+    session->stop();
+    on_close(session, ec);
+  }
+
+  websocket_options options_;
+};
+} // namespace cpp_http::server
@@ -0,0 +1,124 @@
+#pragma once
+#include <cstddef>
+#include <string_view>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace cpp_http::simd {
+namespace detail {
+#if defined(__AVX2__)
+template <char... Needles> inline __m256i match_any(__m256i chunk) {
+  __m256i hits = _mm256_setzero_si256();
+  ((hits = _mm256_or_si256(hits,
+                           _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(Needles)))),
+   ...);
+  return hits;
+}
+#endif
+#if defined(__SSE2__)
+template <char... Needles> inline __m128i match_any(__m128i chunk) {
+  __m128i hits = _mm_setzero_si128();
+  ((hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(Needles)))),
+   ...);
+  return hits;
+}
+#endif
+} // namespace detail
+
+// Returns the index of the first byte at or after `pos` that equals one of
+// `Needles`, or std::string_view::npos if there is none.
+// Uses 32 byte AVX2 or 16 byte SSE2 strides when the target supports them,
+// the tail is always scanned bytewise.
+template <char... Needles>
+inline std::size_t find_any(std::string_view data, std::size_t pos = 0) {
+  static_assert(sizeof...(Needles) > 0, "at least one needle is required");
+  const char *const begin = data.data();
+  const std::size_t size = data.size();
+#if defined(__AVX2__)
+  for (; pos + 32 <= size; pos += 32) {
+    const auto chunk =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(begin + pos));
+    const auto mask = static_cast<unsigned>(
+        _mm256_movemask_epi8(detail::match_any<Needles...>(chunk)));
+    if (mask != 0) {
+      return pos + static_cast<std::size_t>(__builtin_ctz(mask));
+    }
+  }
+#endif
+#if defined(__SSE2__)
+  for (; pos + 16 <= size; pos += 16) {
+    const auto chunk =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin + pos));
+    const auto mask = static_cast<unsigned>(
+        _mm_movemask_epi8(detail::match_any<Needles...>(chunk)));
+    if (mask != 0) {
+      return pos + static_cast<std::size_t>(__builtin_ctz(mask));
+    }
+  }
+#endif
+  for (; pos < size; ++pos) {
+    const char c = begin[pos];
+    if (((c == Needles) || ...)) {
+      return pos;
+    }
+  }
+  return std::string_view::npos;
+}
+
+// Returns the index of the first byte at or after `pos` that is not visible
+// ASCII or space, i.e. a control character (including HTAB, CR and LF), DEL
+// or obs-text, or std::string_view::npos if there is none.
+inline std::size_t find_control(std::string_view data, std::size_t pos = 0) {
+  const char *const begin = data.data();
+  const std::size_t size = data.size();
+#if defined(__AVX2__)
+  for (; pos + 32 <= size; pos += 32) {
+    const auto chunk =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(begin + pos));
+    // Signed compare, so obs-text (0x80 - 0xff) counts as below ' ' as well
+    const auto hits = _mm256_or_si256(
+        _mm256_cmpgt_epi8(_mm256_set1_epi8(0x20), chunk),
+        _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(0x7f)));
+    const auto mask = static_cast<unsigned>(_mm256_movemask_epi8(hits));
+    if (mask != 0) {
+      return pos + static_cast<std::size_t>(__builtin_ctz(mask));
+    }
+  }
+#endif
+#if defined(__SSE4_2__)
+  const auto ranges = _mm_setr_epi8(0x00, 0x1f, 0x7f, static_cast<char>(0xff),
+                                    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+  for (; pos + 16 <= size; pos += 16) {
+    const auto chunk =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin + pos));
+    const int index =
+        _mm_cmpestri(ranges, 4, chunk, 16,
+                     _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES |
+                         _SIDD_LEAST_SIGNIFICANT);
+    if (index != 16) {
+      return pos + static_cast<std::size_t>(index);
+    }
+  }
+#elif defined(__SSE2__)
+  for (; pos + 16 <= size; pos += 16) {
+    const auto chunk =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin + pos));
+    const auto hits =
+        _mm_or_si128(_mm_cmplt_epi8(chunk, _mm_set1_epi8(0x20)),
+                     _mm_cmpeq_epi8(chunk, _mm_set1_epi8(0x7f)));
+    const auto mask = static_cast<unsigned>(_mm_movemask_epi8(hits));
+    if (mask != 0) {
+      return pos + static_cast<std::size_t>(__builtin_ctz(mask));
+    }
+  }
+#endif
+  for (; pos < size; ++pos) {
+    const auto c = static_cast<unsigned char>(begin[pos]);
+    if (c < 0x20 || c >= 0x7f) {
+      return pos;
+    }
+  }
+  return std::string_view::npos;
+}
+} // namespace cpp_http::simd